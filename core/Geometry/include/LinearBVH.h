@@ -0,0 +1,277 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "Platform/include/RYAO.h"
+#include <utility>
+#include <vector>
+
+namespace Ryao {
+
+// the traversal stack is a fixed size array, so no branch of the tree is
+// allowed to go deeper than this. Anything left at this depth becomes one leaf.
+#define BVH_MAX_DEPTH 64
+
+// how many bins the surface area heuristic sorts centroids into
+#define BVH_SAH_BINS 16
+
+// the cost of testing one node's box, relative to handing one primitive to the narrow
+// phase, which has to compute an actual point-triangle or edge-edge distance
+#define BVH_SAH_TRAVERSAL_COST 0.25
+
+// default for the largest leaf the builder will make when a split is still possible
+#define BVH_MAX_LEAF_SIZE 4
+
+// subtrees over at least this many primitives get built as their own tasks
+#define BVH_PARALLEL_BUILD_SIZE 4096
+
+// default for how much worse than a fresh build the SAH cost of a refit tree can get
+// before refit() builds it again from scratch
+#define BVH_REBUILD_RATIO 2.0
+
+// tree-vs-tree traversals split the top this many levels into separate jobs,
+// which are then handed out to the threads
+#define BVH_TASK_DEPTH 8
+
+// a node of LinearBVH. An interior node's first child is the next node in the
+// array, and offset is its second child. A leaf stores its primitives as the
+// range [offset, offset + count) of the permuted primitive array.
+struct LinearBVHNode {
+    int offset;
+    int count;
+
+    bool isLeaf() const { return count > 0; };
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// A flattened bounding volume hierarchy over surface triangles, edges or vertices, with the
+// same query API as AABBTree
+//
+// The nodes sit in one array in depth-first order, so the left child is always the next
+// node, and the traversal is a loop with a small stack instead of a recursion through
+// pointers. The leaves don't own index lists; they point into a single array of primitive
+// indices, permuted so that every leaf's primitives are contiguous.
+//
+// The bounds are stored separately from the nodes, one float array per axis for the mins
+// and for the maxs, so a traversal only pulls in the bounds it actually tests. They are
+// rounded outwards when they're converted to float, so they stay conservative.
+//
+// The tree is built top-down with the binned surface area heuristic from
+// "On fast Construction of SAH-based Bounding Volume Hierarchies", Wald 2007:
+// primitive centroids are sorted into BVH_SAH_BINS bins along the axis they're most
+// spread out along, and the cheapest split between bins wins, unless a leaf would be
+// cheaper. Large subtrees
+// are built as OpenMP tasks and spliced into the array afterwards.
+//
+// refit() only updates the bounds, and the tree gets worse as the mesh deforms away
+// from the pose it was built in. When the SAH cost climbs past rebuildRatio() times
+// what the last build had, refit() builds the tree again.
+//
+// The refit itself goes from the leaves up, in parallel. Every leaf's thread walks towards
+// the root, and counts itself in at each parent. The first child to arrive stops there,
+// and the second one, which knows both children are done, refits the parent and carries on.
+// Passing refit() the mesh's positions version skips the refit when the vertices haven't
+// moved since the last one.
+//
+// overlappingPairs() and selfOverlappingPairs() walk two trees, or a tree and itself,
+// simultaneously, so a whole broad phase is one traversal instead of one query per primitive.
+// A node pair that overlaps splits whichever of the two boxes is bigger. The first
+// BVH_TASK_DEPTH levels of that are done serially, and leave a list of subtree pairs that
+// the threads traverse in parallel. Each one fills its own list of pairs, and the lists are
+// joined in order, so the output doesn't depend on the thread count.
+/////////////////////////////////////////////////////////////////////////////////////////////
+class LinearBVH {
+public:
+    LinearBVH(const std::vector<VECTOR3>& vertices, const std::vector<VECTOR3I>* surfaceTriangles,
+              const int maxLeafSize = BVH_MAX_LEAF_SIZE);
+    LinearBVH(const std::vector<VECTOR3>& vertices, const std::vector<VECTOR2I>* surfaceEdges,
+              const int maxLeafSize = BVH_MAX_LEAF_SIZE);
+    LinearBVH(const std::vector<VECTOR3>& vertices, const std::vector<int>* surfaceVertices,
+              const int maxLeafSize = BVH_MAX_LEAF_SIZE);
+
+    // return a list of potential triangles nearby a vertex, subject to a distance threshold
+    void nearbyTriangles(const VECTOR3& vertex, const REAL& eps, std::vector<int>& faces) const;
+
+    // return a list of potential triangles nearby an edge, subject to a distance threshold
+    void nearbyTriangles(const VECTOR2I& edge, const REAL& eps, std::vector<int>& faces) const;
+
+    // return a list of potential triangles nearby a box, subject to a distance threshold
+    void nearbyTriangles(const VECTOR3& mins, const VECTOR3& maxs, const REAL& eps, std::vector<int>& faces) const;
+
+    // return a list of potential edges nearby an edge, subject to a distance threshold
+    void nearbyEdges(const VECTOR2I& edge, const REAL& eps, std::vector<int>& edges) const;
+
+    // return every pair of a primitive here and a primitive in other whose boxes come within
+    // eps of each other, as (this index, other index). Pairs that share a vertex are left out,
+    // so both trees have to be over the same vertices.
+    void overlappingPairs(const LinearBVH& other, const REAL& eps,
+                          std::vector<std::pair<int, int> >& pairs) const;
+
+    // the same, but between the primitives of this tree, with each pair appearing once,
+    // smaller index first
+    void selfOverlappingPairs(const REAL& eps, std::vector<std::pair<int, int> >& pairs) const;
+
+    // refit the bounding boxes, presumably because the vertices moved,
+    // and rebuild if that made the tree too much worse
+    void refit();
+
+    // the same, unless the tree has already been refit for this positionsVersion
+    void refit(const int positionsVersion);
+
+    // build the tree from scratch around the current vertex positions
+    void rebuild();
+
+    // the expected cost of a query, in units of one primitive handed to the narrow phase,
+    // for the current bounds
+    REAL sahCost() const;
+
+    const std::vector<LinearBVHNode>& nodes() const { return _nodes; };
+    int totalNodes() const                          { return _nodes.size(); };
+    int totalPrimitives() const;
+    int totalRebuilds() const                       { return _totalRebuilds; };
+
+    // SAH cost and wall clock seconds of the last build
+    REAL builtSAHCost() const                       { return _builtSAHCost; };
+    REAL buildTime() const                          { return _buildTime; };
+
+    // largest leaf the builder makes, takes effect at the next rebuild()
+    int& maxLeafSize()                              { return _maxLeafSize; };
+
+    // rebuild when the SAH cost gets this many times worse, zero never rebuilds
+    REAL& rebuildRatio()                            { return _rebuildRatio; };
+
+private:
+    // a node of this tree and a node of the other one, still to be traversed. In a self
+    // traversal, a == b means everything inside that subtree
+    struct NodePair {
+        int a;
+        int b;
+    };
+
+    // a node while the tree is being built, with full precision bounds
+    struct BuildNode {
+        VECTOR3 mins, maxs;
+        int offset;
+        int count;
+    };
+
+    // the bounds and centroid of every primitive, gathered once per build
+    struct BuildPrimitives {
+        std::vector<VECTOR3> mins, maxs, centers;
+    };
+
+    // build the whole tree over the primitives
+    void build();
+
+    // build the subtree over _primitives[begin, end) into the end of nodes, with offsets
+    // relative to the start of nodes
+    void buildNode(const int begin, const int end, const int depth,
+                   const BuildPrimitives& primitives, std::vector<BuildNode>& nodes);
+
+    // find the cheapest binned SAH split of _primitives[begin, end), and return its cost
+    // in units of one primitive. Returns a negative axis if there's no split.
+    REAL findSAHSplit(const int begin, const int end, const VECTOR3& mins, const VECTOR3& maxs,
+                      const VECTOR3& centerMins, const VECTOR3& centerMaxs,
+                      const BuildPrimitives& primitives, int& axis, int& bin) const;
+
+    // the bounding box of a single triangle, edge or vertex
+    void primitiveBoundingBox(const int primitive, VECTOR3& mins, VECTOR3& maxs) const;
+
+    // store the bounds of a node, rounded outwards to float
+    void setBounds(const int node, const VECTOR3& mins, const VECTOR3& maxs);
+
+    // store the bounds of the primitive in slot x of _primitives, rounded outwards to float
+    void setPrimitiveBounds(const int x, const VECTOR3& mins, const VECTOR3& maxs);
+
+    // collect the primitives of every leaf whose inflated box overlaps [mins, maxs].
+    // If strict is true, the box has to contain the point strictly, like AABBTree::insideAABB
+    void collect(const VECTOR3& mins, const VECTOR3& maxs, const REAL& eps, const bool strict,
+                 std::vector<int>& primitives) const;
+
+    // the bounding box of an edge
+    void edgeBoundingBox(const VECTOR2I& edge, VECTOR3& mins, VECTOR3& maxs) const;
+
+    // the mesh vertices of a primitive, returns how many there are
+    int primitiveVertices(const int primitive, int vertices[3]) const;
+
+    // do the boxes of node a here and node b in other come within eps of each other?
+    bool nodesOverlap(const int a, const LinearBVH& other, const int b, const REAL& eps) const;
+
+    // the surface area of a node's box
+    REAL nodeArea(const int node) const;
+
+    // which two node pairs an overlapping pair of interior nodes splits into
+    void splitNodePair(const int a, const LinearBVH& other, const int b,
+                       int childrenA[2], int childrenB[2]) const;
+
+    // split the node pair down to depth BVH_TASK_DEPTH, and add what's left to jobs
+    void splitPairs(const int a, const LinearBVH& other, const int b, const REAL& eps,
+                    const int depth, std::vector<NodePair>& jobs) const;
+
+    // the same, for everything inside the subtree under node
+    void splitSelfPairs(const int node, const REAL& eps, const int depth,
+                        std::vector<NodePair>& jobs) const;
+
+    // traverse _jobs in parallel, and add what they found to pairs in order
+    void collectJobs(const LinearBVH& other, const REAL& eps, std::vector<std::pair<int, int> >& pairs) const;
+
+    // add the overlapping pairs under node a here and node b in other
+    void collectPairs(const int a, const LinearBVH& other, const int b, const REAL& eps,
+                      std::vector<std::pair<int, int> >& pairs) const;
+
+    // add the overlapping pairs inside the subtree under node
+    void collectSelfPairs(const int node, const REAL& eps, std::vector<std::pair<int, int> >& pairs) const;
+
+    // test the primitives of leaf a here against those of leaf b in other, one by one
+    void leafPairs(const int a, const LinearBVH& other, const int b, const REAL& eps,
+                   std::vector<std::pair<int, int> >& pairs) const;
+
+    const std::vector<VECTOR3>& _vertices;
+
+    // exactly one of these is non-NULL, depending on which kind of tree this is
+    const std::vector<VECTOR3I>* _surfaceTriangles;
+    const std::vector<VECTOR2I>* _surfaceEdges;
+    const std::vector<int>* _surfaceVertices;
+
+    // the nodes, in depth-first order
+    std::vector<LinearBVHNode> _nodes;
+
+    // the parent of every node, -1 for the root, and the indices of all the leaves
+    std::vector<int> _parents;
+    std::vector<int> _leaves;
+
+    // how many children have already been refit, for every node. The second child
+    // to arrive puts it back to zero
+    std::vector<int> _refitArrivals;
+
+    // the positions version of the last refit, -1 if there hasn't been one
+    int _refitVersion;
+
+    // node bounds, one array per axis
+    std::vector<float> _mins[3];
+    std::vector<float> _maxs[3];
+
+    // indices into _surfaceTriangles, _surfaceEdges or _surfaceVertices, permuted so each
+    // leaf is a contiguous range
+    std::vector<int> _primitives;
+
+    // the bounds of each primitive, in the same order as _primitives, so leaf-vs-leaf
+    // tests don't need to go back to the vertices
+    std::vector<float> _primitiveMins[3];
+    std::vector<float> _primitiveMaxs[3];
+
+    // scratch space for the tree-vs-tree traversals, kept so that calling them every
+    // frame doesn't reallocate
+    mutable std::vector<NodePair> _jobs;
+    mutable std::vector<std::vector<std::pair<int, int> > > _jobPairs;
+
+    int _maxLeafSize;
+    REAL _rebuildRatio;
+
+    REAL _builtSAHCost;
+    REAL _buildTime;
+    int _totalRebuilds;
+};
+
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define TET_MESH_H
 
 #include "Platform/include/RYAO.h"
+#include "Platform/include/MatrixSoA.h"
 #include "Hyperelastic/include/HYPERELASTIC.h"
 #include "Hyperelastic/include/VertexFaceCollision.h"
 #include "Hyperelastic/include/McadamsCollision.h"
@@ -15,6 +16,10 @@
 #include <map>
 #include <vector>
 
+// store the 9x12 change-of-basis pFpx for every tet, rather than applying it
+// on the fly from DmInv. It's 864 bytes per tet, and slower.
+#define STORE_PFPXS 0
+
 namespace Ryao {
 
 using namespace std;
@@ -40,9 +45,19 @@ public:
     vector<VECTOR4I>& vertexFaceCollisionTets() { return _vertexFaceCollisionTets; };
     const vector<REAL>& restOneRingVolumes() const { return _restOneRingVolumes; };
     vector<REAL>& restOneRingVolumes() { return _restOneRingVolumes; };
+    const vector<REAL>& restTetVolumes() const { return _restTetVolumes; };
+    const MATRIX3_SOA& DmInvs() const { return _DmInvs; };
+    const MATRIX3_SOA& Fs() const { return _Fs; };
+    const vector<int>& vertexTetStarts() const { return _vertexTetStarts; };
+    const vector<int>& vertexTets() const { return _vertexTets; };
     const VECTOR3& vertex(const int index) const { return _vertices[index]; };
     VECTOR3& vertex(const int index) { return _vertices[index]; };
     const REAL& collisionEps() const { return _collisionEps; };
+
+    // goes up every time setPositions() or setDisplacement() moves the vertices, so anything
+    // computed from them can tell whether it's stale. Writing through vertices() or vertex()
+    // doesn't count
+    int positionsVersion() const { return _positionsVersion; };
     const VECTOR3& restVertex(const int index) const { return _restVertices[index]; };
     const VECTOR4I& tet(const int tetIndex) const { return _tets[tetIndex]; };
     const vector<int>& surfaceTets() const { return _surfaceTets; };
@@ -66,6 +81,15 @@ public:
     void computeFdots(const VECTOR& velocity);
     void computeSVDs();
 
+    // partition the vertices into color classes, so that no two vertices of the
+    // same color share a tet. Greedy, visiting the most connected vertices first.
+    vector<vector<int>> computeVertexColors() const;
+
+    // cut the tets into chunks of chunkSize consecutive tets, and partition the
+    // chunks into color classes, so that no two chunks of the same color share
+    // a vertex. Chunk x holds tets chunkSize * x onwards. Greedy, in index order.
+    vector<vector<int>> computeTetChunkColors(const int chunkSize) const;
+
     /**
      * @brief get volume-weighted global translation
      *
@@ -139,12 +163,22 @@ public:
     virtual SPARSE_MATRIX computeDampingHessian(const VOLUME::Damping& damping) const;
 
     // compute x-based collision quantities
+    REAL computeVertexFaceCollisionEnergy() const;
     VECTOR computeVertexFaceCollisionForces() const;
     SPARSE_MATRIX computeVertexFaceCollisionClampedHessian() const;
     REAL computeEdgeEdgeCollisionEnergy() const;
     VECTOR computeEdgeEdgeCollisionForces() const;
     SPARSE_MATRIX computeEdgeEdgeCollisionClampedHessian() const;
 
+    // the same collision quantities, but without building a global vector or matrix. The forces are
+    // added into the one passed in, and each collision's 12x12 clamped Hessian is appended to
+    // hessians, along with the four vertices it acts on. Resizing the arrays never gives back
+    // their capacity, so once they've seen the most collisions they stop allocating.
+    void addVertexFaceCollisionForces(VECTOR& forces) const;
+    void addVertexFaceCollisionClampedHessians(vector<VECTOR4I>& vertices, vector<MATRIX12>& hessians) const;
+    void addEdgeEdgeCollisionForces(VECTOR& forces) const;
+    void addEdgeEdgeCollisionClampedHessians(vector<VECTOR4I>& vertices, vector<MATRIX12>& hessians) const;
+
     /**
      * @brief compute elastic and damping forces at the same time
      *
@@ -310,14 +344,40 @@ protected:
      *
      * @param DmInvs
      */
-    void computeDmInvs(vector<MATRIX3>& DmInvs);
+    void computeDmInvs(MATRIX3_SOA& DmInvs);
 
+#if STORE_PFPXS
     /**
      * @brief compute the change-of-basis from deformation gradient F to positions, x
      *
      * @return vector<MATRIX9x12>
      */
     void computePFpxs(vector<MATRIX9x12>& pFpxs);
+#endif
+
+    /**
+     * @brief pFpx^T * flatten(PK1) for a tet, i.e. the gradient w.r.t. its vertices.
+     *        pFpx is a sparse rearrangement of DmInv, so this only reads DmInv
+     *
+     * @param DmInv
+     * @param PK1
+     * @return VECTOR12
+     */
+    static VECTOR12 projectPK1(const MATRIX3& DmInv, const MATRIX3& PK1);
+
+    /**
+     * @brief pFpx^T * hessian * pFpx for a tet, i.e. the Hessian w.r.t. its vertices,
+     *        also only reading DmInv
+     *
+     * @param DmInv
+     * @param hessian
+     * @return MATRIX12
+     */
+    static MATRIX12 projectHessian(const MATRIX3& DmInv, const MATRIX9& hessian);
+
+    // the same, for tet tetIndex, either from _pFpxs or from _DmInvs
+    VECTOR12 tetForceDensity(const int tetIndex, const MATRIX3& PK1) const;
+    MATRIX12 tetHessian(const int tetIndex, const MATRIX9& hessian) const;
 
     // find what's on the surface
     void computeSurfaceVertices();
@@ -415,6 +475,13 @@ protected:
      */
     void computeInvertedVertices();
 
+    // build the vertex-to-tet map, so each vertex can pull from its tets
+    void computeVertexTets();
+
+    // sum the per-tet forces into a global vector, with each vertex gathering
+    // from its tets in index order, so the result is the same for any thread count
+    VECTOR gatherTetForces(const vector<VECTOR12>& perElementForces) const;
+
     // the core geometry
     vector<VECTOR3>     _vertices;
     vector<VECTOR3>     _restVertices;
@@ -427,19 +494,27 @@ protected:
     VECTOR          _restEdgeAreas;
 
     // support for computing deformation gradient F
-    vector<MATRIX3> _DmInvs;
+    MATRIX3_SOA _DmInvs;
 
+#if STORE_PFPXS
     // change-of-basis to go from deformation gradient (F) to positions (x)
     vector<MATRIX9x12> _pFpxs;
+#endif
 
-    // deformation gradients, and their SVDs
-    vector<MATRIX3> _Fs;
-    vector<MATRIX3> _Us;
-    vector<VECTOR3> _Sigmas;
-    vector<MATRIX3> _Vs;
+    // deformation gradients, and their SVDs, stored as structures of arrays
+    // so the per-tet loops over them vectorize
+    MATRIX3_SOA _Fs;
+    MATRIX3_SOA _Us;
+    VECTOR3_SOA _Sigmas;
+    MATRIX3_SOA _Vs;
 
     // velocity gradients
-    vector<MATRIX3> _Fdots;
+    MATRIX3_SOA _Fdots;
+
+    // the tets touching each vertex in CSR form, in increasing tet order, packed as
+    // 4 * tet + which vertex of the tet it is
+    vector<int> _vertexTetStarts;
+    vector<int> _vertexTets;
 
     // list of tets that are one of the surface
     vector<int> _surfaceTets;
@@ -526,6 +601,9 @@ protected:
 
     // which vertices are inverted?
     vector<bool> _invertedVertices;
+
+    // how many times the vertices have been moved
+    int _positionsVersion;
 };
 
 } // Ryao
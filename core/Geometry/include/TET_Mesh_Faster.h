@@ -2,15 +2,34 @@
 #define RYAO_TET_MESH_FASTER_H
 
 #include "TET_Mesh.h"
-#include "AABBTree.h"
+#include "LinearBVH.h"
 #include "Platform/include/MatrixUtils.h"
 #include "Platform/include/CollisionUtils.h"
+#include "Platform/include/BlockSparseMatrix.h"
+#include "Platform/include/BatchedSVD.h"
 #include "LineIntersect.h"
 #include "Platform/include/Logger.h"
 #include "Platform/include/Timer.h"
 
 namespace Ryao {
 
+// default for how much further out than the collision eps the broad phase looks, as a multiple
+// of the collision eps. The candidates it finds stay good until some vertex moves half of that
+#define COLLISION_CANDIDATE_MARGIN 0.5
+
+// how many consecutive tets the fused elastic pass hands to a thread at a time.
+// A multiple of SVD_LANES, so only the last chunk has a partial batch
+#define ELASTIC_CHUNK_SIZE 64
+
+// how often the collision candidates could be reused instead of found again
+struct CANDIDATE_CACHE_STATS {
+    // calls to the collision detection
+    int detections;
+
+    // how many of those had to run the broad phase again
+    int rebuilds;
+};
+
 class TET_Mesh_Faster : public TET_Mesh {
 public:
     TET_Mesh_Faster(const std::vector<VECTOR3>& restVertices,
@@ -21,19 +40,109 @@ public:
     virtual SPARSE_MATRIX computeHyperelasticClampedHessian(const VOLUME::HYPERELASTIC& hyperelastic) const override;
     virtual SPARSE_MATRIX computeDampingHessian(const VOLUME::Damping& damping) const override;
 
+    // the same clamped Hessian, but assembled into 3x3 blocks. If upperOnly is set,
+    // only the blocks on or above the diagonal are stored.
+    const BlockSparseMatrix& computeHyperelasticClampedHessianBlocks(const VOLUME::HYPERELASTIC& hyperelastic,
+                                                                     const bool upperOnly = false) const;
+
+    // F, its SVD, the forces and the clamped Hessian in a single pass over the tets, SVD_LANES
+    // tets at a time. Each tet adds its forces and Hessian straight into the global vector and
+    // matrix, so no per-tet state goes back out to memory in between. F and the SVDs are still
+    // stored, so everything else sees the same state. Returns the forces, and the clamped
+    // Hessian goes into hyperelasticClampedHessianBlocks() if blocks is set, and into
+    // hyperelasticClampedHessian() otherwise.
+    //
+    // The tets are cut into chunks of consecutive tets, and the chunks go one color at a time.
+    // Chunks of the same color don't share any vertices, so they never add into the same
+    // entries, and each chunk still walks its part of the mesh in order.
+    //
+    // Looks up the dynamic type of the material once, and runs computeElasticTerms for it.
+    VECTOR computeFusedElasticTerms(const VOLUME::HYPERELASTIC& hyperelastic,
+                                    const bool blocks = false, const bool upperOnly = false);
+
+    // the same pass, compiled against a concrete material so that its PK1 and clamped
+    // Hessian are called directly instead of through the vtable. Instantiated for the
+    // materials in the registry, and for HYPERELASTIC itself, which is the virtual fallback.
+    template <class MATERIAL>
+    VECTOR computeElasticTerms(const MATERIAL& material, const bool blocks, const bool upperOnly);
+
+    // the hyperelastic energy of the current Fs, dispatched the same way
+    REAL computeElasticEnergy(const VOLUME::HYPERELASTIC& hyperelastic) const;
+    template <class MATERIAL>
+    REAL computeElasticEnergy(const MATERIAL& material) const;
+
+    // the clamped Hessian as the last computeFusedElasticTerms() left it
+    const SPARSE_MATRIX& hyperelasticClampedHessian() const             { return _sparseA; };
+    const BlockSparseMatrix& hyperelasticClampedHessianBlocks() const   { return _blockA; };
+
     // find all the vertex-face collision pairs, using the InFaceRegion test
     virtual void computeVertexFaceCollisions() override;
 
     // find all the edge-edge collision pairs
     virtual void computeEdgeEdgeCollisions() override;
 
-    const AABBTree& aabbTreeTriangles() const { return _aabbTreeTriangles; };
-    void refitAABB() { _aabbTreeTriangles.refit();  _aabbTreeEdges.refit(); };
+    const LinearBVH& aabbTreeTriangles() const { return _aabbTreeTriangles; };
+
+    // refit the collision trees, skipping any that are already up to date with the vertices
+    void refitAABB();
+
+    // the collision candidate margin, as a multiple of the collision eps. Zero turns the
+    // candidate caching off, and runs the broad phase at exactly the collision eps every time
+    REAL& candidateMargin()                                         { return _candidateMargin; };
+    const CANDIDATE_CACHE_STATS& vertexFaceCandidateStats() const   { return _vertexFaceCandidateStats; };
+    const CANDIDATE_CACHE_STATS& edgeEdgeCandidateStats() const     { return _edgeEdgeCandidateStats; };
+    void printCandidateCacheStats() const;
 
 private:
+    // what one thread found in the collision narrow phases, kept around between
+    // frames so the storage gets reused
+    struct CollisionBuffer {
+        vector<pair<int, int>> vertexFaceCollisions;
+        vector<pair<int, int>> edgeEdgeCollisions;
+        vector<pair<VECTOR2, VECTOR2>> edgeEdgeCoordinates;
+        vector<REAL> edgeEdgeCollisionAreas;
+        vector<bool> edgeEdgeIntersections;
+    };
+
+    // make sure there's an empty buffer for every thread
+    void clearCollisionBuffers();
+
+    // throw out the cached candidates if any surface vertex has moved more than half the
+    // margin since they were found, or the collision eps has changed
+    void checkCandidateCache();
+
+    // remember the surface vertex positions the candidates are about to be found at.
+    // Any candidates found at other positions aren't valid anymore
+    void snapshotCandidatePositions();
+
     // find the compressed index mapping
     void computeCompressedIndices();
 
+    // build the 3x3 block sparsity, the per-block gathers and the per-tet block indices
+    void computeBlockGathers(const bool upperOnly) const;
+
+    // fill _perElementHessians with the per-tet clamped Hessians
+    void computePerElementClampedHessians(const VOLUME::HYPERELASTIC& hyperelastic) const;
+
+    // assemble the per-tet clamped Hessians in _perElementHessians
+    SPARSE_MATRIX assembleHyperelasticClampedHessian() const;
+    const BlockSparseMatrix& assembleHyperelasticClampedHessianBlocks(const bool upperOnly) const;
+
+    // add the Hessian of a tet into _blockA if blocks is set, and into _sparseA otherwise
+    void scatterTetHessian(const int tetIndex, const MATRIX12& hessian, const bool blocks);
+
+    // the element loops instantiated for one material, which take the base class
+    // and cast it back to what the registry found
+    struct ElasticKernels {
+        VECTOR (*terms)(TET_Mesh_Faster& tetMesh, const VOLUME::HYPERELASTIC& hyperelastic,
+                        const bool blocks, const bool upperOnly);
+        REAL (*energy)(const TET_Mesh_Faster& tetMesh, const VOLUME::HYPERELASTIC& hyperelastic);
+    };
+
+    // find the kernels for the dynamic type of the material, so scenes can keep
+    // picking one at runtime. Unknown materials get the virtual fallback.
+    static const ElasticKernels& findElasticKernels(const VOLUME::HYPERELASTIC& hyperelastic);
+
     mutable bool _sparsityCached;
     mutable SPARSE_MATRIX _sparseA;
 
@@ -43,18 +152,63 @@ private:
     // cache the hessian for each tet
     mutable vector<MATRIX12> _perElementHessians;
 
-    // mapping from edge index pairs to _surfaceEdges
-    map<pair<int, int>, int> _edgeHash;
+    // the chunks of ELASTIC_CHUNK_SIZE tets, partitioned so that no two of the
+    // same color share a vertex
+    vector<vector<int>> _tetChunkColors;
+
+    // where each tet's 4x4 vertex pairs go in _sparseA, 48 per tet: for the pair
+    // (x, y) and column b of the 3x3 block, at 12 * y + 3 * x + b, the index of
+    // the first of the block column's three consecutive entries
+    vector<int> _tetEntryOffsets;
 
     // for each entry in the global stiffness matrix, the
     // tet indices to gather entries from
     vector<vector<VECTOR3I>> _hessianGathers;
 
+    // the global stiffness matrix in 3x3 blocks, and for each block, the tet
+    // indices and local vertex pair to gather from
+    mutable BlockSparseMatrix _blockA;
+    mutable vector<vector<VECTOR3I>> _blockGathers;
+
+    // where each tet's 4x4 vertex pairs go in _blockA, 16 per tet, at 4 * y + x for
+    // the pair (x, y). -1 for the pairs below the diagonal in upper-only storage
+    mutable vector<int> _tetBlockIndices;
+
     // collision detection acceleration structure for triangles
-    AABBTree _aabbTreeTriangles;
+    LinearBVH _aabbTreeTriangles;
 
     // collision detection acceleration structure for edges
-    AABBTree _aabbTreeEdges;
+    LinearBVH _aabbTreeEdges;
+
+    // collision detection acceleration structure for surface vertices, traversed
+    // against _aabbTreeTriangles
+    LinearBVH _aabbTreeVertices;
+
+    // broad phase candidates, as (surface vertex, surface triangle) and (surface edge,
+    // surface edge) pairs, and where each edge's candidates start
+    vector<pair<int, int>> _vertexFaceCandidates;
+    vector<pair<int, int>> _edgeEdgeCandidates;
+    vector<int> _edgeEdgeCandidateStarts;
+
+    // per-thread narrow phase results
+    vector<CollisionBuffer> _collisionBuffers;
+
+    // the candidates above get found with the collision eps plus a margin, and then reused
+    // for as long as no surface vertex has moved more than half the margin, like a Verlet list
+    REAL _candidateMargin;
+    bool _vertexFaceCandidatesValid;
+    bool _edgeEdgeCandidatesValid;
+
+    // the surface vertex positions and broad phase eps the valid candidates were found with
+    vector<VECTOR3> _candidatePositions;
+    int _candidatePositionsVersion;
+    REAL _candidateEps;
+
+    // the positions version the cache was last checked against
+    int _candidateCheckVersion;
+
+    CANDIDATE_CACHE_STATS _vertexFaceCandidateStats;
+    CANDIDATE_CACHE_STATS _edgeEdgeCandidateStats;
 };
 
 }
@@ -0,0 +1,698 @@
+#include <LinearBVH.h>
+#include <Platform/include/Timer.h>
+#include <Platform/include/Logger.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace Ryao {
+
+// round to the nearest float that is no larger, or no smaller
+static float roundDown(const REAL& value) {
+    const float rounded = (float)value;
+    return ((REAL)rounded > value) ? nextafterf(rounded, -HUGE_VALF) : rounded;
+}
+
+static float roundUp(const REAL& value) {
+    const float rounded = (float)value;
+    return ((REAL)rounded < value) ? nextafterf(rounded, HUGE_VALF) : rounded;
+}
+
+// the surface area of a box, up to the factor of two that cancels in every ratio
+static REAL surfaceArea(const VECTOR3& mins, const VECTOR3& maxs) {
+    const VECTOR3 extent = maxs - mins;
+    return extent[0] * extent[1] + extent[1] * extent[2] + extent[2] * extent[0];
+}
+
+LinearBVH::LinearBVH(const vector<VECTOR3>& vertices, const vector<VECTOR3I>* surfaceTriangles,
+                     const int maxLeafSize) :
+    _vertices(vertices), _surfaceTriangles(surfaceTriangles), _surfaceEdges(NULL), _surfaceVertices(NULL),
+    _refitVersion(-1), _maxLeafSize(maxLeafSize), _rebuildRatio(BVH_REBUILD_RATIO), _totalRebuilds(0) {
+    assert(_vertices.size() > 0);
+    assert(_surfaceTriangles->size() > 0);
+
+    // build the tree
+    build();
+}
+
+LinearBVH::LinearBVH(const vector<VECTOR3>& vertices, const vector<VECTOR2I>* surfaceEdges,
+                     const int maxLeafSize) :
+    _vertices(vertices), _surfaceTriangles(NULL), _surfaceEdges(surfaceEdges), _surfaceVertices(NULL),
+    _refitVersion(-1), _maxLeafSize(maxLeafSize), _rebuildRatio(BVH_REBUILD_RATIO), _totalRebuilds(0) {
+    assert(_vertices.size() > 0);
+    assert(_surfaceEdges->size() > 0);
+
+    // build the tree
+    build();
+}
+
+LinearBVH::LinearBVH(const vector<VECTOR3>& vertices, const vector<int>* surfaceVertices,
+                     const int maxLeafSize) :
+    _vertices(vertices), _surfaceTriangles(NULL), _surfaceEdges(NULL), _surfaceVertices(surfaceVertices),
+    _refitVersion(-1), _maxLeafSize(maxLeafSize), _rebuildRatio(BVH_REBUILD_RATIO), _totalRebuilds(0) {
+    assert(_vertices.size() > 0);
+    assert(_surfaceVertices->size() > 0);
+
+    // build the tree
+    build();
+}
+
+int LinearBVH::totalPrimitives() const {
+    if (_surfaceTriangles != NULL)
+        return _surfaceTriangles->size();
+    if (_surfaceEdges != NULL)
+        return _surfaceEdges->size();
+    return _surfaceVertices->size();
+}
+
+void LinearBVH::rebuild() {
+    build();
+    _totalRebuilds++;
+}
+
+void LinearBVH::build() {
+    Timer functionTimer(string("LinearBVH::") + __FUNCTION__);
+    const auto begin = chrono::steady_clock::now();
+    const int primitiveCount = totalPrimitives();
+
+    // gather the bounds and centers of the primitives once, instead of at every level
+    BuildPrimitives primitives;
+    primitives.mins.resize(primitiveCount);
+    primitives.maxs.resize(primitiveCount);
+    primitives.centers.resize(primitiveCount);
+    _primitives.resize(primitiveCount);
+#pragma omp parallel for schedule(static)
+    for (int x = 0; x < primitiveCount; x++) {
+        primitiveBoundingBox(x, primitives.mins[x], primitives.maxs[x]);
+        primitives.centers[x] = 0.5 * (primitives.mins[x] + primitives.maxs[x]);
+        _primitives[x] = x;
+    }
+
+    // the first thread starts at the root, and the big subtrees spawn tasks for the rest
+    vector<BuildNode> built;
+    built.reserve(2 * primitiveCount - 1);
+#pragma omp parallel
+#pragma omp single
+    buildNode(0, primitiveCount, 0, primitives, built);
+
+    // flatten into the node array and the float bounds
+    const int totalNodes = built.size();
+    _nodes.resize(totalNodes);
+    for (int x = 0; x < 3; x++) {
+        _mins[x].resize(totalNodes);
+        _maxs[x].resize(totalNodes);
+    }
+    for (int x = 0; x < totalNodes; x++) {
+        _nodes[x].offset = built[x].offset;
+        _nodes[x].count = built[x].count;
+        setBounds(x, built[x].mins, built[x].maxs);
+    }
+
+    // the links the refit needs to go from the leaves up
+    _parents.assign(totalNodes, -1);
+    _leaves.clear();
+    for (int x = 0; x < totalNodes; x++) {
+        if (_nodes[x].isLeaf()) {
+            _leaves.push_back(x);
+            continue;
+        }
+        _parents[x + 1] = x;
+        _parents[_nodes[x].offset] = x;
+    }
+    _refitArrivals.assign(totalNodes, 0);
+    for (int x = 0; x < 3; x++) {
+        _primitiveMins[x].resize(primitiveCount);
+        _primitiveMaxs[x].resize(primitiveCount);
+    }
+    for (int x = 0; x < primitiveCount; x++)
+        setPrimitiveBounds(x, primitives.mins[_primitives[x]], primitives.maxs[_primitives[x]]);
+
+    _builtSAHCost = sahCost();
+    _buildTime = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    RYAO_INFO("Built a BVH over {} primitives: {} nodes, SAH cost {}, {} ms",
+              primitiveCount, totalNodes, _builtSAHCost, _buildTime * 1000.0);
+}
+
+void LinearBVH::buildNode(const int begin, const int end, const int depth,
+                          const BuildPrimitives& primitives, vector<BuildNode>& nodes) {
+    assert(end > begin);
+    const int count = end - begin;
+
+    // the bounds of the primitives, and of their centers
+    VECTOR3 mins = primitives.mins[_primitives[begin]];
+    VECTOR3 maxs = primitives.maxs[_primitives[begin]];
+    VECTOR3 centerMins = primitives.centers[_primitives[begin]];
+    VECTOR3 centerMaxs = centerMins;
+    for (int x = begin + 1; x < end; x++) {
+        const int primitive = _primitives[x];
+        mins = mins.cwiseMin(primitives.mins[primitive]);
+        maxs = maxs.cwiseMax(primitives.maxs[primitive]);
+        centerMins = centerMins.cwiseMin(primitives.centers[primitive]);
+        centerMaxs = centerMaxs.cwiseMax(primitives.centers[primitive]);
+    }
+
+    // make it a leaf for now
+    const int index = nodes.size();
+    BuildNode node;
+    node.mins = mins;
+    node.maxs = maxs;
+    node.offset = begin;
+    node.count = count;
+    nodes.push_back(node);
+
+    if (count == 1 || depth >= BVH_MAX_DEPTH)
+        return;
+
+    int axis, bin;
+    const REAL splitCost = findSAHSplit(begin, end, mins, maxs, centerMins, centerMaxs, primitives, axis, bin);
+
+    // stay a leaf if that's cheaper and small enough
+    if (count <= _maxLeafSize && (axis < 0 || splitCost >= count))
+        return;
+
+    int split;
+    if (axis >= 0) {
+        const REAL scale = BVH_SAH_BINS / (centerMaxs[axis] - centerMins[axis]);
+        split = partition(_primitives.begin() + begin, _primitives.begin() + end,
+                          [&](const int primitive) {
+                              const int which = (int)((primitives.centers[primitive][axis] - centerMins[axis]) * scale);
+                              return min(which, BVH_SAH_BINS - 1) <= bin;
+                          }) - _primitives.begin();
+    } else {
+        // the centers are all in one bin, so split at the median of the widest axis instead
+        const VECTOR3 extent = centerMaxs - centerMins;
+        int widest = 0;
+        for (int x = 1; x < 3; x++)
+            if (extent[x] > extent[widest])
+                widest = x;
+        split = begin + count / 2;
+        nth_element(_primitives.begin() + begin, _primitives.begin() + split, _primitives.begin() + end,
+                    [&](const int a, const int b) {
+                        return primitives.centers[a][widest] < primitives.centers[b][widest];
+                    });
+    }
+    assert(split > begin && split < end);
+
+    // small subtrees go straight into the array, the first child right after us
+    if (count < BVH_PARALLEL_BUILD_SIZE) {
+        buildNode(begin, split, depth + 1, primitives, nodes);
+        const int secondChild = nodes.size();
+        buildNode(split, end, depth + 1, primitives, nodes);
+
+        nodes[index].offset = secondChild;
+        nodes[index].count = 0;
+        return;
+    }
+
+    // big ones get built side by side, and then shifted into place
+    vector<BuildNode> first, second;
+#pragma omp task shared(first, primitives)
+    buildNode(begin, split, depth + 1, primitives, first);
+#pragma omp task shared(second, primitives)
+    buildNode(split, end, depth + 1, primitives, second);
+#pragma omp taskwait
+
+    const int firstStart = index + 1;
+    const int secondStart = firstStart + first.size();
+    for (unsigned int x = 0; x < first.size(); x++) {
+        if (first[x].count == 0)
+            first[x].offset += firstStart;
+        nodes.push_back(first[x]);
+    }
+    for (unsigned int x = 0; x < second.size(); x++) {
+        if (second[x].count == 0)
+            second[x].offset += secondStart;
+        nodes.push_back(second[x]);
+    }
+    nodes[index].offset = secondStart;
+    nodes[index].count = 0;
+}
+
+REAL LinearBVH::findSAHSplit(const int begin, const int end, const VECTOR3& mins, const VECTOR3& maxs,
+                             const VECTOR3& centerMins, const VECTOR3& centerMaxs,
+                             const BuildPrimitives& primitives, int& axis, int& bin) const {
+    axis = -1;
+    bin = -1;
+    REAL bestCost = numeric_limits<REAL>::max();
+    const REAL parentArea = surfaceArea(mins, maxs);
+
+    // only bin along the axis the centers are spread out the most along, like Wald 2007
+    const VECTOR3 extents = centerMaxs - centerMins;
+    int widest = 0;
+    for (int x = 1; x < 3; x++)
+        if (extents[x] > extents[widest])
+            widest = x;
+
+    {
+        const int a = widest;
+        const REAL extent = extents[a];
+        if (extent <= 0.0)
+            return bestCost;
+        const REAL scale = BVH_SAH_BINS / extent;
+
+        // sort the primitives into bins
+        int counts[BVH_SAH_BINS] = {0};
+        VECTOR3 binMins[BVH_SAH_BINS], binMaxs[BVH_SAH_BINS];
+        for (int x = begin; x < end; x++) {
+            const int primitive = _primitives[x];
+            const int which = min((int)((primitives.centers[primitive][a] - centerMins[a]) * scale), BVH_SAH_BINS - 1);
+            if (counts[which] == 0) {
+                binMins[which] = primitives.mins[primitive];
+                binMaxs[which] = primitives.maxs[primitive];
+            } else {
+                binMins[which] = binMins[which].cwiseMin(primitives.mins[primitive]);
+                binMaxs[which] = binMaxs[which].cwiseMax(primitives.maxs[primitive]);
+            }
+            counts[which]++;
+        }
+
+        // sweep from the right to get the area and count above every split
+        REAL rightAreas[BVH_SAH_BINS];
+        int rightCounts[BVH_SAH_BINS];
+        VECTOR3 sweepMins, sweepMaxs;
+        int sweepCount = 0;
+        for (int x = BVH_SAH_BINS - 1; x > 0; x--) {
+            if (counts[x] > 0) {
+                sweepMins = (sweepCount == 0) ? binMins[x] : VECTOR3(sweepMins.cwiseMin(binMins[x]));
+                sweepMaxs = (sweepCount == 0) ? binMaxs[x] : VECTOR3(sweepMaxs.cwiseMax(binMaxs[x]));
+                sweepCount += counts[x];
+            }
+            rightCounts[x] = sweepCount;
+            rightAreas[x] = (sweepCount > 0) ? surfaceArea(sweepMins, sweepMaxs) : 0.0;
+        }
+
+        // then from the left, splitting after bin x
+        sweepCount = 0;
+        for (int x = 0; x < BVH_SAH_BINS - 1; x++) {
+            if (counts[x] > 0) {
+                sweepMins = (sweepCount == 0) ? binMins[x] : VECTOR3(sweepMins.cwiseMin(binMins[x]));
+                sweepMaxs = (sweepCount == 0) ? binMaxs[x] : VECTOR3(sweepMaxs.cwiseMax(binMaxs[x]));
+                sweepCount += counts[x];
+            }
+            if (sweepCount == 0 || rightCounts[x + 1] == 0)
+                continue;
+
+            const REAL cost = surfaceArea(sweepMins, sweepMaxs) * sweepCount + rightAreas[x + 1] * rightCounts[x + 1];
+            if (cost < bestCost) {
+                bestCost = cost;
+                axis = a;
+                bin = x;
+            }
+        }
+    }
+
+    if (axis < 0)
+        return bestCost;
+
+    // one traversal step, plus the primitives of each child weighted by how likely it gets hit
+    return BVH_SAH_TRAVERSAL_COST + ((parentArea > 0.0) ? bestCost / parentArea : (REAL)(end - begin));
+}
+
+REAL LinearBVH::sahCost() const {
+    const VECTOR3 rootMins(_mins[0][0], _mins[1][0], _mins[2][0]);
+    const VECTOR3 rootMaxs(_maxs[0][0], _maxs[1][0], _maxs[2][0]);
+    const REAL rootArea = surfaceArea(rootMins, rootMaxs);
+    if (rootArea <= 0.0)
+        return _nodes[0].isLeaf() ? _nodes[0].count : BVH_SAH_TRAVERSAL_COST;
+
+    // this runs after every refit, so it shouldn't be the serial part
+    const int totalNodes = _nodes.size();
+    REAL cost = 0.0;
+#pragma omp parallel for schedule(static) reduction(+:cost)
+    for (int x = 0; x < totalNodes; x++) {
+        const VECTOR3 mins(_mins[0][x], _mins[1][x], _mins[2][x]);
+        const VECTOR3 maxs(_maxs[0][x], _maxs[1][x], _maxs[2][x]);
+        const REAL weight = (_nodes[x].isLeaf()) ? _nodes[x].count : BVH_SAH_TRAVERSAL_COST;
+        cost += weight * surfaceArea(mins, maxs) / rootArea;
+    }
+    return cost;
+}
+
+void LinearBVH::primitiveBoundingBox(const int primitive, VECTOR3& mins, VECTOR3& maxs) const {
+    if (_surfaceTriangles != NULL) {
+        const VECTOR3I& triangle = (*_surfaceTriangles)[primitive];
+        mins = _vertices[triangle[0]].cwiseMin(_vertices[triangle[1]]).cwiseMin(_vertices[triangle[2]]);
+        maxs = _vertices[triangle[0]].cwiseMax(_vertices[triangle[1]]).cwiseMax(_vertices[triangle[2]]);
+        return;
+    }
+    if (_surfaceEdges != NULL) {
+        edgeBoundingBox((*_surfaceEdges)[primitive], mins, maxs);
+        return;
+    }
+    mins = maxs = _vertices[(*_surfaceVertices)[primitive]];
+}
+
+void LinearBVH::setBounds(const int node, const VECTOR3& mins, const VECTOR3& maxs) {
+    for (int x = 0; x < 3; x++) {
+        _mins[x][node] = roundDown(mins[x]);
+        _maxs[x][node] = roundUp(maxs[x]);
+    }
+}
+
+void LinearBVH::setPrimitiveBounds(const int x, const VECTOR3& mins, const VECTOR3& maxs) {
+    for (int y = 0; y < 3; y++) {
+        _primitiveMins[y][x] = roundDown(mins[y]);
+        _primitiveMaxs[y][x] = roundUp(maxs[y]);
+    }
+}
+
+void LinearBVH::refit(const int positionsVersion) {
+    if (positionsVersion == _refitVersion)
+        return;
+    refit();
+    _refitVersion = positionsVersion;
+}
+
+void LinearBVH::refit() {
+    const int totalLeaves = _leaves.size();
+#pragma omp parallel for schedule(static)
+    for (int x = 0; x < totalLeaves; x++) {
+        const int leaf = _leaves[x];
+        const LinearBVHNode& node = _nodes[leaf];
+        VECTOR3 mins, maxs;
+        primitiveBoundingBox(_primitives[node.offset], mins, maxs);
+        setPrimitiveBounds(node.offset, mins, maxs);
+        for (int y = node.offset + 1; y < node.offset + node.count; y++) {
+            VECTOR3 primitiveMins, primitiveMaxs;
+            primitiveBoundingBox(_primitives[y], primitiveMins, primitiveMaxs);
+            setPrimitiveBounds(y, primitiveMins, primitiveMaxs);
+            mins = mins.cwiseMin(primitiveMins);
+            maxs = maxs.cwiseMax(primitiveMaxs);
+        }
+        setBounds(leaf, mins, maxs);
+
+        // head for the root, and stop at any parent whose other child isn't done yet.
+        // The atomic flushes memory, so whoever arrives second sees both children's bounds
+        int parent = _parents[leaf];
+        while (parent >= 0) {
+            int arrived;
+#pragma omp atomic capture seq_cst
+            arrived = ++_refitArrivals[parent];
+            if (arrived < 2)
+                break;
+            _refitArrivals[parent] = 0;
+
+            // refit based on the boxes below
+            const int left = parent + 1;
+            const int right = _nodes[parent].offset;
+            for (int y = 0; y < 3; y++) {
+                _mins[y][parent] = min(_mins[y][left], _mins[y][right]);
+                _maxs[y][parent] = max(_maxs[y][left], _maxs[y][right]);
+            }
+            parent = _parents[parent];
+        }
+    }
+
+    // if the boxes have grown too much, start over
+    if (_rebuildRatio > 0.0) {
+        const REAL cost = sahCost();
+        if (cost > _rebuildRatio * _builtSAHCost) {
+            RYAO_INFO("BVH SAH cost went from {} to {} since the last build, rebuilding", _builtSAHCost, cost);
+            rebuild();
+        }
+    }
+}
+
+void LinearBVH::collect(const VECTOR3& mins, const VECTOR3& maxs, const REAL& eps, const bool strict,
+                        vector<int>& primitives) const {
+    int stack[BVH_MAX_DEPTH];
+    int stackSize = 0;
+    int current = 0;
+
+    while (true) {
+        bool overlap = true;
+        for (int x = 0; x < 3 && overlap; x++) {
+            const REAL inflatedMin = (REAL)_mins[x][current] - eps;
+            const REAL inflatedMax = (REAL)_maxs[x][current] + eps;
+            overlap = (strict) ? (mins[x] > inflatedMin && maxs[x] < inflatedMax)
+                               : (mins[x] <= inflatedMax && maxs[x] >= inflatedMin);
+        }
+
+        if (overlap) {
+            const LinearBVHNode& node = _nodes[current];
+
+            // if we're internal, visit the first child now and the second one later
+            if (!node.isLeaf()) {
+                stack[stackSize++] = node.offset;
+                current++;
+                continue;
+            }
+
+            // if we're a leaf, add our primitives to the list to test
+            for (int x = node.offset; x < node.offset + node.count; x++)
+                primitives.push_back(_primitives[x]);
+        }
+
+        if (stackSize == 0)
+            break;
+        current = stack[--stackSize];
+    }
+}
+
+void LinearBVH::edgeBoundingBox(const VECTOR2I& edge, VECTOR3& mins, VECTOR3& maxs) const {
+    mins = _vertices[edge[0]].cwiseMin(_vertices[edge[1]]);
+    maxs = _vertices[edge[0]].cwiseMax(_vertices[edge[1]]);
+}
+
+void LinearBVH::nearbyTriangles(const VECTOR3& vertex, const REAL& eps, vector<int>& faces) const {
+    assert(_surfaceTriangles != NULL);
+
+    // make sure we don't keep old stuff around by mistake
+    faces.clear();
+
+    collect(vertex, vertex, eps, true, faces);
+}
+
+void LinearBVH::nearbyTriangles(const VECTOR2I& edge, const REAL& eps, vector<int>& faces) const {
+    assert(_surfaceTriangles != NULL);
+
+    // make sure we don't keep old stuff around by mistake
+    faces.clear();
+
+    VECTOR3 mins, maxs;
+    edgeBoundingBox(edge, mins, maxs);
+    collect(mins, maxs, eps, false, faces);
+}
+
+void LinearBVH::nearbyTriangles(const VECTOR3& mins, const VECTOR3& maxs, const REAL& eps,
+                                vector<int>& faces) const {
+    // make sure we don't keep old stuff around by mistake
+    faces.clear();
+
+    collect(mins, maxs, eps, false, faces);
+}
+
+void LinearBVH::nearbyEdges(const VECTOR2I& edge, const REAL& eps, vector<int>& edges) const {
+    assert(_surfaceEdges != NULL);
+
+    // make sure we don't keep old stuff around by mistake
+    edges.clear();
+
+    VECTOR3 mins, maxs;
+    edgeBoundingBox(edge, mins, maxs);
+    collect(mins, maxs, eps, false, edges);
+}
+
+int LinearBVH::primitiveVertices(const int primitive, int vertices[3]) const {
+    if (_surfaceTriangles != NULL) {
+        const VECTOR3I& triangle = (*_surfaceTriangles)[primitive];
+        for (int x = 0; x < 3; x++)
+            vertices[x] = triangle[x];
+        return 3;
+    }
+    if (_surfaceEdges != NULL) {
+        const VECTOR2I& edge = (*_surfaceEdges)[primitive];
+        vertices[0] = edge[0];
+        vertices[1] = edge[1];
+        return 2;
+    }
+    vertices[0] = (*_surfaceVertices)[primitive];
+    return 1;
+}
+
+bool LinearBVH::nodesOverlap(const int a, const LinearBVH& other, const int b, const REAL& eps) const {
+    for (int x = 0; x < 3; x++) {
+        if ((REAL)_mins[x][a] > (REAL)other._maxs[x][b] + eps) return false;
+        if ((REAL)_maxs[x][a] < (REAL)other._mins[x][b] - eps) return false;
+    }
+    return true;
+}
+
+REAL LinearBVH::nodeArea(const int node) const {
+    const VECTOR3 mins(_mins[0][node], _mins[1][node], _mins[2][node]);
+    const VECTOR3 maxs(_maxs[0][node], _maxs[1][node], _maxs[2][node]);
+    return surfaceArea(mins, maxs);
+}
+
+void LinearBVH::leafPairs(const int a, const LinearBVH& other, const int b, const REAL& eps,
+                          vector<pair<int, int> >& pairs) const {
+    const LinearBVHNode& nodeA = _nodes[a];
+    const LinearBVHNode& nodeB = other._nodes[b];
+    const bool sameLeaf = (this == &other) && (a == b);
+
+    for (int x = nodeA.offset; x < nodeA.offset + nodeA.count; x++) {
+        const int primitiveA = _primitives[x];
+        int verticesA[3];
+        const int totalA = primitiveVertices(primitiveA, verticesA);
+
+        // inside a single leaf, only look at each pair once
+        const int first = (sameLeaf) ? x + 1 : nodeB.offset;
+        for (int y = first; y < nodeB.offset + nodeB.count; y++) {
+            bool overlap = true;
+            for (int z = 0; z < 3 && overlap; z++)
+                overlap = ((REAL)_primitiveMins[z][x] <= (REAL)other._primitiveMaxs[z][y] + eps) &&
+                          ((REAL)_primitiveMaxs[z][x] >= (REAL)other._primitiveMins[z][y] - eps);
+            if (!overlap) continue;
+
+            // if they share a vertex, the narrow phase is going to skip them anyway
+            const int primitiveB = other._primitives[y];
+            int verticesB[3];
+            const int totalB = other.primitiveVertices(primitiveB, verticesB);
+            bool shared = false;
+            for (int i = 0; i < totalA && !shared; i++)
+                for (int j = 0; j < totalB && !shared; j++)
+                    shared = (verticesA[i] == verticesB[j]);
+            if (shared) continue;
+
+            pairs.push_back(pair<int, int>(primitiveA, primitiveB));
+        }
+    }
+}
+
+void LinearBVH::splitNodePair(const int a, const LinearBVH& other, const int b,
+                              int childrenA[2], int childrenB[2]) const {
+    const LinearBVHNode& nodeA = _nodes[a];
+    const LinearBVHNode& nodeB = other._nodes[b];
+
+    // descend into whichever one is interior, or the bigger one if they both are
+    bool splitA = !nodeA.isLeaf();
+    if (splitA && !nodeB.isLeaf())
+        splitA = nodeArea(a) >= other.nodeArea(b);
+
+    if (splitA) {
+        childrenA[0] = a + 1;
+        childrenA[1] = nodeA.offset;
+        childrenB[0] = childrenB[1] = b;
+        return;
+    }
+    childrenA[0] = childrenA[1] = a;
+    childrenB[0] = b + 1;
+    childrenB[1] = nodeB.offset;
+}
+
+void LinearBVH::splitPairs(const int a, const LinearBVH& other, const int b, const REAL& eps,
+                           const int depth, vector<NodePair>& jobs) const {
+    if (!nodesOverlap(a, other, b, eps))
+        return;
+
+    if (depth >= BVH_TASK_DEPTH || (_nodes[a].isLeaf() && other._nodes[b].isLeaf())) {
+        const NodePair job = { a, b };
+        jobs.push_back(job);
+        return;
+    }
+
+    int childrenA[2], childrenB[2];
+    splitNodePair(a, other, b, childrenA, childrenB);
+    splitPairs(childrenA[0], other, childrenB[0], eps, depth + 1, jobs);
+    splitPairs(childrenA[1], other, childrenB[1], eps, depth + 1, jobs);
+}
+
+void LinearBVH::splitSelfPairs(const int node, const REAL& eps, const int depth,
+                               vector<NodePair>& jobs) const {
+    if (depth >= BVH_TASK_DEPTH || _nodes[node].isLeaf()) {
+        const NodePair job = { node, node };
+        jobs.push_back(job);
+        return;
+    }
+
+    // everything inside the left subtree, everything inside the right one, and
+    // everything between the two
+    const int left = node + 1;
+    const int right = _nodes[node].offset;
+    splitSelfPairs(left, eps, depth + 1, jobs);
+    splitSelfPairs(right, eps, depth + 1, jobs);
+    splitPairs(left, *this, right, eps, depth + 1, jobs);
+}
+
+void LinearBVH::collectJobs(const LinearBVH& other, const REAL& eps, vector<pair<int, int> >& pairs) const {
+    const int totalJobs = _jobs.size();
+    if ((int)_jobPairs.size() < totalJobs)
+        _jobPairs.resize(totalJobs);
+
+    // the jobs can be very different sizes, so hand them out one at a time
+#pragma omp parallel for schedule(dynamic)
+    for (int x = 0; x < totalJobs; x++) {
+        _jobPairs[x].clear();
+        if (this == &other && _jobs[x].a == _jobs[x].b)
+            collectSelfPairs(_jobs[x].a, eps, _jobPairs[x]);
+        else
+            collectPairs(_jobs[x].a, other, _jobs[x].b, eps, _jobPairs[x]);
+    }
+
+    unsigned int totalPairs = 0;
+    for (int x = 0; x < totalJobs; x++)
+        totalPairs += _jobPairs[x].size();
+    pairs.reserve(totalPairs);
+    for (int x = 0; x < totalJobs; x++)
+        pairs.insert(pairs.end(), _jobPairs[x].begin(), _jobPairs[x].end());
+}
+
+void LinearBVH::collectPairs(const int a, const LinearBVH& other, const int b, const REAL& eps,
+                             vector<pair<int, int> >& pairs) const {
+    if (!nodesOverlap(a, other, b, eps))
+        return;
+
+    if (_nodes[a].isLeaf() && other._nodes[b].isLeaf()) {
+        leafPairs(a, other, b, eps, pairs);
+        return;
+    }
+
+    int childrenA[2], childrenB[2];
+    splitNodePair(a, other, b, childrenA, childrenB);
+    collectPairs(childrenA[0], other, childrenB[0], eps, pairs);
+    collectPairs(childrenA[1], other, childrenB[1], eps, pairs);
+}
+
+void LinearBVH::collectSelfPairs(const int node, const REAL& eps, vector<pair<int, int> >& pairs) const {
+    if (_nodes[node].isLeaf()) {
+        leafPairs(node, *this, node, eps, pairs);
+        return;
+    }
+
+    const int left = node + 1;
+    const int right = _nodes[node].offset;
+    collectSelfPairs(left, eps, pairs);
+    collectSelfPairs(right, eps, pairs);
+    collectPairs(left, *this, right, eps, pairs);
+}
+
+void LinearBVH::overlappingPairs(const LinearBVH& other, const REAL& eps,
+                                 vector<pair<int, int> >& pairs) const {
+    assert(&_vertices == &other._vertices);
+
+    // make sure we don't keep old stuff around by mistake
+    pairs.clear();
+
+    _jobs.clear();
+    splitPairs(0, other, 0, eps, 0, _jobs);
+    collectJobs(other, eps, pairs);
+}
+
+void LinearBVH::selfOverlappingPairs(const REAL& eps, vector<pair<int, int> >& pairs) const {
+    // make sure we don't keep old stuff around by mistake
+    pairs.clear();
+
+    _jobs.clear();
+    splitSelfPairs(0, eps, 0, _jobs);
+    collectJobs(*this, eps, pairs);
+
+    // the pairs between two subtrees come out in whatever order the subtrees were in
+    for (unsigned int x = 0; x < pairs.size(); x++)
+        if (pairs[x].first > pairs[x].second)
+            swap(pairs[x].first, pairs[x].second);
+}
+
+}
@@ -3,10 +3,12 @@
 #include "Platform/include/Timer.h"
 #include "Platform/include/CollisionUtils.h"
 #include "Platform/include/MatrixUtils.h"
+#include "Platform/include/BatchedSVD.h"
 #include "Platform/include/EigenUtils.h"
 #include "Platform/include/RandomUtils.h"
 #include "Platform/include/Logger.h"
 #include <float.h>
+#include <algorithm>
 // DEBUG: only here specifically to debug collisions
 
 
@@ -14,6 +16,9 @@
 // are on triangles that are intersecting
 #define ADD_EDGE_EDGE_PENETRATION_BUG 0
 
+// run the SVDs through the batched kernel, rather than one Eigen::JacobiSVD per tet
+#define USE_BATCHED_SVD 1
+
 namespace Ryao {
 
 using namespace std;
@@ -29,7 +34,10 @@ TET_Mesh::TET_Mesh(const vector<VECTOR3>& restVertices,
     computeTetVolumes(_restVertices, _restTetVolumes);
     computeOneRingVolumes(_restVertices, _restTetVolumes, _restOneRingVolumes);
     computeDmInvs(_DmInvs);
+#if STORE_PFPXS
     computePFpxs(_pFpxs);
+#endif
+    computeVertexTets();
 
     const int totalTets = _tets.size();
     _Fs.resize(totalTets);
@@ -50,6 +58,7 @@ TET_Mesh::TET_Mesh(const vector<VECTOR3>& restVertices,
     _collisionEps = 0.01;
     //_collisionMaterial = NULL; // experimental
     _svdsComputed = false;
+    _positionsVersion = 0;
 
     // this gets overwritten by timestepper every step, so a dummy is fine
     REAL stiffness = 1000.0;
@@ -128,8 +137,7 @@ void TET_Mesh::computeOneRingVolumes(const vector<VECTOR3>& vertices,
     }
 }
 
-void TET_Mesh::computeDmInvs(vector<MATRIX3>& DmInvs) {
-    DmInvs.clear();
+void TET_Mesh::computeDmInvs(MATRIX3_SOA& DmInvs) {
     DmInvs.resize(_tets.size());
 
     for (size_t i = 0; i < _tets.size(); i++) {
@@ -142,6 +150,7 @@ void TET_Mesh::computeDmInvs(vector<MATRIX3>& DmInvs) {
     }
 }
 
+#if STORE_PFPXS
 /**
     * @brief compute change-of-basis from deformation gradient F to positions x for a single DmInv
     * check the Appendix E of Dynamic deformables 
@@ -211,6 +220,61 @@ void TET_Mesh::computePFpxs(vector<MATRIX9x12>& pFpxs) {
     for (size_t i = 0; i < _tets.size(); i++)
         pFpxs[i] = computePFpx(_DmInvs[i]);
 }
+#endif
+
+VECTOR12 TET_Mesh::projectPK1(const MATRIX3& DmInv, const MATRIX3& PK1) {
+    // F = sum_j x_j c_j^T, where c_1..c_3 are the rows of DmInv and c_0 is minus their sum,
+    // so the gradient for vertex j is PK1 * c_j
+    const MATRIX3 G = PK1 * DmInv.transpose();
+
+    VECTOR12 result;
+    result.segment<3>(3) = G.col(0);
+    result.segment<3>(6) = G.col(1);
+    result.segment<3>(9) = G.col(2);
+    result.segment<3>(0) = -(G.col(0) + G.col(1) + G.col(2));
+    return result;
+}
+
+MATRIX12 TET_Mesh::projectHessian(const MATRIX3& DmInv, const MATRIX9& hessian) {
+    // hessian * pFpx first. Column 3 * b + d is sum_j c_b[j] * hessian.col(3 * j + d),
+    // and vertex 0 is minus the sum of the others
+    Eigen::Matrix<REAL, 9, 12> right;
+    for (int b = 1; b < 4; b++)
+        for (int d = 0; d < 3; d++)
+            right.col(3 * b + d) = DmInv(b - 1, 0) * hessian.col(d) +
+                                   DmInv(b - 1, 1) * hessian.col(3 + d) +
+                                   DmInv(b - 1, 2) * hessian.col(6 + d);
+    for (int d = 0; d < 3; d++)
+        right.col(d) = -(right.col(3 + d) + right.col(6 + d) + right.col(9 + d));
+
+    // then pFpx^T on the left, the same way with the rows
+    MATRIX12 result;
+    for (int a = 1; a < 4; a++)
+        for (int e = 0; e < 3; e++)
+            result.row(3 * a + e) = DmInv(a - 1, 0) * right.row(e) +
+                                    DmInv(a - 1, 1) * right.row(3 + e) +
+                                    DmInv(a - 1, 2) * right.row(6 + e);
+    for (int e = 0; e < 3; e++)
+        result.row(e) = -(result.row(3 + e) + result.row(6 + e) + result.row(9 + e));
+    return result;
+}
+
+VECTOR12 TET_Mesh::tetForceDensity(const int tetIndex, const MATRIX3& PK1) const {
+#if STORE_PFPXS
+    return _pFpxs[tetIndex].transpose() * flatten(PK1);
+#else
+    return projectPK1(_DmInvs[tetIndex], PK1);
+#endif
+}
+
+MATRIX12 TET_Mesh::tetHessian(const int tetIndex, const MATRIX9& hessian) const {
+#if STORE_PFPXS
+    const MATRIX9x12& pFpx = _pFpxs[tetIndex];
+    return (pFpx.transpose() * hessian) * pFpx;
+#else
+    return projectHessian(_DmInvs[tetIndex], hessian);
+#endif
+}
 
 // used by computeSurfaceTriangles as a comparator between two triangles
 // to order the map
@@ -457,6 +521,125 @@ void TET_Mesh::computeSurfaceAreas() {
     }
 }
 
+void TET_Mesh::computeVertexTets() {
+    Timer functionTimer(__FUNCTION__);
+    const int totalVertices = _vertices.size();
+
+    _vertexTetStarts.assign(totalVertices + 1, 0);
+    for (unsigned int x = 0; x < _tets.size(); x++)
+        for (int y = 0; y < 4; y++)
+            _vertexTetStarts[_tets[x][y] + 1]++;
+    for (int x = 0; x < totalVertices; x++)
+        _vertexTetStarts[x + 1] += _vertexTetStarts[x];
+
+    // visiting the tets in order keeps each vertex's list sorted
+    _vertexTets.resize(_vertexTetStarts.back());
+    vector<int> fill(_vertexTetStarts.begin(), _vertexTetStarts.end() - 1);
+    for (unsigned int x = 0; x < _tets.size(); x++)
+        for (int y = 0; y < 4; y++)
+            _vertexTets[fill[_tets[x][y]]++] = 4 * x + y;
+}
+
+VECTOR TET_Mesh::gatherTetForces(const vector<VECTOR12>& perElementForces) const {
+    const int totalVertices = _vertices.size();
+    VECTOR forces(3 * totalVertices);
+
+    // each vertex only writes to itself, so there are no races
+#pragma omp parallel for schedule(static)
+    for (int x = 0; x < totalVertices; x++) {
+        VECTOR3 sum = VECTOR3::Zero();
+        for (int y = _vertexTetStarts[x]; y < _vertexTetStarts[x + 1]; y++) {
+            const int tetIndex = _vertexTets[y] / 4;
+            const int which = _vertexTets[y] % 4;
+            sum += perElementForces[tetIndex].segment<3>(3 * which);
+        }
+        forces.segment<3>(3 * x) = sum;
+    }
+
+    return forces;
+}
+
+vector<vector<int>> TET_Mesh::computeVertexColors() const {
+    Timer functionTimer(__FUNCTION__);
+    const int totalVertices = _vertices.size();
+    const vector<int>& starts = _vertexTetStarts;
+
+    // most connected first, ties broken by index so the coloring is deterministic
+    vector<int> order(totalVertices);
+    for (int x = 0; x < totalVertices; x++)
+        order[x] = x;
+    stable_sort(order.begin(), order.end(), [&](const int a, const int b) {
+        return starts[a + 1] - starts[a] > starts[b + 1] - starts[b];
+    });
+
+    // stamp the colors of the neighbors, and take the first free one
+    vector<int> colors(totalVertices, -1);
+    vector<int> stamps;
+    vector<vector<int>> classes;
+    for (int x = 0; x < totalVertices; x++) {
+        const int vertex = order[x];
+        for (int y = starts[vertex]; y < starts[vertex + 1]; y++) {
+            const VECTOR4I& tet = _tets[_vertexTets[y] / 4];
+            for (int z = 0; z < 4; z++)
+                if (colors[tet[z]] >= 0)
+                    stamps[colors[tet[z]]] = vertex;
+        }
+
+        int color = 0;
+        while (color < (int)stamps.size() && stamps[color] == vertex)
+            color++;
+        if (color == (int)stamps.size()) {
+            stamps.push_back(-1);
+            classes.push_back(vector<int>());
+        }
+        colors[vertex] = color;
+        classes[color].push_back(vertex);
+    }
+
+    // keep each class in index order, it's friendlier to the cache
+    for (unsigned int x = 0; x < classes.size(); x++)
+        sort(classes[x].begin(), classes[x].end());
+
+    return classes;
+}
+
+vector<vector<int>> TET_Mesh::computeTetChunkColors(const int chunkSize) const {
+    Timer functionTimer(__FUNCTION__);
+    const int totalTets = _tets.size();
+    const int totalChunks = (totalTets + chunkSize - 1) / chunkSize;
+
+    // stamp the colors of the chunks sharing a vertex, and take the first free one
+    vector<int> colors(totalChunks, -1);
+    vector<int> stamps;
+    vector<vector<int>> classes;
+    for (int x = 0; x < totalChunks; x++) {
+        const int end = min((x + 1) * chunkSize, totalTets);
+        for (int tet = x * chunkSize; tet < end; tet++)
+            for (int y = 0; y < 4; y++) {
+                const int vertex = _tets[tet][y];
+                for (int z = _vertexTetStarts[vertex]; z < _vertexTetStarts[vertex + 1]; z++) {
+                    const int neighbor = _vertexTets[z] / 4 / chunkSize;
+                    if (neighbor != x && colors[neighbor] >= 0)
+                        stamps[colors[neighbor]] = x;
+                }
+            }
+
+        int color = 0;
+        while (color < (int)stamps.size() && stamps[color] == x)
+            color++;
+        if (color == (int)stamps.size()) {
+            stamps.push_back(-1);
+            classes.push_back(vector<int>());
+        }
+        colors[x] = color;
+
+        // visiting in index order keeps each class sorted
+        classes[color].push_back(x);
+    }
+
+    return classes;
+}
+
 void TET_Mesh::computeSurfaceVertices() {
     if (_surfaceTriangles.size() == 0)
         RYAO_ERROR("Did not generate surface triangles!");
@@ -520,49 +703,90 @@ void TET_Mesh::computeSurfaceEdges() {
 
 void TET_Mesh::computeFs() {
     Timer functionTimer(__FUNCTION__);
-    assert(_Fs.size() == _tets.size());
+    assert(_Fs.size() == (int)_tets.size());
+    _svdsComputed = false;
 
-#pragma omp parallel
-#pragma omp for schedule(static)
-    for (int x = 0; x < _tets.size(); x++)
-        _Fs[x] = computeF(x);
+    // F = Ds * DmInv, one lane of F at a time, so the inner loop runs across tets.
+    // An empty mesh has no first tet or vertex to point at
+    const int totalTets = _tets.size();
+    if (totalTets == 0) return;
+    const int* tets = _tets[0].data();
+    const REAL* vertices = _vertices[0].data();
+    const REAL* DmInv[3][3];
+    REAL* F[3][3];
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++) {
+            DmInv[i][j] = _DmInvs.lane(i, j);
+            F[i][j] = _Fs.lane(i, j);
+        }
 
-    _svdsComputed = false;
+#pragma omp parallel for simd schedule(static)
+    for (int x = 0; x < totalTets; x++) {
+        const int v0 = 3 * tets[4 * x];
+        REAL Ds[3][3];
+        for (int j = 0; j < 3; j++) {
+            const int vj = 3 * tets[4 * x + j + 1];
+            for (int i = 0; i < 3; i++)
+                Ds[i][j] = vertices[vj + i] - vertices[v0 + i];
+        }
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                F[i][j][x] = Ds[i][0] * DmInv[0][j][x] + Ds[i][1] * DmInv[1][j][x] + Ds[i][2] * DmInv[2][j][x];
+    }
 }
 
 void TET_Mesh::computeFdots(const VECTOR& velocity) {
     Timer functionTimer(__FUNCTION__);
-    assert(_Fs.size() == _tets.size());
+    assert(_Fs.size() == (int)_tets.size());
 
-#pragma omp parallel
-#pragma omp for schedule(static)
-    for (int x = 0; x < _tets.size(); x++) {
-        const VECTOR4I& tet = _tets[x];
-        VECTOR3 v[4];
-        for (int y = 0; y < 4; y++) {
-            v[y][0] = velocity[3 * tet[y]];
-            v[y][1] = velocity[3 * tet[y] + 1];
-            v[y][2] = velocity[3 * tet[y] + 2];
+    // same as computeFs, but with the velocities
+    const int totalTets = _tets.size();
+    if (totalTets == 0) return;
+    const int* tets = _tets[0].data();
+    const REAL* v = velocity.data();
+    const REAL* DmInv[3][3];
+    REAL* Fdot[3][3];
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++) {
+            DmInv[i][j] = _DmInvs.lane(i, j);
+            Fdot[i][j] = _Fdots.lane(i, j);
         }
 
-        MATRIX3 V;
-        V.col(0) = v[1] - v[0];
-        V.col(1) = v[2] - v[0];
-        V.col(2) = v[3] - v[0];
-        _Fdots[x] = V * _DmInvs[x];
+#pragma omp parallel for simd schedule(static)
+    for (int x = 0; x < totalTets; x++) {
+        const int v0 = 3 * tets[4 * x];
+        REAL V[3][3];
+        for (int j = 0; j < 3; j++) {
+            const int vj = 3 * tets[4 * x + j + 1];
+            for (int i = 0; i < 3; i++)
+                V[i][j] = v[vj + i] - v[v0 + i];
+        }
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                Fdot[i][j][x] = V[i][0] * DmInv[0][j][x] + V[i][1] * DmInv[1][j][x] + V[i][2] * DmInv[2][j][x];
     }
 }
 
 void TET_Mesh::computeSVDs() {
     Timer functionTimer(__FUNCTION__);
-    assert(_Us.size() == _tets.size());
-    assert(_Sigmas.size() == _tets.size());
-    assert(_Vs.size() == _tets.size());
+    assert(_Us.size() == (int)_tets.size());
+    assert(_Sigmas.size() == (int)_tets.size());
+    assert(_Vs.size() == (int)_tets.size());
 
+#if USE_BATCHED_SVD
+    svd_rv(_Fs, _Us, _Sigmas, _Vs);
+#else
 #pragma omp parallel
 #pragma omp for schedule(static)
-    for (int x = 0; x < _tets.size(); x++)
-        svd_rv(_Fs[x], _Us[x], _Sigmas[x], _Vs[x]);
+    for (int x = 0; x < _tets.size(); x++) {
+        MATRIX3 U, V;
+        VECTOR3 Sigma;
+        svd_rv(_Fs[x], U, Sigma, V);
+        _Us[x] = U;
+        _Sigmas[x] = Sigma;
+        _Vs[x] = V;
+    }
+#endif
 
     _svdsComputed = true;
 }
@@ -590,107 +814,64 @@ REAL TET_Mesh::computeHyperelasticEnergy(const VOLUME::HYPERELASTIC& hyperelasti
 
 VECTOR TET_Mesh::computeHyperelasticForces(const VOLUME::HYPERELASTIC& hyperelastic) const {
     Timer functionTimer(__FUNCTION__);
-    vector<VECTOR12> perElementForces(_tets.size());
-    for (unsigned int tetIndex = 0; tetIndex < _tets.size(); tetIndex++) {
+    const int totalTets = _tets.size();
+    vector<VECTOR12> perElementForces(totalTets);
+    const bool needsSVD = hyperelastic.PK1NeedsSVD();
+    assert(!needsSVD || _svdsComputed);
+#pragma omp parallel for schedule(static)
+    for (int tetIndex = 0; tetIndex < totalTets; tetIndex++) {
         const MATRIX3& F = _Fs[tetIndex];
-        const MATRIX3 PK1 = hyperelastic.PK1(F);
-        const VECTOR12 forceDensity = _pFpxs[tetIndex].transpose() * flatten(PK1);
+        const MATRIX3 PK1 = needsSVD ? hyperelastic.PK1(_Us[tetIndex], _Sigmas[tetIndex], _Vs[tetIndex])
+                                     : hyperelastic.PK1(F);
+        const VECTOR12 forceDensity = tetForceDensity(tetIndex, PK1);
         const VECTOR12 force = -_restTetVolumes[tetIndex] * forceDensity;
         perElementForces[tetIndex] = force;
     }
 
-    // scatter the forces to the global force vector, this can be parallelized
-    // better where each vector entry pulls from perElementForce, but let's get
-    // the slow preliminary version working first
-    const int DOFs = _vertices.size() * 3;
-    VECTOR forces(DOFs);
-    forces.setZero();
-
-    for (unsigned int tetIndex = 0; tetIndex < _tets.size(); tetIndex++) {
-        const VECTOR4I tet = _tets[tetIndex];
-        const VECTOR12& tetForce = perElementForces[tetIndex];
-        for (int x = 0; x < 4; x++) {
-            unsigned int index = 3 * tet[x];
-            forces[index] += tetForce[3 * x];
-            forces[index + 1] += tetForce[3 * x + 1];
-            forces[index + 2] += tetForce[3 * x + 2];
-        }
-    }
-
-    return forces;
+    // each vector entry pulls from perElementForces
+    return gatherTetForces(perElementForces);
 }
 
 VECTOR TET_Mesh::computeDampingForces(const VOLUME::Damping& damping) const {
     Timer functionTimer(__FUNCTION__);
-    vector<VECTOR12> perElementForces(_tets.size());
-    for (unsigned int tetIndex = 0; tetIndex < _tets.size(); tetIndex++) {
+    const int totalTets = _tets.size();
+    vector<VECTOR12> perElementForces(totalTets);
+#pragma omp parallel for schedule(static)
+    for (int tetIndex = 0; tetIndex < totalTets; tetIndex++) {
         const MATRIX3& F = _Fs[tetIndex];
         const MATRIX3& Fdot = _Fdots[tetIndex];
         const MATRIX3 PK1 = damping.PK1(F, Fdot);
-        const VECTOR12 forceDensity = _pFpxs[tetIndex].transpose() * flatten(PK1);
+        const VECTOR12 forceDensity = tetForceDensity(tetIndex, PK1);
         const VECTOR12 force = -_restTetVolumes[tetIndex] * forceDensity;
         perElementForces[tetIndex] = force;
     }
-    // scatter the forces to the global force vector, this can be parallelized
-    // better where each vector entry pulls from perElementForce, but let's get
-    // the slow preliminary version working first
-    const int DOFs = _vertices.size() * 3;
-    VECTOR forces(DOFs);
-    forces.setZero();
 
-    for (unsigned int tetIndex = 0; tetIndex < _tets.size(); tetIndex++) {
-        const VECTOR4I tet = _tets[tetIndex];
-        const VECTOR12& tetForce = perElementForces[tetIndex];
-        for (int x = 0; x < 4; x++) {
-            unsigned int index = 3 * tet[x];
-            forces[index] += tetForce[3 * x];
-            forces[index + 1] += tetForce[3 * x + 1];
-            forces[index + 2] += tetForce[3 * x + 2];
-        }
-    }
-
-    return forces;
+    // each vector entry pulls from perElementForces
+    return gatherTetForces(perElementForces);
 }
 
 VECTOR TET_Mesh::computeInternalForce(const VOLUME::HYPERELASTIC& hyperelastic,
     const VOLUME::Damping& damping) const {
     Timer functionTimer(__FUNCTION__);
     vector<VECTOR12> perElementForces(_tets.size());
+    const bool needsSVD = hyperelastic.PK1NeedsSVD();
+    assert(!needsSVD || _svdsComputed);
 #pragma omp parallel
 #pragma  omp for schedule(static)
     for (int tetIndex = 0; tetIndex < _tets.size(); tetIndex++) {
-        const MATRIX3& U = _Us[tetIndex];
-        const MATRIX3& V = _Vs[tetIndex];
-        const VECTOR3& Sigma = _Sigmas[tetIndex];
         const MATRIX3& F = _Fs[tetIndex];
         const MATRIX3& Fdot = _Fdots[tetIndex];
 
-        const MATRIX3 elasticPK1 = hyperelastic.PK1(U, Sigma, V);
+        const MATRIX3 elasticPK1 = needsSVD ? hyperelastic.PK1(_Us[tetIndex], _Sigmas[tetIndex], _Vs[tetIndex])
+                                            : hyperelastic.PK1(F);
         const MATRIX3 dampingPK1 = damping.PK1(F, Fdot);
-        const VECTOR12 forceDensity = _pFpxs[tetIndex].transpose() * flatten(elasticPK1 + dampingPK1);
+        const VECTOR12 forceDensity = tetForceDensity(tetIndex, elasticPK1 + dampingPK1);
         const VECTOR12 force = -_restTetVolumes[tetIndex] * forceDensity;
         perElementForces[tetIndex] = force;
     }
 
-    // scatter the forces to the global force vector, this can be parallelized
-    // better where each vector entry pulls from perElementForce, but let's get
-    // the slow preliminary version working first
-    const int DOFs = _vertices.size() * 3;
-    VECTOR forces(DOFs);
-    forces.setZero();
-
-    for (unsigned int tetIndex = 0; tetIndex < _tets.size(); tetIndex++) {
-        const VECTOR4I& tet = _tets[tetIndex];
-        const VECTOR12& tetForce = perElementForces[tetIndex];
-        for (int x = 0; x < 4; x++) {
-            unsigned int index = 3 * tet[x];
-            forces[index] += tetForce[3 * x];
-            forces[index + 1] += tetForce[3 * x + 1];
-            forces[index + 2] += tetForce[3 * x + 2];
-        }
-    }
-
-    return forces;
+    // each vector entry pulls from perElementForces
+    return gatherTetForces(perElementForces);
 }
 
 /**
@@ -706,9 +887,8 @@ SPARSE_MATRIX TET_Mesh::computeDampingHessian(const VOLUME::Damping& damping) co
     for (unsigned int i = 0; i < _tets.size(); i++) {
         const MATRIX3& F = _Fs[i];
         const MATRIX3& Fdot = _Fdots[i];
-        const MATRIX9x12& pFpx = _pFpxs[i];
         const MATRIX9& hessian = -_restTetVolumes[i] * damping.hessian(F, Fdot);
-        perElementHessians[i] = (pFpx.transpose() * hessian) * pFpx;
+        perElementHessians[i] = tetHessian(i, hessian);
     }
 
     // build out the triplets
@@ -749,9 +929,8 @@ SPARSE_MATRIX TET_Mesh::computeHyperelasticHessian(const VOLUME::HYPERELASTIC& h
     vector<MATRIX12> perElementHessians(_tets.size());
     for (unsigned int i = 0; i < _tets.size(); i++) {
         const MATRIX3& F = _Fs[i];
-        const MATRIX9x12& pFpx = _pFpxs[i];
         const MATRIX9 hessian = -_restTetVolumes[i] * hyperelastic.hessian(F);
-        perElementHessians[i] = (pFpx.transpose() * hessian) * pFpx;
+        perElementHessians[i] = tetHessian(i, hessian);
     }
 
     // build out the triplets
@@ -793,9 +972,8 @@ SPARSE_MATRIX TET_Mesh::computeHyperelasticClampedHessian(const VOLUME::HYPERELA
     vector<MATRIX12> perElementHessians(_tets.size());
     for (unsigned int i = 0; i < _tets.size(); i++) {
         const MATRIX3& F = _Fs[i];
-        const MATRIX9x12& pFpx = _pFpxs[i];
         const MATRIX9 hessian = -_restTetVolumes[i] * hyperelastic.clampedHessian(F);
-        perElementHessians[i] = (pFpx.transpose() * hessian) * pFpx;
+        perElementHessians[i] = tetHessian(i, hessian);
     }
 
     // build out the triplets
@@ -848,6 +1026,7 @@ void TET_Mesh::setPositions(const VECTOR& positions) {
         _vertices[x][1] = positions[3 * x + 1];
         _vertices[x][2] = positions[3 * x + 2];
     }
+    _positionsVersion++;
 }
 
 void TET_Mesh::setDisplacement(const VECTOR& delta) {
@@ -858,6 +1037,7 @@ void TET_Mesh::setDisplacement(const VECTOR& delta) {
         _vertices[x][1] = _restVertices[x][1] + delta[3 * x + 1];
         _vertices[x][2] = _restVertices[x][2] + delta[3 * x + 2];
     }
+    _positionsVersion++;
 }
 
 void TET_Mesh::getBoundingBox(VECTOR3& mins, VECTOR3& maxs) const {
@@ -1624,6 +1804,22 @@ void TET_Mesh::buildVertexFaceCollisionTets(const VECTOR& velocity) {
     }
 }
 
+REAL TET_Mesh::computeVertexFaceCollisionEnergy() const {
+    Timer functionTimer(__FUNCTION__);
+
+    REAL finalEnergy = 0.0;
+    for (unsigned int i = 0; i < _vertexFaceCollisionTets.size(); i++) {
+        vector<VECTOR3> vs(4);
+        for (unsigned int j = 0; j < 4; j++)
+            vs[j] = _vertices[_vertexFaceCollisionTets[i][j]];
+
+        const REAL psi = _vertexFaceEnergy->psi(vs);
+        finalEnergy += _vertexFaceCollisionAreas[i] * psi;
+    }
+
+    return finalEnergy;
+}
+
 VECTOR TET_Mesh::computeVertexFaceCollisionForces() const {
     Timer functionTimer(__FUNCTION__);
 
@@ -1684,7 +1880,13 @@ REAL TET_Mesh::computeEdgeEdgeCollisionEnergy() const {
         const VECTOR2& a = _edgeEdgeCoordinates[i].first;
         const VECTOR2& b = _edgeEdgeCoordinates[i].second;
 
+        // match computeEdgeEdgeCollisionForces(), which flips intersecting edges
+#if ADD_EDGE_EDGE_PENETRATION_BUG
         const REAL psi = _edgeEdgeEnergy->psi(vs, a, b);
+#else
+        const REAL psi = (!_edgeEdgeIntersections[i]) ? _edgeEdgeEnergy->psi(vs, a, b)
+                                                      : _edgeEdgeEnergy->psiNegated(vs, a, b);
+#endif
         finalEnergy += _edgeEdgeCollisionAreas[i] * psi;
     }
 
@@ -1848,6 +2050,108 @@ SPARSE_MATRIX TET_Mesh::computeVertexFaceCollisionClampedHessian() const {
     return A;
 }
 
+void TET_Mesh::addVertexFaceCollisionForces(VECTOR& forces) const {
+    Timer functionTimer(__FUNCTION__);
+    assert((int)forces.size() == 3 * (int)_vertices.size());
+
+    vector<VECTOR3> vs(4);
+    for (unsigned int i = 0; i < _vertexFaceCollisionTets.size(); i++) {
+        const VECTOR4I& tet = _vertexFaceCollisionTets[i];
+        for (int j = 0; j < 4; j++)
+            vs[j] = _vertices[tet[j]];
+        const VECTOR12 force = -_vertexFaceCollisionAreas[i] * _vertexFaceEnergy->gradient(vs);
+
+        for (int x = 0; x < 4; x++)
+            forces.segment<3>(3 * tet[x]) += force.segment<3>(3 * x);
+    }
+}
+
+void TET_Mesh::addVertexFaceCollisionClampedHessians(vector<VECTOR4I>& vertices, vector<MATRIX12>& hessians) const {
+    Timer functionTimer(__FUNCTION__);
+    assert(vertices.size() == hessians.size());
+
+    const int first = hessians.size();
+    const int totalCollisions = _vertexFaceCollisionTets.size();
+    vertices.resize(first + totalCollisions);
+    hessians.resize(first + totalCollisions);
+
+    // each collision writes its own entry, and each thread gets its own vertex buffer
+#pragma omp parallel
+    {
+        vector<VECTOR3> vs(4);
+#pragma omp for schedule(static)
+        for (int i = 0; i < totalCollisions; i++) {
+            const VECTOR4I& tet = _vertexFaceCollisionTets[i];
+            for (int j = 0; j < 4; j++)
+                vs[j] = _vertices[tet[j]];
+            vertices[first + i] = tet;
+            hessians[first + i] = -_vertexFaceCollisionAreas[i] * _vertexFaceEnergy->clampedHessian(vs);
+        }
+    }
+}
+
+void TET_Mesh::addEdgeEdgeCollisionForces(VECTOR& forces) const {
+    Timer functionTimer(__FUNCTION__);
+    assert((int)forces.size() == 3 * (int)_vertices.size());
+
+    vector<VECTOR3> vs(4);
+    for (unsigned int i = 0; i < _edgeEdgeCollisions.size(); i++) {
+        const VECTOR2I& edge0 = _surfaceEdges[_edgeEdgeCollisions[i].first];
+        const VECTOR2I& edge1 = _surfaceEdges[_edgeEdgeCollisions[i].second];
+        const VECTOR4I vertexIndices(edge0[0], edge0[1], edge1[0], edge1[1]);
+        for (int j = 0; j < 4; j++)
+            vs[j] = _vertices[vertexIndices[j]];
+
+        const VECTOR2& a = _edgeEdgeCoordinates[i].first;
+        const VECTOR2& b = _edgeEdgeCoordinates[i].second;
+
+#if ADD_EDGE_EDGE_PENETRATION_BUG
+        const VECTOR12 force = -_edgeEdgeCollisionAreas[i] * _edgeEdgeEnergy->gradient(vs, a, b);
+#else
+        const VECTOR12 force = (!_edgeEdgeIntersections[i]) ? -_edgeEdgeCollisionAreas[i] * _edgeEdgeEnergy->gradient(vs, a, b)
+            : -_edgeEdgeCollisionAreas[i] * _edgeEdgeEnergy->gradientNegated(vs, a, b);
+#endif
+
+        for (int x = 0; x < 4; x++)
+            forces.segment<3>(3 * vertexIndices[x]) += force.segment<3>(3 * x);
+    }
+}
+
+void TET_Mesh::addEdgeEdgeCollisionClampedHessians(vector<VECTOR4I>& vertices, vector<MATRIX12>& hessians) const {
+    Timer functionTimer(__FUNCTION__);
+    assert(vertices.size() == hessians.size());
+
+    const int first = hessians.size();
+    const int totalCollisions = _edgeEdgeCollisions.size();
+    vertices.resize(first + totalCollisions);
+    hessians.resize(first + totalCollisions);
+
+    // each collision writes its own entry, and each thread gets its own vertex buffer
+#pragma omp parallel
+    {
+        vector<VECTOR3> vs(4);
+#pragma omp for schedule(static)
+        for (int i = 0; i < totalCollisions; i++) {
+            const VECTOR2I& edge0 = _surfaceEdges[_edgeEdgeCollisions[i].first];
+            const VECTOR2I& edge1 = _surfaceEdges[_edgeEdgeCollisions[i].second];
+            const VECTOR4I vertexIndices(edge0[0], edge0[1], edge1[0], edge1[1]);
+            for (int j = 0; j < 4; j++)
+                vs[j] = _vertices[vertexIndices[j]];
+
+            const VECTOR2& a = _edgeEdgeCoordinates[i].first;
+            const VECTOR2& b = _edgeEdgeCoordinates[i].second;
+
+            vertices[first + i] = vertexIndices;
+#if ADD_EDGE_EDGE_PENETRATION_BUG
+            hessians[first + i] = -_edgeEdgeCollisionAreas[i] * _edgeEdgeEnergy->clampedHessian(vs, a, b);
+#else
+            hessians[first + i] = (!_edgeEdgeIntersections[i]) ? -_edgeEdgeCollisionAreas[i] * _edgeEdgeEnergy->clampedHessian(vs, a, b)
+                : -_edgeEdgeCollisionAreas[i] * _edgeEdgeEnergy->clampedHessianNegated(vs, a, b);
+#endif
+        }
+    }
+}
+
 void TET_Mesh::computeSurfaceVertexOneRings() {
     _insideSurfaceVertexOneRing.clear();
     for (unsigned int x = 0; x < _surfaceEdges.size(); x++) {
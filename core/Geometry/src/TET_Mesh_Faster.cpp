@@ -1,5 +1,15 @@
 #include "TET_Mesh_Faster.h"
-
+#include "Hyperelastic/include/SNH.h"
+#include "Hyperelastic/include/StVK.h"
+#include "Hyperelastic/include/ARAP.h"
+#include "Hyperelastic/include/NeoHookeanBW.h"
+#include "Hyperelastic/include/SNHWithBarrier.h"
+#include <algorithm>
+#include <typeindex>
+#include <unordered_map>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace Ryao {
 using namespace std;
@@ -10,7 +20,8 @@ TET_Mesh_Faster::TET_Mesh_Faster(const vector<VECTOR3>& restVertices,
     TET_Mesh(restVertices, faces, tets),
     // build collision detection data structures
     _aabbTreeTriangles(_vertices, &_surfaceTriangles),
-    _aabbTreeEdges(_vertices, &_surfaceEdges) {
+    _aabbTreeEdges(_vertices, &_surfaceEdges),
+    _aabbTreeVertices(_vertices, &_surfaceVertices) {
     RYAO_INFO("Initializing matrix sparsity ... ");
     // build out the triplets
     typedef Eigen::Triplet<REAL> TRIPLET;
@@ -48,11 +59,19 @@ TET_Mesh_Faster::TET_Mesh_Faster(const vector<VECTOR3>& restVertices,
     // preallocate per-element storage
     _perElementHessians.resize(_tets.size());
 
-    // mapping from edge index pairs to _surfaceEdges
-    for (unsigned int x = 0; x < _surfaceEdges.size(); x++) {
-        pair<int,int> edge(_surfaceEdges[x][0], _surfaceEdges[x][1]);
-        _edgeHash[edge] = x;
-    }
+    // the fused elastic pass goes one color at a time
+    _tetChunkColors = computeTetChunkColors(ELASTIC_CHUNK_SIZE);
+    RYAO_INFO("The fused elastic pass needs {} chunk colors", _tetChunkColors.size());
+
+    // nothing has been found yet, so nothing can be reused
+    _candidateMargin = COLLISION_CANDIDATE_MARGIN;
+    _vertexFaceCandidatesValid = false;
+    _edgeEdgeCandidatesValid = false;
+    _candidatePositionsVersion = -1;
+    _candidateEps = 0.0;
+    _candidateCheckVersion = -1;
+    _vertexFaceCandidateStats = CANDIDATE_CACHE_STATS{0, 0};
+    _edgeEdgeCandidateStats = CANDIDATE_CACHE_STATS{0, 0};
 }
 
 void TET_Mesh_Faster::computeCompressedIndices() {
@@ -81,6 +100,7 @@ void TET_Mesh_Faster::computeCompressedIndices() {
     RYAO_INFO("Computing compressed indices ..");
     // allocate an array for each non-zero matrix entry
     _hessianGathers.resize(_sparseA.nonZeros());
+    _tetEntryOffsets.resize(48 * _tets.size());
     for (unsigned int i = 0; i < _tets.size(); i++) {
         const VECTOR4I& tet = _tets[i];
         for (int y = 0; y < 4; y++) {
@@ -100,6 +120,11 @@ void TET_Mesh_Faster::computeCompressedIndices() {
                         tetMapping[1] = 3 * x + a;
                         tetMapping[2] = 3 * y + b;
                         _hessianGathers[index].push_back(tetMapping);
+
+                        // all three rows of the block are in the pattern, so
+                        // they're consecutive in the column
+                        if (a == 0)
+                            _tetEntryOffsets[48 * i + 12 * y + 3 * x + b] = index;
                     }
             }
         }
@@ -107,20 +132,339 @@ void TET_Mesh_Faster::computeCompressedIndices() {
     RYAO_INFO("Done.");
 }
 
-SPARSE_MATRIX TET_Mesh_Faster::computeHyperelasticClampedHessian(const VOLUME::HYPERELASTIC &hyperelastic) const {
-    Timer functionTimer(string("TET_Mesh_Faster::") + __FUNCTION__);
+void TET_Mesh_Faster::computeBlockGathers(const bool upperOnly) const {
+    Timer functionTimer(__FUNCTION__);
+
+    // every pair of vertices in a tet gets a block
+    vector<pair<int, int> > blockPairs;
+    blockPairs.reserve(16 * _tets.size());
+    for (unsigned int i = 0; i < _tets.size(); i++)
+        for (int y = 0; y < 4; y++)
+            for (int x = 0; x < 4; x++)
+                blockPairs.push_back(make_pair(_tets[i][x], _tets[i][y]));
+
+    const int totalVertices = _vertices.size();
+    _blockA.setPattern(totalVertices, totalVertices, blockPairs, upperOnly);
+
+    _blockGathers.clear();
+    _blockGathers.resize(_blockA.nonZeroBlocks());
+    _tetBlockIndices.assign(16 * _tets.size(), -1);
+    for (unsigned int i = 0; i < _tets.size(); i++) {
+        const VECTOR4I& tet = _tets[i];
+        for (int y = 0; y < 4; y++)
+            for (int x = 0; x < 4; x++) {
+                if (upperOnly && tet[x] > tet[y])
+                    continue;
+                const int index = _blockA.blockIndex(tet[x], tet[y]);
+                _tetBlockIndices[16 * i + 4 * y + x] = index;
+
+                // store the tet and the local vertex pair this corresponds to
+                _blockGathers[index].push_back(VECTOR3I(i, x, y));
+            }
+    }
+
+    RYAO_INFO("Block sparsity: {} blocks, {} index bytes vs. {} for the entry-wise matrix",
+              _blockA.nonZeroBlocks(), _blockA.indexBytes(),
+              (_sparseA.nonZeros() + _sparseA.outerSize() + 1) * sizeof(int));
+}
+
+void TET_Mesh_Faster::computePerElementClampedHessians(const VOLUME::HYPERELASTIC& hyperelastic) const {
+    const int totalTets = _tets.size();
+    if (!hyperelastic.clampedHessianNeedsSVD()) {
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < totalTets; i++) {
+            const MATRIX9 hessian   = -_restTetVolumes[i] * hyperelastic.clampedHessian(MATRIX3(_Fs[i]));
+            _perElementHessians[i]  = tetHessian(i, hessian);
+        }
+        return;
+    }
+
     assert(_svdsComputed == true);
 #pragma omp parallel
 #pragma omp for schedule(static)
-    for (int i = 0; i < _tets.size(); i++) {
+    for (int i = 0; i < totalTets; i++) {
         const MATRIX3& U        = _Us[i];
         const MATRIX3& V        = _Vs[i];
         const VECTOR3& Sigma    = _Sigmas[i];
-        const MATRIX9x12& pFpx  = _pFpxs[i];
         const MATRIX9 hessian   = -_restTetVolumes[i] * hyperelastic.clampedHessian(U, Sigma, V);
-        _perElementHessians[i]  = (pFpx.transpose() * hessian) * pFpx;
+        _perElementHessians[i]  = tetHessian(i, hessian);
     }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// The material calls in the templated element loops. Qualifying the call with
+// the concrete class skips the vtable, and lets it be inlined when the material
+// is visible, e.g. with link time optimization. Each material says which
+// overload it actually implements, so the base class never has to rebuild F
+// from the SVD, or take the SVD of F, to get to it.
+//
+// The plain HYPERELASTIC versions are the virtual fallback, and are picked
+// over the templates when that's the static type.
+//////////////////////////////////////////////////////////////////////////////
+template <class MATERIAL>
+static inline REAL materialPsi(const MATERIAL& material, const MATRIX3& F) {
+    if constexpr (MATERIAL::PSI_USES_SVD) {
+        MATRIX3 U, V;
+        VECTOR3 Sigma;
+        svd_rv(F, U, Sigma, V);
+        return material.MATERIAL::psi(U, Sigma, V);
+    } else
+        return material.MATERIAL::psi(F);
+}
 
+template <class MATERIAL>
+static inline MATRIX3 materialPK1(const MATERIAL& material, const MATRIX3& F,
+                                  const MATRIX3& U, const VECTOR3& Sigma, const MATRIX3& V) {
+    if constexpr (MATERIAL::PK1_USES_SVD)
+        return material.MATERIAL::PK1(U, Sigma, V);
+    else
+        return material.MATERIAL::PK1(F);
+}
+
+template <class MATERIAL>
+static inline MATRIX9 materialClampedHessian(const MATERIAL& material, const MATRIX3& F,
+                                             const MATRIX3& U, const VECTOR3& Sigma, const MATRIX3& V) {
+    if constexpr (MATERIAL::CLAMPED_HESSIAN_USES_SVD)
+        return material.MATERIAL::clampedHessian(U, Sigma, V);
+    else
+        return material.MATERIAL::clampedHessian(F);
+}
+
+static inline REAL materialPsi(const VOLUME::HYPERELASTIC& material, const MATRIX3& F) {
+    return material.psi(F);
+}
+
+static inline MATRIX3 materialPK1(const VOLUME::HYPERELASTIC& material, const MATRIX3& F,
+                                  const MATRIX3& U, const VECTOR3& Sigma, const MATRIX3& V) {
+    return material.PK1NeedsSVD() ? material.PK1(U, Sigma, V) : material.PK1(F);
+}
+
+static inline MATRIX9 materialClampedHessian(const VOLUME::HYPERELASTIC& material, const MATRIX3& F,
+                                             const MATRIX3& U, const VECTOR3& Sigma, const MATRIX3& V) {
+    return material.clampedHessianNeedsSVD() ? material.clampedHessian(U, Sigma, V) : material.clampedHessian(F);
+}
+
+// does the pass over the tets need the SVDs of all of them? The virtual fallback can't know
+// until runtime, and a clamped Hessian that tries without the SVD first only needs some.
+template <class MATERIAL>
+static constexpr bool materialNeedsSVD() {
+    if constexpr (std::is_same<MATERIAL, VOLUME::HYPERELASTIC>::value)
+        return true;
+    else
+        return MATERIAL::PK1_USES_SVD ||
+               (MATERIAL::CLAMPED_HESSIAN_USES_SVD && !MATERIAL::CLAMPED_HESSIAN_TRIES_WITHOUT_SVD);
+}
+
+template <class MATERIAL>
+static constexpr bool materialTriesWithoutSVD() {
+    if constexpr (std::is_same<MATERIAL, VOLUME::HYPERELASTIC>::value)
+        return false;
+    else
+        return MATERIAL::CLAMPED_HESSIAN_TRIES_WITHOUT_SVD && !materialNeedsSVD<MATERIAL>();
+}
+
+void TET_Mesh_Faster::scatterTetHessian(const int tetIndex, const MATRIX12& hessian, const bool blocks) {
+    if (blocks) {
+        const int* indices = &_tetBlockIndices[16 * tetIndex];
+        for (int y = 0; y < 4; y++)
+            for (int x = 0; x < 4; x++)
+                if (indices[4 * y + x] >= 0)
+                    _blockA.block(indices[4 * y + x]) += hessian.block<3, 3>(3 * x, 3 * y);
+        return;
+    }
+
+    REAL* base = _sparseA.valuePtr();
+    const int* offsets = &_tetEntryOffsets[48 * tetIndex];
+    for (int y = 0; y < 4; y++)
+        for (int x = 0; x < 4; x++)
+            for (int b = 0; b < 3; b++) {
+                REAL* column = base + offsets[12 * y + 3 * x + b];
+                for (int a = 0; a < 3; a++)
+                    column[a] += hessian(3 * x + a, 3 * y + b);
+            }
+}
+
+template <class MATERIAL>
+VECTOR TET_Mesh_Faster::computeElasticTerms(const MATERIAL& material, const bool blocks, const bool upperOnly) {
+    Timer functionTimer(string("TET_Mesh_Faster::") + __FUNCTION__);
+    constexpr bool needsSVD = materialNeedsSVD<MATERIAL>();
+    constexpr bool triesWithoutSVD = materialTriesWithoutSVD<MATERIAL>();
+
+    // the tets add into the matrix, so it has to start out at zero
+    if (blocks) {
+        if (_blockGathers.empty() || _blockA.upperOnly() != upperOnly)
+            computeBlockGathers(upperOnly);
+        _blockA.setZero();
+    } else {
+        // DO NOT use _sparseA.setZero()! It will not just set things to zero, it will
+        // delete the sparsity pattern
+        const int nonZeros = _sparseA.nonZeros();
+        REAL* base = _sparseA.valuePtr();
+#pragma omp parallel for schedule(static)
+        for (int x = 0; x < nonZeros; x++)
+            base[x] = 0.0;
+    }
+    VECTOR forces = VECTOR::Zero(DOFs());
+
+    const int totalTets = _tets.size();
+#pragma omp parallel
+    for (unsigned int color = 0; color < _tetChunkColors.size(); color++) {
+        const vector<int>& chunks = _tetChunkColors[color];
+        const int totalChunks = chunks.size();
+
+        // the implicit barrier at the end keeps the colors from overlapping
+#pragma omp for schedule(static)
+        for (int chunk = 0; chunk < totalChunks; chunk++) {
+            const int chunkEnd = min((chunks[chunk] + 1) * ELASTIC_CHUNK_SIZE, totalTets);
+            for (int begin = chunks[chunk] * ELASTIC_CHUNK_SIZE; begin < chunkEnd; begin += SVD_LANES) {
+                const int count = min(SVD_LANES, chunkEnd - begin);
+
+                MATRIX3 Fs[SVD_LANES], Us[SVD_LANES], Vs[SVD_LANES], DmInvs[SVD_LANES];
+                VECTOR3 Sigmas[SVD_LANES];
+                for (int x = 0; x < count; x++) {
+                    const VECTOR4I& tet = _tets[begin + x];
+                    MATRIX3 Ds;
+                    Ds.col(0) = _vertices[tet[1]] - _vertices[tet[0]];
+                    Ds.col(1) = _vertices[tet[2]] - _vertices[tet[0]];
+                    Ds.col(2) = _vertices[tet[3]] - _vertices[tet[0]];
+                    DmInvs[x] = _DmInvs[begin + x];
+                    Fs[x] = Ds * DmInvs[x];
+                }
+
+                // the SVD is only worth it if the material is going to use it
+                if constexpr (needsSVD)
+                    svd_rv(Fs, count, Us, Sigmas, Vs);
+
+                MATRIX9 hessians[SVD_LANES];
+                if constexpr (triesWithoutSVD) {
+                    // only the tets that need clamping go through the SVD, still as one batch
+                    int clamped[SVD_LANES];
+                    MATRIX3 clampedFs[SVD_LANES];
+                    int totalClamped = 0;
+                    for (int x = 0; x < count; x++)
+                        if (!material.MATERIAL::clampedHessianWithoutSVD(Fs[x], hessians[x])) {
+                            clamped[totalClamped] = x;
+                            clampedFs[totalClamped++] = Fs[x];
+                        }
+
+                    if (totalClamped > 0) {
+                        svd_rv(clampedFs, totalClamped, Us, Sigmas, Vs);
+                        for (int x = 0; x < totalClamped; x++)
+                            hessians[clamped[x]] = material.MATERIAL::clampedHessian(Us[x], Sigmas[x], Vs[x]);
+                    }
+                } else
+                    for (int x = 0; x < count; x++)
+                        hessians[x] = materialClampedHessian(material, Fs[x], Us[x], Sigmas[x], Vs[x]);
+
+                for (int x = 0; x < count; x++) {
+                    const int tetIndex = begin + x;
+                    const VECTOR4I& tet = _tets[tetIndex];
+                    const REAL volume = _restTetVolumes[tetIndex];
+                    const MATRIX3 PK1 = materialPK1(material, Fs[x], Us[x], Sigmas[x], Vs[x]);
+                    const VECTOR12 force = -volume * projectPK1(DmInvs[x], PK1);
+                    for (int y = 0; y < 4; y++)
+                        forces.segment<3>(3 * tet[y]) += force.segment<3>(3 * y);
+                    scatterTetHessian(tetIndex, projectHessian(DmInvs[x], (-volume * hessians[x]).eval()), blocks);
+
+                    // only writes, so other passes can still read them
+                    _Fs[tetIndex] = Fs[x];
+                    if constexpr (needsSVD) {
+                        _Us[tetIndex] = Us[x];
+                        _Sigmas[tetIndex] = Sigmas[x];
+                        _Vs[tetIndex] = Vs[x];
+                    }
+                }
+            }
+        }
+    }
+    _svdsComputed = needsSVD;
+
+    return forces;
+}
+
+template <class MATERIAL>
+REAL TET_Mesh_Faster::computeElasticEnergy(const MATERIAL& material) const {
+    const int totalTets = _tets.size();
+    VECTOR tetEnergies(totalTets);
+#pragma omp parallel for schedule(static)
+    for (int tetIndex = 0; tetIndex < totalTets; tetIndex++)
+        tetEnergies[tetIndex] = _restTetVolumes[tetIndex] * materialPsi(material, MATRIX3(_Fs[tetIndex]));
+
+    return tetEnergies.sum();
+}
+
+template <class MATERIAL>
+static VECTOR elasticTermsKernel(TET_Mesh_Faster& tetMesh, const VOLUME::HYPERELASTIC& hyperelastic,
+                                 const bool blocks, const bool upperOnly) {
+    return tetMesh.computeElasticTerms<MATERIAL>(static_cast<const MATERIAL&>(hyperelastic), blocks, upperOnly);
+}
+
+template <class MATERIAL>
+static REAL elasticEnergyKernel(const TET_Mesh_Faster& tetMesh, const VOLUME::HYPERELASTIC& hyperelastic) {
+    return tetMesh.computeElasticEnergy<MATERIAL>(static_cast<const MATERIAL&>(hyperelastic));
+}
+
+const TET_Mesh_Faster::ElasticKernels& TET_Mesh_Faster::findElasticKernels(const VOLUME::HYPERELASTIC& hyperelastic) {
+    static const ElasticKernels fallback = {
+        elasticTermsKernel<VOLUME::HYPERELASTIC>, elasticEnergyKernel<VOLUME::HYPERELASTIC> };
+    static const unordered_map<type_index, ElasticKernels> registry = {
+        { typeid(VOLUME::SNH),            { elasticTermsKernel<VOLUME::SNH>,            elasticEnergyKernel<VOLUME::SNH> } },
+        { typeid(VOLUME::StVK),           { elasticTermsKernel<VOLUME::StVK>,           elasticEnergyKernel<VOLUME::StVK> } },
+        { typeid(VOLUME::ARAP),           { elasticTermsKernel<VOLUME::ARAP>,           elasticEnergyKernel<VOLUME::ARAP> } },
+        { typeid(VOLUME::NeoHookeanBW),   { elasticTermsKernel<VOLUME::NeoHookeanBW>,   elasticEnergyKernel<VOLUME::NeoHookeanBW> } },
+        { typeid(VOLUME::SNHWithBarrier), { elasticTermsKernel<VOLUME::SNHWithBarrier>, elasticEnergyKernel<VOLUME::SNHWithBarrier> } }
+    };
+
+    const auto found = registry.find(type_index(typeid(hyperelastic)));
+    if (found == registry.end())
+        return fallback;
+    return found->second;
+}
+
+VECTOR TET_Mesh_Faster::computeFusedElasticTerms(const VOLUME::HYPERELASTIC& hyperelastic,
+                                                 const bool blocks, const bool upperOnly) {
+    return findElasticKernels(hyperelastic).terms(*this, hyperelastic, blocks, upperOnly);
+}
+
+REAL TET_Mesh_Faster::computeElasticEnergy(const VOLUME::HYPERELASTIC& hyperelastic) const {
+    return findElasticKernels(hyperelastic).energy(*this, hyperelastic);
+}
+
+const BlockSparseMatrix& TET_Mesh_Faster::computeHyperelasticClampedHessianBlocks(const VOLUME::HYPERELASTIC& hyperelastic,
+                                                                                  const bool upperOnly) const {
+    Timer functionTimer(string("TET_Mesh_Faster::") + __FUNCTION__);
+    computePerElementClampedHessians(hyperelastic);
+    return assembleHyperelasticClampedHessianBlocks(upperOnly);
+}
+
+const BlockSparseMatrix& TET_Mesh_Faster::assembleHyperelasticClampedHessianBlocks(const bool upperOnly) const {
+    if (_blockGathers.empty() || _blockA.upperOnly() != upperOnly)
+        computeBlockGathers(upperOnly);
+
+    Timer assemblyTimer("Block sparse matrix assembly");
+    const int totalBlocks = _blockA.nonZeroBlocks();
+#pragma omp parallel
+#pragma omp for schedule(static)
+    for (int x = 0; x < totalBlocks; x++) {
+        const vector<VECTOR3I>& gather = _blockGathers[x];
+        MATRIX3& block = _blockA.block(x);
+        block.setZero();
+
+        for (unsigned int y = 0; y < gather.size(); y++) {
+            const VECTOR3I& lookup = gather[y];
+            block += _perElementHessians[lookup[0]].block<3, 3>(3 * lookup[1], 3 * lookup[2]);
+        }
+    }
+    return _blockA;
+}
+
+SPARSE_MATRIX TET_Mesh_Faster::computeHyperelasticClampedHessian(const VOLUME::HYPERELASTIC &hyperelastic) const {
+    Timer functionTimer(string("TET_Mesh_Faster::") + __FUNCTION__);
+    computePerElementClampedHessians(hyperelastic);
+    return assembleHyperelasticClampedHessian();
+}
+
+SPARSE_MATRIX TET_Mesh_Faster::assembleHyperelasticClampedHessian() const {
     // DO NOT use _sparseA.setZero()! It will not just set things to zero, it will
     // delete the sparsity pattern
 
@@ -155,9 +499,8 @@ SPARSE_MATRIX TET_Mesh_Faster::computeDampingHessian(const VOLUME::Damping &damp
     for (int i = 0; i < _tets.size(); i++) {
         const MATRIX3& F        = _Fs[i];
         const MATRIX3& Fdot     = _Fdots[i];
-        const MATRIX9x12& pFpx  = _pFpxs[i];
         const MATRIX9 hessian   = -_restTetVolumes[i] * damping.hessian(F, Fdot);
-        _perElementHessians[i]  = (pFpx.transpose() * hessian) * pFpx;
+        _perElementHessians[i]  = tetHessian(i, hessian);
     }
 
     // DO NOT use _sparseA.setZero()! It will not just set things to zero, it will
@@ -183,6 +526,90 @@ SPARSE_MATRIX TET_Mesh_Faster::computeDampingHessian(const VOLUME::Damping &damp
     return _sparseA;
 }
 
+void TET_Mesh_Faster::refitAABB() {
+    _aabbTreeTriangles.refit(_positionsVersion);
+    _aabbTreeEdges.refit(_positionsVersion);
+    _aabbTreeVertices.refit(_positionsVersion);
+}
+
+void TET_Mesh_Faster::checkCandidateCache() {
+    const REAL candidateEps = (1.0 + _candidateMargin) * _collisionEps;
+    if (_candidateCheckVersion == _positionsVersion && _candidateEps == candidateEps)
+        return;
+    _candidateCheckVersion = _positionsVersion;
+
+    if (_candidateMargin <= 0.0 || _candidateEps != candidateEps) {
+        _vertexFaceCandidatesValid = false;
+        _edgeEdgeCandidatesValid = false;
+        return;
+    }
+
+    // two primitives whose vertices have each moved less than half the margin have gotten
+    // less than a whole margin closer, so anything within eps now was within the
+    // broad phase eps back when the candidates were found
+    const REAL halfMargin = 0.5 * _candidateMargin * _collisionEps;
+    const int totalSurfaceVertices = _surfaceVertices.size();
+    REAL maxMovedSquared = 0.0;
+#pragma omp parallel for schedule(static) reduction(max:maxMovedSquared)
+    for (int x = 0; x < totalSurfaceVertices; x++) {
+        const REAL movedSquared = (_vertices[_surfaceVertices[x]] - _candidatePositions[x]).squaredNorm();
+        maxMovedSquared = max(maxMovedSquared, movedSquared);
+    }
+
+    if (maxMovedSquared > halfMargin * halfMargin) {
+        _vertexFaceCandidatesValid = false;
+        _edgeEdgeCandidatesValid = false;
+    }
+}
+
+void TET_Mesh_Faster::snapshotCandidatePositions() {
+    const REAL candidateEps = (1.0 + _candidateMargin) * _collisionEps;
+    if (_candidatePositionsVersion == _positionsVersion && _candidateEps == candidateEps)
+        return;
+
+    const int totalSurfaceVertices = _surfaceVertices.size();
+    _candidatePositions.resize(totalSurfaceVertices);
+    for (int x = 0; x < totalSurfaceVertices; x++)
+        _candidatePositions[x] = _vertices[_surfaceVertices[x]];
+    _candidatePositionsVersion = _positionsVersion;
+    _candidateEps = candidateEps;
+
+    // whatever was found before was found around the old positions
+    _vertexFaceCandidatesValid = false;
+    _edgeEdgeCandidatesValid = false;
+}
+
+void TET_Mesh_Faster::printCandidateCacheStats() const {
+    const CANDIDATE_CACHE_STATS* stats[] = { &_vertexFaceCandidateStats, &_edgeEdgeCandidateStats };
+    const char* names[] = { "Vertex-face", "Edge-edge" };
+    for (int x = 0; x < 2; x++) {
+        if (stats[x]->detections == 0) continue;
+        const REAL hitRate = 1.0 - (REAL)stats[x]->rebuilds / stats[x]->detections;
+        RYAO_INFO("{} collision candidates: {} rebuilds in {} detections, one every {:.1f} frames, {:.1f}% reused",
+                  names[x], stats[x]->rebuilds, stats[x]->detections,
+                  (REAL)stats[x]->detections / max(stats[x]->rebuilds, 1), 100.0 * hitRate);
+    }
+}
+
+void TET_Mesh_Faster::clearCollisionBuffers() {
+    int totalThreads = 1;
+#ifdef _OPENMP
+    totalThreads = omp_get_max_threads();
+#endif
+    // only ever grows, so the buffers keep their storage from frame to frame
+    if ((int)_collisionBuffers.size() < totalThreads)
+        _collisionBuffers.resize(totalThreads);
+
+    for (unsigned int x = 0; x < _collisionBuffers.size(); x++) {
+        CollisionBuffer& buffer = _collisionBuffers[x];
+        buffer.vertexFaceCollisions.clear();
+        buffer.edgeEdgeCollisions.clear();
+        buffer.edgeEdgeCoordinates.clear();
+        buffer.edgeEdgeCollisionAreas.clear();
+        buffer.edgeEdgeIntersections.clear();
+    }
+}
+
 void TET_Mesh_Faster::computeVertexFaceCollisions() {
     Timer functionTimer(__FUNCTION__);
 
@@ -193,31 +620,56 @@ void TET_Mesh_Faster::computeVertexFaceCollisions() {
     computeInvertedVertices();
     _vertexFaceCollisions.clear();
 
-    _aabbTreeTriangles.refit();
     const REAL collisionEps = _collisionEps;
 
-    for (unsigned int x = 0; x < _surfaceVertices.size(); x++) {
-        const int currentID = _surfaceVertices[x];
+    // do the broad phase for all the vertices at once, find nearby triangles, though not
+    // necessarily inside the desired collision distance. Sorting puts the pairs back in
+    // vertex order. If nothing has moved too far since the last time, reuse those.
+    checkCandidateCache();
+    _vertexFaceCandidateStats.detections++;
+    if (!_vertexFaceCandidatesValid) {
+        snapshotCandidatePositions();
+        _aabbTreeTriangles.refit(_positionsVersion);
+        _aabbTreeVertices.refit(_positionsVersion);
+        _aabbTreeVertices.overlappingPairs(_aabbTreeTriangles, _candidateEps, _vertexFaceCandidates);
+        sort(_vertexFaceCandidates.begin(), _vertexFaceCandidates.end());
+        _vertexFaceCandidatesValid = true;
+        _vertexFaceCandidateStats.rebuilds++;
+    }
+
+    // each thread gets one contiguous range of the candidates, so appending what the
+    // threads found in thread order gives the same list as a serial loop would
+    clearCollisionBuffers();
+    const int totalCandidates = _vertexFaceCandidates.size();
+#pragma omp parallel
+    {
+        int thread = 0;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+        vector<pair<int, int> >& collisions = _collisionBuffers[thread].vertexFaceCollisions;
 
-        // if the vertex is involved in an inverted tet, give up
-        if (_invertedVertices[currentID]) continue;
+#pragma omp for schedule(static)
+        for (int x = 0; x < totalCandidates; x++) {
+            const int currentID = _surfaceVertices[_vertexFaceCandidates[x].first];
 
-        const VECTOR3& surfaceVertex = _vertices[currentID];
-        vector<int> broadPhaseFaces;
+            // if the vertex is involved in an inverted tet, give up
+            if (_invertedVertices[currentID]) continue;
 
-        // do the broad phase, find nearby triangles, though not necessarily
-        // inside the desired collision distance
-        _aabbTreeTriangles.nearbyTriangles(surfaceVertex, collisionEps, broadPhaseFaces);
+            const VECTOR3& surfaceVertex = _vertices[currentID];
+            const int faceID = _vertexFaceCandidates[x].second;
+            const VECTOR3I& t = _surfaceTriangles[faceID];
 
-        // find the close triangles
-        for (unsigned int y = 0; y < broadPhaseFaces.size(); y++) {
-            const int faceID = broadPhaseFaces[y];
+            // the candidates were found with some margin, and possibly a few frames ago,
+            // so first make sure the vertex is still inside the triangle's box plus eps
+            const VECTOR3 mins = _vertices[t[0]].cwiseMin(_vertices[t[1]]).cwiseMin(_vertices[t[2]]);
+            const VECTOR3 maxs = _vertices[t[0]].cwiseMax(_vertices[t[1]]).cwiseMax(_vertices[t[2]]);
+            if (((surfaceVertex - mins).array() < -collisionEps).any() ||
+                ((surfaceVertex - maxs).array() > collisionEps).any()) continue;
 
             // if the surface triangle is so small the normal could be degenerate, skip it
             if (surfaceTriangleIsDegenerate(faceID)) continue;
 
-            const VECTOR3I& t = _surfaceTriangles[faceID];
-
             // if it's an inverted face, move on
             if (_invertedVertices[t[0]] && _invertedVertices[t[1]] && _invertedVertices[t[2]]) continue;
 
@@ -233,18 +685,23 @@ void TET_Mesh_Faster::computeVertexFaceCollisions() {
                 if (pointProjectsInsideTriangle(_vertices[t[0]], _vertices[t[1]],
                                                 _vertices[t[2]], surfaceVertex)) {
                     pair<int, int> collision(currentID, faceID);
-                    _vertexFaceCollisions.push_back(collision);
+                    collisions.push_back(collision);
                 }
                     // if it's not within the projection, but inside the collision cell,
                     // still record it as a collision
                 else if (insideCollisionCell(faceID, surfaceVertex)) {
                     pair<int, int> collision(currentID, faceID);
-                    _vertexFaceCollisions.push_back(collision);
+                    collisions.push_back(collision);
                 }
             }
         }
     }
 
+    for (unsigned int x = 0; x < _collisionBuffers.size(); x++) {
+        const vector<pair<int, int> >& collisions = _collisionBuffers[x].vertexFaceCollisions;
+        _vertexFaceCollisions.insert(_vertexFaceCollisions.end(), collisions.begin(), collisions.end());
+    }
+
 #if VERBOSE
     if (_vertexFaceCollisions.size() > 0)
     RYAO_INFO("Found {} vertex-face collisions.", _vertexFaceCollisions.size());
@@ -265,159 +722,187 @@ void TET_Mesh_Faster::computeEdgeEdgeCollisions() {
     _edgeEdgeCoordinates.clear();
     _edgeEdgeCollisionAreas.clear();
 
-    _aabbTreeEdges.refit();
-
-    // get the nearest edge to each edge, not including itself
-    // and ones where it shares a vertex
-    for (unsigned int x = 0; x < _surfaceEdges.size(); x++) {
-        int closestEdge = -1;
-        REAL closestDistance = FLT_MAX;
-        VECTOR2 aClosest(-1, -1);
-        VECTOR2 bClosest(-1, -1);
-        const VECTOR2I& outerEdge = _surfaceEdges[x];
-        const VECTOR3& v0 = _vertices[outerEdge[0]];
-        const VECTOR3& v1 = _vertices[outerEdge[1]];
-        // why we need a new index named outerFalt?
-        const unsigned int outerFlat = outerEdge[0] + outerEdge[1] * _surfaceEdges.size();
-
-        vector<int> nearbyEdges;
-        _aabbTreeEdges.nearbyEdges(_surfaceEdges[x], _collisionEps, nearbyEdges);
-
-        // find the closest other edge
-        for (unsigned int y = 0; y < nearbyEdges.size(); y++) {
-            // skip if index is smaller -- don't want to double count nearby edges
-            // (a,b) and (b,a)
-            if (nearbyEdges[y] < x) continue;
-
-            const VECTOR2I innerEdge = _surfaceEdges[nearbyEdges[y]];
-            // if they share a vertex, skip it
-            if ((outerEdge[0] == innerEdge[0]) || (outerEdge[0] == innerEdge[1]) ||
-                (outerEdge[1] == innerEdge[0]) || (outerEdge[1] == innerEdge[1]))
-                continue;
-
-            const VECTOR3& v2 = _vertices[innerEdge[0]];
-            const VECTOR3& v3 = _vertices[innerEdge[1]];
-
-            VECTOR3 innerPoint, outerPoint;
-            IntersectLineSegments(v0, v1, v2, v3,
-                                  outerPoint, innerPoint);
-
-            const REAL distance = (innerPoint - outerPoint).norm();
-            if (distance > closestDistance) continue;
-
-            // get the line interpolation coordinates
-            VECTOR2 a,b;
-            const VECTOR3 e0 = v1 - v0;
-            const VECTOR3 e1 = v3 - v2;
-
-            // this is a little dicey in general, but if the intersection test isn't
-            // total garbage, it should still be robust
-            a[1] = (outerPoint - v0).norm() / e0.norm();
-            a[0] = 1.0 - a[1];
-            b[1] = (innerPoint - v2).norm() / e1.norm();
-            b[0] = 1.0 - b[1];
-
-            // if it's really close to an end vertex, skip it
-            const REAL skipEps = 1e-4;
-            if ((a[0] < skipEps) || (a[0] > 1.0 - skipEps)) continue;
-            if ((a[1] < skipEps) || (a[1] > 1.0 - skipEps)) continue;
-            if ((b[0] < skipEps) || (b[0] > 1.0 - skipEps)) continue;
-            if ((b[1] < skipEps) || (b[1] > 1.0 - skipEps)) continue;
-
-            // it's mid-segment, and closest, so remember it
-            closestDistance = distance;
-            closestEdge = nearbyEdges[y];
-
-            aClosest = a;
-            bClosest = b;
-        }
-
-        // if nothing was close, move on
-        if (closestEdge == -1) continue;
-
-        /*
-        // retrieve the eps of the closest edge
-        const VECTOR2I innerEdge = _surfaceEdges[closestEdge];
-        const unsigned int innerFlat = innerEdge[0] + innerEdge[1] * _surfaceEdges.size();
-        const pair<unsigned int, unsigned int> edgeEdge(innerFlat, outerFlat);
-        // it exists, right?
-        assert(_edgeEdgeRestEps.find(edgeEdge) != _edgeEdgeRestEps.end());
-        const REAL collisionEps = _edgeEdgeRestEps[edgeEdge];
-        */
-
-        // are they within each other's one rings?
-        const VECTOR2I innerEdge = _surfaceEdges[closestEdge];
-        bool insideOneRing = false;
-
-        for (int j = 0; j < 2; j++) {
-            pair<int, int> lookup;
-            lookup.first = outerEdge[j];
-            for (int i = 0; i < 2; i++) {
-                lookup.second = innerEdge[i];
-                if (_insideSurfaceVertexOneRing.find(lookup) != _insideSurfaceVertexOneRing.end())
-                    insideOneRing = true;
-            }
-        }
-        if (insideOneRing) continue;
+    // do the broad phase for all the edges at once, unless the last one is still good.
+    // Each pair comes out once, smaller index first, so sorting groups the pairs by their first edge
+    const int totalEdges = _surfaceEdges.size();
+    checkCandidateCache();
+    _edgeEdgeCandidateStats.detections++;
+    if (!_edgeEdgeCandidatesValid) {
+        snapshotCandidatePositions();
+        _aabbTreeEdges.refit(_positionsVersion);
+        _aabbTreeEdges.selfOverlappingPairs(_candidateEps, _edgeEdgeCandidates);
+        sort(_edgeEdgeCandidates.begin(), _edgeEdgeCandidates.end());
+
+        // where each edge's nearby edges start in _edgeEdgeCandidates
+        _edgeEdgeCandidateStarts.assign(totalEdges + 1, 0);
+        for (unsigned int x = 0; x < _edgeEdgeCandidates.size(); x++)
+            _edgeEdgeCandidateStarts[_edgeEdgeCandidates[x].first + 1]++;
+        for (int x = 0; x < totalEdges; x++)
+            _edgeEdgeCandidateStarts[x + 1] += _edgeEdgeCandidateStarts[x];
+        _edgeEdgeCandidatesValid = true;
+        _edgeEdgeCandidateStats.rebuilds++;
+    }
 
-        // if it's within the positive threshold, it's in collision
-        if (closestDistance < _collisionEps) {
-            pair<int,int> collision(x, closestEdge);
-            _edgeEdgeCollisions.push_back(collision);
+    // same as the vertex-faces, each thread gets one contiguous range of edges,
+    // and the threads' results get appended in order afterwards
+    clearCollisionBuffers();
+#pragma omp parallel
+    {
+        int thread = 0;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+        CollisionBuffer& buffer = _collisionBuffers[thread];
 
-            // this was actually set, right?
-            assert(aClosest[0] > 0.0 && aClosest[1] > 0.0);
-            assert(bClosest[0] > 0.0 && bClosest[1] > 0.0);
+        // get the nearest edge to each edge, not including itself
+        // and ones where it shares a vertex
+#pragma omp for schedule(static)
+        for (int x = 0; x < totalEdges; x++) {
+            int closestEdge = -1;
+            REAL closestDistance = FLT_MAX;
+            VECTOR2 aClosest(-1, -1);
+            VECTOR2 bClosest(-1, -1);
+            const VECTOR2I& outerEdge = _surfaceEdges[x];
+            const VECTOR3& v0 = _vertices[outerEdge[0]];
+            const VECTOR3& v1 = _vertices[outerEdge[1]];
+
+            // find the closest other edge. Only the ones with a larger index are in the
+            // list -- don't want to double count nearby edges (a,b) and (b,a)
+            for (int y = _edgeEdgeCandidateStarts[x]; y < _edgeEdgeCandidateStarts[x + 1]; y++) {
+                const int nearbyEdge = _edgeEdgeCandidates[y].second;
+                const VECTOR2I innerEdge = _surfaceEdges[nearbyEdge];
+                // if they share a vertex, skip it
+                if ((outerEdge[0] == innerEdge[0]) || (outerEdge[0] == innerEdge[1]) ||
+                    (outerEdge[1] == innerEdge[0]) || (outerEdge[1] == innerEdge[1]))
+                    continue;
+
+                const VECTOR3& v2 = _vertices[innerEdge[0]];
+                const VECTOR3& v3 = _vertices[innerEdge[1]];
+
+                // same as the vertex-faces, skip it if the boxes aren't within eps anymore,
+                // since then the edges can't be either
+                if ((v0.cwiseMin(v1) - v2.cwiseMax(v3)).maxCoeff() > _collisionEps ||
+                    (v2.cwiseMin(v3) - v0.cwiseMax(v1)).maxCoeff() > _collisionEps) continue;
+
+                VECTOR3 innerPoint, outerPoint;
+                IntersectLineSegments(v0, v1, v2, v3,
+                                      outerPoint, innerPoint);
+
+                const REAL distance = (innerPoint - outerPoint).norm();
+                if (distance > closestDistance) continue;
+
+                // get the line interpolation coordinates
+                VECTOR2 a,b;
+                const VECTOR3 e0 = v1 - v0;
+                const VECTOR3 e1 = v3 - v2;
+
+                // this is a little dicey in general, but if the intersection test isn't
+                // total garbage, it should still be robust
+                a[1] = (outerPoint - v0).norm() / e0.norm();
+                a[0] = 1.0 - a[1];
+                b[1] = (innerPoint - v2).norm() / e1.norm();
+                b[0] = 1.0 - b[1];
+
+                // if it's really close to an end vertex, skip it
+                const REAL skipEps = 1e-4;
+                if ((a[0] < skipEps) || (a[0] > 1.0 - skipEps)) continue;
+                if ((a[1] < skipEps) || (a[1] > 1.0 - skipEps)) continue;
+                if ((b[0] < skipEps) || (b[0] > 1.0 - skipEps)) continue;
+                if ((b[1] < skipEps) || (b[1] > 1.0 - skipEps)) continue;
+
+                // it's mid-segment, and closest, so remember it
+                closestDistance = distance;
+                closestEdge = nearbyEdge;
+
+                aClosest = a;
+                bClosest = b;
+            }
 
-            pair<VECTOR2,VECTOR2> coordinate(aClosest, bClosest);
-            _edgeEdgeCoordinates.push_back(coordinate);
+            // if nothing was close, move on
+            if (closestEdge == -1) continue;
 
-            // get the areas too
+            // are they within each other's one rings?
             const VECTOR2I innerEdge = _surfaceEdges[closestEdge];
-            const pair<int,int> outerPair(outerEdge[0], outerEdge[1]);
-            const pair<int,int> innerPair(innerEdge[0], innerEdge[1]);
-            const REAL xArea = _restEdgeAreas[_edgeHash[outerPair]];
-            const REAL closestArea = _restEdgeAreas[_edgeHash[innerPair]];
-            _edgeEdgeCollisionAreas.push_back(xArea + closestArea);
-
-            // find out if they are penetrating
-            vector<VECTOR3> edge(2);
-            edge[0] = v0;
-            edge[1] = v1;
-
-            // get the adjacent triangles of the *other* edge
-            VECTOR2I adjacentTriangles = _surfaceEdgeTriangleNeighbors[_edgeHash[innerPair]];
-
-            // build triangle 0
-            const VECTOR3I surfaceTriangle0 = _surfaceTriangles[adjacentTriangles[0]];
-            vector<VECTOR3> triangle0;
-            triangle0.push_back(_vertices[surfaceTriangle0[0]]);
-            triangle0.push_back(_vertices[surfaceTriangle0[1]]);
-            triangle0.push_back(_vertices[surfaceTriangle0[2]]);
-
-            // build triangle 1
-            vector<VECTOR3> triangle1;
-            // if there's another triangle on the other side (this is in case we're looking at cloth)
-            // then store that one too
-            if (adjacentTriangles[1] != -1) {
-                const VECTOR3I surfaceTriangle1 = _surfaceTriangles[adjacentTriangles[1]];
-                triangle1.push_back(_vertices[surfaceTriangle1[0]]);
-                triangle1.push_back(_vertices[surfaceTriangle1[1]]);
-                triangle1.push_back(_vertices[surfaceTriangle1[2]]);
+            bool insideOneRing = false;
+
+            for (int j = 0; j < 2; j++) {
+                pair<int, int> lookup;
+                lookup.first = outerEdge[j];
+                for (int i = 0; i < 2; i++) {
+                    lookup.second = innerEdge[i];
+                    if (_insideSurfaceVertexOneRing.find(lookup) != _insideSurfaceVertexOneRing.end())
+                        insideOneRing = true;
+                }
             }
+            if (insideOneRing) continue;
+
+            // if it's within the positive threshold, it's in collision
+            if (closestDistance < _collisionEps) {
+                pair<int,int> collision(x, closestEdge);
+                buffer.edgeEdgeCollisions.push_back(collision);
+
+                // this was actually set, right?
+                assert(aClosest[0] > 0.0 && aClosest[1] > 0.0);
+                assert(bClosest[0] > 0.0 && bClosest[1] > 0.0);
+
+                pair<VECTOR2,VECTOR2> coordinate(aClosest, bClosest);
+                buffer.edgeEdgeCoordinates.push_back(coordinate);
+
+                // get the areas too, the edges index straight into _surfaceEdges
+                const REAL xArea = _restEdgeAreas[x];
+                const REAL closestArea = _restEdgeAreas[closestEdge];
+                buffer.edgeEdgeCollisionAreas.push_back(xArea + closestArea);
+
+                // find out if they are penetrating
+                vector<VECTOR3> edge(2);
+                edge[0] = v0;
+                edge[1] = v1;
+
+                // get the adjacent triangles of the *other* edge
+                VECTOR2I adjacentTriangles = _surfaceEdgeTriangleNeighbors[closestEdge];
+
+                // build triangle 0
+                const VECTOR3I surfaceTriangle0 = _surfaceTriangles[adjacentTriangles[0]];
+                vector<VECTOR3> triangle0;
+                triangle0.push_back(_vertices[surfaceTriangle0[0]]);
+                triangle0.push_back(_vertices[surfaceTriangle0[1]]);
+                triangle0.push_back(_vertices[surfaceTriangle0[2]]);
+
+                // build triangle 1
+                vector<VECTOR3> triangle1;
+                // if there's another triangle on the other side (this is in case we're looking at cloth)
+                // then store that one too
+                if (adjacentTriangles[1] != -1) {
+                    const VECTOR3I surfaceTriangle1 = _surfaceTriangles[adjacentTriangles[1]];
+                    triangle1.push_back(_vertices[surfaceTriangle1[0]]);
+                    triangle1.push_back(_vertices[surfaceTriangle1[1]]);
+                    triangle1.push_back(_vertices[surfaceTriangle1[2]]);
+                }
 
-            // see if the edges are already penetrating the opposing faces
-            bool penetrating = false;
-            if (triangle0.size() > 0) penetrating = faceEdgeIntersection(triangle0, edge);
-            if (triangle1.size() > 0) penetrating = penetrating || faceEdgeIntersection(triangle1, edge);
-            _edgeEdgeIntersections.push_back(penetrating);
-            //_edgeEdgeCollisionEps.push_back(_collisionEps);
+                // see if the edges are already penetrating the opposing faces
+                bool penetrating = false;
+                if (triangle0.size() > 0) penetrating = faceEdgeIntersection(triangle0, edge);
+                if (triangle1.size() > 0) penetrating = penetrating || faceEdgeIntersection(triangle1, edge);
+                buffer.edgeEdgeIntersections.push_back(penetrating);
 
-            // TODO: for completeness, should probably test the other edges against the other
-            // pair, just in case we're looking at a degenerate case. In general, seems redundant.
+                // TODO: for completeness, should probably test the other edges against the other
+                // pair, just in case we're looking at a degenerate case. In general, seems redundant.
+            }
         }
     }
+
+    for (unsigned int x = 0; x < _collisionBuffers.size(); x++) {
+        const CollisionBuffer& buffer = _collisionBuffers[x];
+        _edgeEdgeCollisions.insert(_edgeEdgeCollisions.end(),
+                                   buffer.edgeEdgeCollisions.begin(), buffer.edgeEdgeCollisions.end());
+        _edgeEdgeCoordinates.insert(_edgeEdgeCoordinates.end(),
+                                    buffer.edgeEdgeCoordinates.begin(), buffer.edgeEdgeCoordinates.end());
+        _edgeEdgeCollisionAreas.insert(_edgeEdgeCollisionAreas.end(),
+                                       buffer.edgeEdgeCollisionAreas.begin(), buffer.edgeEdgeCollisionAreas.end());
+        _edgeEdgeIntersections.insert(_edgeEdgeIntersections.end(),
+                                      buffer.edgeEdgeIntersections.begin(), buffer.edgeEdgeIntersections.end());
+    }
     assert(_edgeEdgeCollisions.size() == _edgeEdgeCoordinates.size());
 }
 
-}
\ No newline at end of file
+}
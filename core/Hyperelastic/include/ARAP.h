@@ -9,6 +9,12 @@ namespace VOLUME {
 class ARAP : public HYPERELASTIC {
 public:
     ARAP(const REAL& mu, const REAL& lambda);
+
+    static constexpr bool PSI_USES_SVD = true;
+    static constexpr bool PK1_USES_SVD = true;
+    static constexpr bool CLAMPED_HESSIAN_TRIES_WITHOUT_SVD = false;
+    static constexpr bool CLAMPED_HESSIAN_USES_SVD = true;
+
     ~ARAP() {};
 
     virtual REAL psi(const MATRIX3& U, const VECTOR3& Sigma, const MATRIX3& V) const override;
@@ -24,6 +30,8 @@ public:
     virtual bool energyNeedsSVD() const override;
 
     virtual bool PK1NeedsSVD() const override;
+
+    virtual bool clampedHessianNeedsSVD() const override;
 private:
     REAL _mu;
     REAL _lambda;
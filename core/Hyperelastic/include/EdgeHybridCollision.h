@@ -39,6 +39,10 @@ public:
                              const VECTOR2& a, const VECTOR2& b) const override;
     virtual MATRIX12 hessianNegated(const VECTOR12& x,
                                     const VECTOR2& a, const VECTOR2& b) const override;
+    virtual MATRIX12 clampedHessian(const VECTOR12& x,
+                                    const VECTOR2& a, const VECTOR2& b) const override;
+    virtual MATRIX12 clampedHessianNegated(const VECTOR12& x,
+                                           const VECTOR2& a, const VECTOR2& b) const override;
 
     virtual std::string name() const override;
     virtual void setEps(const REAL& eps) override;
@@ -46,6 +46,12 @@ public:
     virtual MATRIX12 hessianNegated(const VECTOR12& x,
                                     const VECTOR2& a, const VECTOR2& b) const override;
 
+    // analytic eigenvalue clamping, no 12x12 eigen solve
+    virtual MATRIX12 clampedHessian(const VECTOR12& x,
+                                    const VECTOR2& a, const VECTOR2& b) const override;
+    virtual MATRIX12 clampedHessianNegated(const VECTOR12& x,
+                                           const VECTOR2& a, const VECTOR2& b) const override;
+
     virtual std::string name() const override;
 
 private:
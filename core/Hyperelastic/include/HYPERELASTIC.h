@@ -29,15 +29,33 @@ public:
     virtual MATRIX9 clampedHessian(const MATRIX3& F) const;
     virtual MATRIX9 clampedHessian(const MATRIX3& U, const VECTOR3& Sigma, const MATRIX3& V) const;
 
+    // The clamped Hessian from F alone, if it can be had without an SVD. Returns false
+    // and leaves hessian alone if not, and the SVD version has to be called instead.
+    virtual bool clampedHessianWithoutSVD(const MATRIX3& F, MATRIX9& hessian) const;
+
     // The name of the material
     virtual std::string name() const = 0;
 
+    // Each material also says at compile time which overloads it really implements, so
+    // TET_Mesh_Faster::computeElasticTerms can call them directly:
+    //
+    //   PSI_USES_SVD, PK1_USES_SVD, CLAMPED_HESSIAN_USES_SVD: call the U, Sigma, V overload
+    //   instead of the F one
+    //   CLAMPED_HESSIAN_TRIES_WITHOUT_SVD: try clampedHessianWithoutSVD first, and only
+    //   take the SVD of the Fs it turns down
+    //
+    // The virtuals below are the runtime versions, and return those same constants.
+
     // True if the energy computation requires the SVD of F
     virtual bool energyNeedsSVD() const = 0;
 
     // True if the PK1 computation requires the SVD of F
     virtual bool PK1NeedsSVD() const = 0;
 
+    // True if the clamped Hessian computation requires the SVD of every F, i.e. it
+    // uses the SVD and doesn't try without it first
+    virtual bool clampedHessianNeedsSVD() const = 0;
+
     // convert Young's modulus (E) and Poisson's ratio (nu) to Lam\'{e} parameters
     static REAL computeMu(const REAL E, const REAL nu);
     static REAL computeLambda(const REAL E, const REAL nu);
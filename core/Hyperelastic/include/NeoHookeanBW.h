@@ -12,6 +12,11 @@ class NeoHookeanBW : public HYPERELASTIC {
 public:
     NeoHookeanBW(const REAL& mu, const REAL& lambda);
 
+    static constexpr bool PSI_USES_SVD = false;
+    static constexpr bool PK1_USES_SVD = false;
+    static constexpr bool CLAMPED_HESSIAN_TRIES_WITHOUT_SVD = false;
+    static constexpr bool CLAMPED_HESSIAN_USES_SVD = true;
+
     virtual ~NeoHookeanBW() override = default;
 
     virtual REAL psi(const MATRIX3& F) const override;
@@ -28,6 +33,8 @@ public:
 
     virtual bool PK1NeedsSVD() const override;
 
+    virtual bool clampedHessianNeedsSVD() const override;
+
 private:
     const REAL _mu;
     const REAL _lambda;
@@ -10,6 +10,11 @@ class SNH : public HYPERELASTIC {
 public:
     SNH(const REAL& mu, const REAL& lambda);
 
+    static constexpr bool PSI_USES_SVD = false;
+    static constexpr bool PK1_USES_SVD = false;
+    static constexpr bool CLAMPED_HESSIAN_TRIES_WITHOUT_SVD = true;
+    static constexpr bool CLAMPED_HESSIAN_USES_SVD = true;
+
     virtual ~SNH() override = default;
 
     virtual REAL psi(const MATRIX3& F) const override;
@@ -18,7 +23,9 @@ public:
 
     virtual MATRIX9 hessian(const MATRIX3& F) const override;
 
+    virtual MATRIX9 clampedHessian(const MATRIX3& F) const override;
     virtual MATRIX9 clampedHessian(const MATRIX3& U, const VECTOR3& Sigma, const MATRIX3& V) const override;
+    virtual bool clampedHessianWithoutSVD(const MATRIX3& F, MATRIX9& hessian) const override;
 
     virtual std::string name() const override;
 
@@ -26,6 +33,8 @@ public:
 
     virtual bool PK1NeedsSVD() const override;
 
+    virtual bool clampedHessianNeedsSVD() const override;
+
 private:
     const REAL _mu;
     const REAL _lambda;
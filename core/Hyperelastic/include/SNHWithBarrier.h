@@ -11,6 +11,11 @@ class SNHWithBarrier : public HYPERELASTIC {
 public:
     SNHWithBarrier(const REAL& mu, const REAL& lambda);
 
+    static constexpr bool PSI_USES_SVD = false;
+    static constexpr bool PK1_USES_SVD = false;
+    static constexpr bool CLAMPED_HESSIAN_TRIES_WITHOUT_SVD = false;
+    static constexpr bool CLAMPED_HESSIAN_USES_SVD = true;
+
     virtual ~SNHWithBarrier() override = default;
 
     virtual REAL psi(const MATRIX3& F) const override;
@@ -27,6 +32,8 @@ public:
 
     virtual bool PK1NeedsSVD() const override;
 
+    virtual bool clampedHessianNeedsSVD() const override;
+
 private:
     const REAL _mu;
     const REAL _lambda;
@@ -9,7 +9,13 @@ namespace VOLUME {
 class StVK : public HYPERELASTIC {
 public:
     StVK(const REAL& mu, const REAL& lambda);
-    ~StVK();
+
+    static constexpr bool PSI_USES_SVD = false;
+    static constexpr bool PK1_USES_SVD = false;
+    static constexpr bool CLAMPED_HESSIAN_TRIES_WITHOUT_SVD = false;
+    static constexpr bool CLAMPED_HESSIAN_USES_SVD = true;
+
+    ~StVK() {};
 
     virtual REAL psi(const MATRIX3& F) const override;
 
@@ -20,11 +26,14 @@ public:
     virtual MATRIX9 hessian(const MATRIX3& F) const override;
 
     virtual MATRIX9 clampedHessian(const MATRIX3& F) const override;
+    virtual MATRIX9 clampedHessian(const MATRIX3& U, const VECTOR3& Sigma, const MATRIX3& V) const override;
 
     virtual bool energyNeedsSVD() const override;
 
     virtual bool PK1NeedsSVD() const override;
 
+    virtual bool clampedHessianNeedsSVD() const override;
+
 private:
     void buildEigenSystem(const MATRIX3& U, const VECTOR3& Sigma, const MATRIX3& V,
                           VECTOR9& eigenvalues, MATRIX9& eigenvectors) const;
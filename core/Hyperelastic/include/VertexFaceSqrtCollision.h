@@ -25,6 +25,7 @@ public:
     virtual VECTOR12 gradient(const std::vector<VECTOR3>& v) const override;
     virtual MATRIX12 hessian(const std::vector<VECTOR3>& v) const override;
     virtual MATRIX12 clampedHessian(const std::vector<VECTOR3>& v) const override;
+    virtual MATRIX12 clampedHessian(const VECTOR12& x) const override;
 
     virtual std::string name() const override;
 protected:
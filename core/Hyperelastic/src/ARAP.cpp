@@ -138,11 +138,15 @@ std::string ARAP::name() const {
 }
 
 bool ARAP::energyNeedsSVD() const {
-    return true;
+    return PSI_USES_SVD;
 }
 
 bool ARAP::PK1NeedsSVD() const {
-    return true;
+    return PK1_USES_SVD;
+}
+
+bool ARAP::clampedHessianNeedsSVD() const {
+    return CLAMPED_HESSIAN_USES_SVD && !CLAMPED_HESSIAN_TRIES_WITHOUT_SVD;
 }
 
 }
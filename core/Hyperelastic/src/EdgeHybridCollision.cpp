@@ -97,6 +97,22 @@ MATRIX12 EdgeHybridCollision::hessianNegated(const VECTOR12& x,
     return _sqrt.hessianNegated(x,a,b);
 }
 
+MATRIX12 EdgeHybridCollision::clampedHessian(const VECTOR12& x,
+                                               const VECTOR2& a,
+                                               const VECTOR2& b) const {
+    if (puntToCrossProduct(x,a,b))
+        return EdgeCollision::clampedHessian(x,a,b);
+    return _sqrt.clampedHessian(x,a,b);
+}
+
+MATRIX12 EdgeHybridCollision::clampedHessianNegated(const VECTOR12& x,
+                                                      const VECTOR2& a,
+                                                      const VECTOR2& b) const {
+    if (puntToCrossProduct(x,a,b))
+        return EdgeCollision::clampedHessianNegated(x,a,b);
+    return _sqrt.clampedHessianNegated(x,a,b);
+}
+
 void EdgeHybridCollision::setEps(const REAL& eps) {
     _eps = eps;
     _sqrt.setEps(eps);
@@ -187,5 +187,65 @@ MATRIX12 EdgeSqrtCollision::hessianNegated(const VECTOR12& x,
                         (normPartial) * (vPartial.transpose() * n).transpose());
 }
 
+/**
+* @brief clamp the Hessian analytically. vDiffPartial is w^T kron I, with w = (-a, b), so the
+*          Hessian is (w w^T) kron M, with the 3x3
+*
+*          M = 2 mu (d d^T + ((|diff| - eps) / |diff|) (I - d d^T)), d = diff / |diff|
+*
+*          Its only nonzero eigenvalues are 2 mu |w|^2 along w kron d, and
+*          2 mu |w|^2 (|diff| - eps) / |diff| twice along w kron (anything orthogonal to d).
+*          Only the second can go negative, so clamping it in M is the whole eigenvalue clamp.
+*
+* @param x
+* @param a
+* @param b
+* @return MATRIX12
+*/
+MATRIX12 EdgeSqrtCollision::clampedHessian(const VECTOR12& x,
+                                             const VECTOR2& a,
+                                             const VECTOR2& b) const {
+    // convert to vertices and edges
+    vector<VECTOR3> v;
+    vector<VECTOR3> e;
+    getVerticesAndEdges(x, v, e);
+    assert(v.size() == 4);
+    assert(e.size() == 2);
+
+    // get the interpolated vertices
+    const VECTOR3 va = (a[0] * v[0] + a[1] * v[1]);
+    const VECTOR3 vb = (b[0] * v[2] + b[1] * v[3]);
+    const VECTOR3 diff = vb - va;
+    const REAL diffNorm = diff.norm();
+
+    // same give-up condition as hessian()
+    if (diffNorm < _tooSmall)
+        return MATRIX12::Zero();
+
+    const VECTOR3 d = diff / diffNorm;
+    const MATRIX3 dd = d * d.transpose();
+    const REAL tangent = (diffNorm > _eps) ? (diffNorm - _eps) / diffNorm : 0.0;
+    const MATRIX3 M = 2.0 * _mu * (dd + tangent * (MATRIX3::Identity() - dd));
+
+    const MATRIX3x12 vPartial = vDiffPartial(a,b);
+    return vPartial.transpose() * M * vPartial;
+}
+
+/**
+* @brief the negated Hessian has the same structure as in clampedHessian(), but
+*          its tangential eigenvalue (|diff| + eps) / |diff| is never negative,
+*          so nothing needs clamping
+*
+* @param x
+* @param a
+* @param b
+* @return MATRIX12
+*/
+MATRIX12 EdgeSqrtCollision::clampedHessianNegated(const VECTOR12& x,
+                                                    const VECTOR2& a,
+                                                    const VECTOR2& b) const {
+    return hessianNegated(x, a, b);
+}
+
 }
 }
\ No newline at end of file
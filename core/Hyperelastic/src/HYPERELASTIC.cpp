@@ -118,6 +118,18 @@ MATRIX9 HYPERELASTIC::clampedHessian(const MATRIX3& F) const
     return clampedHessian(U, Sigma, V);
 }
 
+/**
+ * @brief If nothing is provided, there's no way around the SVD
+ *
+ * @param F
+ * @param hessian
+ * @return bool
+ */
+bool HYPERELASTIC::clampedHessianWithoutSVD(const MATRIX3& F, MATRIX9& hessian) const
+{
+    return false;
+}
+
 /**
  * @brief convert Young's modulus (E) and Poisson's ratio (nu) to Lam\'{e} parameters
  *
@@ -115,11 +115,15 @@ string NeoHookeanBW::name() const {
 }
 
 bool NeoHookeanBW::energyNeedsSVD() const {
-    return false;
+    return PSI_USES_SVD;
 }
 
 bool NeoHookeanBW::PK1NeedsSVD() const {
-    return false;
+    return PK1_USES_SVD;
+}
+
+bool NeoHookeanBW::clampedHessianNeedsSVD() const {
+    return CLAMPED_HESSIAN_USES_SVD && !CLAMPED_HESSIAN_TRIES_WITHOUT_SVD;
 }
 
 }
@@ -77,6 +77,78 @@ MATRIX9 SNH::hessian(const MATRIX3 &F) const {
     return _mu * MATRIX9::Identity() + _lambda * pjpf * pjpf.transpose() + hessJ;
 }
 
+/**
+* @brief The clamped Hessian, taking the SVD only if clampedHessianWithoutSVD can't do without it
+*
+* @param F
+* @return MATRIX9
+*/
+MATRIX9 SNH::clampedHessian(const MATRIX3 &F) const {
+    MATRIX9 H;
+    if (clampedHessianWithoutSVD(F, H))
+        return H;
+
+    MATRIX3 U, V;
+    VECTOR3 Sigma;
+    svd_rv(F, U, Sigma, V);
+    return clampedHessian(U, Sigma, V);
+}
+
+/**
+* @brief The clamped Hessian straight from F, if nothing needs clamping.
+*        The eigenvalues in Section 4.6 only need the singular values, and those
+*        come from the closed-form eigenvalues of F^T F. If none of them are
+*        negative beyond roundoff, the Hessian is its own projection, and the
+*        analytic one from F is it. Only when something actually needs to be
+*        clamped are the eigenvectors, and so the SVD, needed.
+*
+* @param F
+* @param hessian
+* @return bool
+*/
+bool SNH::clampedHessianWithoutSVD(const MATRIX3 &F, MATRIX9 &hessian) const {
+    static const REAL roundoff = 1000 * std::numeric_limits<REAL>::epsilon();
+
+    // singular values, with the reflection on the smallest one, same as svd_rv
+    Eigen::SelfAdjointEigenSolver<MATRIX3> CEigs;
+    CEigs.computeDirect(F.transpose() * F, Eigen::EigenvaluesOnly);
+    VECTOR3 Sigma = CEigs.eigenvalues().cwiseMax(0.0).cwiseSqrt();
+    const REAL J = F.determinant();
+    if (J < 0.0)
+        Sigma[0] = -Sigma[0];
+
+    // twist and flip eigenvalues are mu +/- front * Sigma, so only the largest one matters
+    const REAL front = _lambda * (J - 1.0) - _mu;
+    const REAL twistFlip = std::abs(front) * Sigma.cwiseAbs().maxCoeff();
+    if (_mu - twistFlip < -roundoff * (_mu + twistFlip))
+        return false;
+
+    // the scaling eigenvalues, same matrix as below
+    MATRIX3 A;
+    const REAL s0s0 = Sigma(0) * Sigma(0);
+    const REAL s1s1 = Sigma(1) * Sigma(1);
+    const REAL s2s2 = Sigma(2) * Sigma(2);
+    A(0,0) = _mu + _lambda * s1s1 * s2s2;
+    A(1,1) = _mu + _lambda * s0s0 * s2s2;
+    A(2,2) = _mu + _lambda * s0s0 * s1s1;
+
+    const REAL frontOffDiag = _lambda * (2.0 * J - 1.0) - _mu;
+    A(0,1) = frontOffDiag * Sigma(2);
+    A(0,2) = frontOffDiag * Sigma(1);
+    A(1,2) = frontOffDiag * Sigma(0);
+    A(1,0) = A(0,1);
+    A(2,0) = A(0,2);
+    A(2,1) = A(1,2);
+
+    Eigen::SelfAdjointEigenSolver<MATRIX3> Aeigs;
+    Aeigs.computeDirect(A, Eigen::EigenvaluesOnly);
+    if (Aeigs.eigenvalues()[0] < -roundoff * Aeigs.eigenvalues().cwiseAbs().maxCoeff())
+        return false;
+
+    hessian = this->hessian(F);
+    return true;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // These are from Section 4.6 in "Stable Neo-Hookean Flesh Simulation"
 //
@@ -163,11 +235,15 @@ string SNH::name() const {
 }
 
 bool SNH::energyNeedsSVD() const {
-    return false;
+    return PSI_USES_SVD;
 }
 
 bool SNH::PK1NeedsSVD() const {
-    return false;
+    return PK1_USES_SVD;
+}
+
+bool SNH::clampedHessianNeedsSVD() const {
+    return CLAMPED_HESSIAN_USES_SVD && !CLAMPED_HESSIAN_TRIES_WITHOUT_SVD;
 }
 }
 }
\ No newline at end of file
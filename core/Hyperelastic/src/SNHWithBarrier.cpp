@@ -150,11 +150,15 @@ string SNHWithBarrier::name() const {
 }
 
 bool SNHWithBarrier::energyNeedsSVD() const {
-    return false;
+    return PSI_USES_SVD;
 }
 
 bool SNHWithBarrier::PK1NeedsSVD() const {
-    return false;
+    return PK1_USES_SVD;
+}
+
+bool SNHWithBarrier::clampedHessianNeedsSVD() const {
+    return CLAMPED_HESSIAN_USES_SVD && !CLAMPED_HESSIAN_TRIES_WITHOUT_SVD;
 }
 
 }
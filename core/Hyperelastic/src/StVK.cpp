@@ -117,7 +117,19 @@ MATRIX9 StVK::clampedHessian(const MATRIX3 &F) const {
     MATRIX3 U, V;
     VECTOR3 Sigma;
     svd_rv(F, U, Sigma, V);
+    return clampedHessian(U, Sigma, V);
+}
 
+/**
+* @brief clamp the analytic eigensystem, so a cached SVD can be reused
+*          and no 9x9 eigen solve is needed
+*
+* @param U
+* @param Sigma
+* @param V
+* @return MATRIX9
+*/
+MATRIX9 StVK::clampedHessian(const MATRIX3& U, const VECTOR3& Sigma, const MATRIX3& V) const {
     VECTOR9 eigenvalues;
     MATRIX9 eigenvectors;
     buildEigenSystem(U, Sigma, V, eigenvalues, eigenvectors);
@@ -130,11 +142,15 @@ MATRIX9 StVK::clampedHessian(const MATRIX3 &F) const {
 }
 
 bool StVK::energyNeedsSVD() const {
-    return false;
+    return PSI_USES_SVD;
 }
 
 bool StVK::PK1NeedsSVD() const {
-    return false;
+    return PK1_USES_SVD;
+}
+
+bool StVK::clampedHessianNeedsSVD() const {
+    return CLAMPED_HESSIAN_USES_SVD && !CLAMPED_HESSIAN_TRIES_WITHOUT_SVD;
 }
 
 }
@@ -146,8 +146,47 @@ MATRIX12 VertexFaceSqrtCollision::hessian(const VECTOR12& x, const VECTOR3& bary
 }
 
 MATRIX12 VertexFaceSqrtCollision::clampedHessian(const std::vector<VECTOR3> &v) const {
-    const MATRIX12 H = hessian(v);
-    return clampEigenvalues(H);
+    return clampedHessian(flattenVertices(v));
+}
+
+/**
+* @brief clamp the Hessian analytically. tDiff is w^T kron I, with w = (1, -bary), so the
+*          Hessian is (w w^T) kron M, with the 3x3
+*
+*          M = 2 mu (t t^T / |t|^2 + (springDiff / |t|) (I - t t^T / |t|^2))
+*
+*          Its only nonzero eigenvalues are 2 mu |w|^2 along w kron t, and 2 mu |w|^2 springDiff / |t|
+*          twice along w kron (anything orthogonal to t). Only the second can go negative, so
+*          clamping it in M is the whole eigenvalue clamp.
+*
+* @param x
+* @return MATRIX12
+*/
+MATRIX12 VertexFaceSqrtCollision::clampedHessian(const VECTOR12& x) const {
+    // convert to vertices and edges
+    vector<VECTOR3> v;
+    vector<VECTOR3> e;
+    getVerticesAndEdges(x, v, e);
+    const bool reversal = reverse(v,e);
+    const VECTOR3 bary = getBarycentricCoordinates(v);
+
+    // remember we had to reorder vertices in a wonky way
+    const VECTOR3 xs = bary[0] * v[1] + bary[1] * v[2] + bary[2] * v[3];
+    const VECTOR3 t = v[0] - xs;
+    const REAL tDott = t.dot(t);
+    const REAL tMagnitude = sqrt(tDott);
+    const REAL springDiff = (reversal) ? tMagnitude + _eps : tMagnitude - _eps;
+
+    // same give-up condition as hessian()
+    if (fabs(tMagnitude) <= _inverseEps || fabs(tDott) < _inverseEps)
+        return MATRIX12::Zero();
+
+    const MATRIX3 tt = t * t.transpose() / tDott;
+    const REAL tangent = (springDiff > 0.0) ? springDiff / tMagnitude : 0.0;
+    const MATRIX3 M = 2.0 * _mu * (tt + tangent * (MATRIX3::Identity() - tt));
+
+    const MATRIX3x12 tDiff = tDiffPartial(bary);
+    return tDiff.transpose() * M * tDiff;
 }
 
 }
@@ -0,0 +1,51 @@
+#ifndef BATCHEDSVD_H
+#define BATCHEDSVD_H
+
+#include "RYAO.h"
+#include "MatrixSoA.h"
+#include <vector>
+
+namespace Ryao {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// A batched version of svd_rv, following "Computing the Singular Value Decomposition of 3x3
+// matrices with minimal branching and elementary floating point operations", McAdams et al. 2011
+//
+// Jacobi sweeps on F^T F accumulate V as a quaternion, the columns of F V are sorted, and a
+// Givens QR of them gives U and Sigma. There are no data-dependent branches, so SVD_LANES
+// matrices are laid out side by side and every step is a '#pragma omp simd' loop over them.
+//
+// Same convention as svd_rv: U and V are rotations, Sigma is sorted by magnitude, and a
+// reflection goes into the sign of Sigma[2]. Any matrix the kernel doesn't reconstruct to
+// within tolerance falls back to svd_rv.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// how many matrices go through the kernel together, 8 doubles fills an AVX-512 register
+// and two AVX ones
+#define SVD_LANES 8
+
+// relative reconstruction error the kernel has to reach, about 10^6 epsilons
+#if RYAO_SINGLE_PRECISION
+#define SVD_TOLERANCE 1e-5
+#else
+#define SVD_TOLERANCE 1e-10
+#endif
+
+// run svd_rv on count <= SVD_LANES matrices in one go
+void svd_rv(const MATRIX3* Fs, const int count, MATRIX3* Us, VECTOR3* Sigmas, MATRIX3* Vs);
+
+// run svd_rv on all of Fs
+void svd_rv(const std::vector<MATRIX3>& Fs, std::vector<MATRIX3>& Us,
+            std::vector<VECTOR3>& Sigmas, std::vector<MATRIX3>& Vs);
+
+// the same, but straight out of and into structure-of-arrays storage,
+// whose lanes are already laid out the way the kernel wants them
+void svd_rv(const MATRIX3_SOA& Fs, MATRIX3_SOA& Us, VECTOR3_SOA& Sigmas, MATRIX3_SOA& Vs);
+
+// run count <= SVD_LANES matrices through the kernel alone, without falling back to
+// svd_rv for the ones it gets wrong, so the tests can see how accurate it is by itself
+void svdBlock(const MATRIX3* Fs, const int count, MATRIX3* Us, VECTOR3* Sigmas, MATRIX3* Vs);
+
+}
+
+#endif // !BATCHEDSVD_H
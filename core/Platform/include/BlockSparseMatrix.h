@@ -0,0 +1,88 @@
+#ifndef BLOCKSPARSEMATRIX_H
+#define BLOCKSPARSEMATRIX_H
+
+#include "RYAO.h"
+#include <vector>
+#include <utility>
+
+namespace Ryao {
+
+///////////////////////////////////////////////////////////////////////
+// A block sparse row (BSR) matrix made of dense 3x3 blocks, one per
+// pair of vertices. Compared to an entry-wise CSC matrix, this needs
+// 9x less index metadata, and the matrix-vector multiply runs on
+// fixed-size 3x3 blocks.
+//
+// If the matrix is symmetric, only the blocks on or above the diagonal
+// can be stored, and the multiply applies the mirrored blocks transposed.
+// The pattern then also keeps, for every block row, which stored blocks
+// mirror into it, so the multiply gathers them instead of scattering.
+//
+// Convert to and from SPARSE_MATRIX only at API boundaries.
+///////////////////////////////////////////////////////////////////////
+class BlockSparseMatrix {
+public:
+    BlockSparseMatrix();
+
+    // build the sparsity pattern from a list of (block row, block column) pairs,
+    // duplicates are fine. If upperOnly is set, pairs below the diagonal are
+    // mirrored above it. All the blocks are set to zero.
+    void setPattern(const int blockRows, const int blockCols,
+                    std::vector<std::pair<int, int> > blockPairs, const bool upperOnly = false);
+
+    int blockRows() const       { return _blockRows; };
+    int blockCols() const       { return _blockCols; };
+    int rows() const            { return 3 * _blockRows; };
+    int cols() const            { return 3 * _blockCols; };
+    int nonZeroBlocks() const   { return _columns.size(); };
+    bool upperOnly() const      { return _upperOnly; };
+
+    // where is block (row, col) stored? Returns -1 if it is not in the pattern.
+    // In upper-only storage, blocks below the diagonal are not in the pattern.
+    int blockIndex(const int blockRow, const int blockCol) const;
+
+    MATRIX3& block(const int index)             { return _blocks[index]; };
+    const MATRIX3& block(const int index) const { return _blocks[index]; };
+    const std::vector<int>& rowStarts() const   { return _rowStarts; };
+    const std::vector<int>& columns() const     { return _columns; };
+
+    // zero out the blocks, but keep the sparsity pattern
+    void setZero();
+
+    // y = A * x
+    void multiply(const VECTOR& x, VECTOR& y) const;
+    VECTOR operator*(const VECTOR& x) const;
+
+    // accumulate scale times the diagonal blocks into blocks
+    void addDiagonalBlocks(const REAL scale, std::vector<MATRIX3>& blocks) const;
+
+    // convert at the API boundaries
+    SPARSE_MATRIX toSparseMatrix() const;
+    static BlockSparseMatrix fromSparseMatrix(const SPARSE_MATRIX& A, const bool upperOnly = false);
+
+    // how many bytes are spent on indices?
+    size_t indexBytes() const;
+
+private:
+    int _blockRows;
+    int _blockCols;
+    bool _upperOnly;
+
+    // where each block row starts in _columns and _blocks
+    std::vector<int> _rowStarts;
+
+    // block column of each block, sorted within each row
+    std::vector<int> _columns;
+    std::vector<MATRIX3> _blocks;
+
+    // only in upper-only storage: where each block row starts in the lists of
+    // the blocks above the diagonal that mirror into it, and for each of those,
+    // the block row it is stored in and its index in _blocks
+    std::vector<int> _mirrorStarts;
+    std::vector<int> _mirrorRows;
+    std::vector<int> _mirrorBlocks;
+};
+
+}
+
+#endif // !BLOCKSPARSEMATRIX_H
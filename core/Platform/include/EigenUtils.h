@@ -4,6 +4,13 @@
 #include "RYAO.h"
 
 namespace Ryao {
+// relative error an analytic eigensystem has to match SelfAdjointEigenSolver to
+#if RYAO_SINGLE_PRECISION
+#define EIGENSYSTEM_TOLERANCE 1e-4
+#else
+#define EIGENSYSTEM_TOLERANCE 1e-8
+#endif
+
 // clamp the eigenvalues of a 9x9 to semi-positive-definite
 MATRIX9 clampEigenvalues(const MATRIX9& A);
 MATRIX12 clampEigenvalues(const MATRIX12& A);
@@ -0,0 +1,67 @@
+#ifndef MATRIXSOA_H
+#define MATRIXSOA_H
+
+#include "RYAO.h"
+
+namespace Ryao {
+
+// element counts get rounded up to a multiple of this, so every lane is a whole
+// number of 64 byte cache lines and a vector loop never needs a remainder
+#define SOA_PADDING 8
+
+///////////////////////////////////////////////////////////////////////
+// An array of small fixed-size matrices stored as a structure of arrays:
+// entry (i, j) of every element is contiguous, in a "lane" of its own.
+// A loop over the elements that touches one lane at a time is then a
+// plain strided-by-one loop, which the compiler can vectorize.
+//
+// The storage is an Eigen matrix with one column per lane, so it gets
+// Eigen's aligned allocation, and with the padding each lane starts on
+// an aligned boundary too. The padding elements are zero.
+//
+// operator[] returns an Eigen::Map of one element, which can be read
+// and written like a MATRIX3, so per-element code doesn't need to change.
+///////////////////////////////////////////////////////////////////////
+template <int ROWS, int COLS>
+class MatrixSoA {
+public:
+    typedef Eigen::Matrix<REAL, ROWS, COLS> Element;
+    typedef Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic> ElementStride;
+    typedef Eigen::Map<Element, Eigen::Unaligned, ElementStride> View;
+    typedef Eigen::Map<const Element, Eigen::Unaligned, ElementStride> ConstView;
+
+    MatrixSoA() : _size(0), _paddedSize(0) {};
+
+    void resize(const int size) {
+        _size = size;
+        _paddedSize = ((size + SOA_PADDING - 1) / SOA_PADDING) * SOA_PADDING;
+        _lanes.setZero(_paddedSize, ROWS * COLS);
+    };
+
+    int size() const        { return _size; };
+    int paddedSize() const  { return _paddedSize; };
+
+    // a view of a single element
+    View operator[](const int index) {
+        return View(_lanes.data() + index, ElementStride(ROWS * _paddedSize, _paddedSize));
+    };
+    ConstView operator[](const int index) const {
+        return ConstView(_lanes.data() + index, ElementStride(ROWS * _paddedSize, _paddedSize));
+    };
+
+    // entry (row, col) of all the elements, paddedSize() long
+    REAL* lane(const int row, const int col)             { return _lanes.col(row + ROWS * col).data(); };
+    const REAL* lane(const int row, const int col) const { return _lanes.col(row + ROWS * col).data(); };
+
+private:
+    Eigen::Matrix<REAL, Eigen::Dynamic, ROWS * COLS> _lanes;
+    int _size;
+    int _paddedSize;
+};
+
+typedef MatrixSoA<3, 3> MATRIX3_SOA;
+typedef MatrixSoA<3, 1> VECTOR3_SOA;
+
+}
+
+#endif // !MATRIXSOA_H
@@ -21,6 +21,10 @@ namespace Ryao {
     // Matrix double-contraction
     REAL ddot(const MATRIX3& A, const MATRIX3& B);
 
+    // dot product of two long vectors, summed in REAL_ACCUMULATE so that
+    // Krylov solves still converge when REAL is a float
+    REAL_ACCUMULATE accumulatedDot(const VECTOR& a, const VECTOR& b);
+
     // eigenvectors 0-2 are the twist modes
     // eigenvectors 3-5 are the flip modes
     void buildTwistAndFlipEigenvectors(const MATRIX3& U, const MATRIX3& V,
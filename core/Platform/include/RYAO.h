@@ -6,7 +6,28 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+// Build everything in single precision? Positions, Fs, Hessians and the solver
+// vectors are then all floats, which halves the memory traffic of the element
+// loops and of the sparse matrix-vector multiplies.
+//
+// Only SOLVER::solveMatrixFreePPCG accumulates its dot products into
+// REAL_ACCUMULATE, so float builds use it by default. The assembled path goes
+// through Eigen's ConjugateGradient, which still accumulates in REAL, so if a
+// float build switches matrix-free PCG off, its reductions and its convergence
+// test are float too.
+//
+// test/BunnyDropPrecision runs BunnyDrop with matrix-free PCG in both
+// precisions, and fails if they drift further apart than it allows.
+#ifndef RYAO_SINGLE_PRECISION
+#define RYAO_SINGLE_PRECISION 0
+#endif
+
+#if RYAO_SINGLE_PRECISION
+typedef float REAL;
+#else
 typedef double REAL;
+#endif
+typedef double REAL_ACCUMULATE;
 typedef Eigen::Matrix<REAL, 3,  3>  MATRIX3;
 typedef Eigen::Matrix<REAL, 9,  9>  MATRIX9;
 typedef Eigen::Matrix<REAL, 3,  12> MATRIX3x12;
@@ -34,6 +55,7 @@ typedef Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic> MATRIXI;
 typedef Eigen::SparseMatrix<REAL> SPARSE_MATRIX;
 
 typedef Eigen::Quaterniond QUATERNIOND;
+typedef Eigen::AngleAxis<REAL> ANGLE_AXIS;
 
 struct TriVertex {
 	// position 
@@ -0,0 +1,328 @@
+#include <BatchedSVD.h>
+#include <MatrixUtils.h>
+#include <cmath>
+
+namespace Ryao {
+using namespace std;
+
+// fixed number of Jacobi sweeps, so there is no convergence test to branch on.
+// Jacobi converges quadratically, and four sweeps get doubles down to roundoff.
+static const int jacobiSweeps = 4;
+
+// a block of lanes never straddles the padding
+static_assert(SOA_PADDING % SVD_LANES == 0, "SOA_PADDING must be a multiple of SVD_LANES");
+
+// anything the kernel reconstructs worse than this, relative to |F|, goes to svd_rv
+static const REAL fallbackTolerance = SVD_TOLERANCE;
+
+///////////////////////////////////////////////////////////////////////
+// conjugate S by the Givens rotation in the (p, q) plane that zeroes
+// S(p, q), and multiply the rotation, which is about axis k, onto the
+// quaternion. (p, q, k) is (0, 1, 2), (1, 2, 0) or (2, 0, 1).
+///////////////////////////////////////////////////////////////////////
+static inline void jacobiConjugate(const int p, const int q, const int k,
+                                   REAL S[3][3][SVD_LANES], REAL quaternion[4][SVD_LANES]) {
+#pragma omp simd
+    for (int l = 0; l < SVD_LANES; l++) {
+        const REAL Spp = S[p][p][l];
+        const REAL Sqq = S[q][q][l];
+        const REAL Spq = S[p][q][l];
+        const REAL Spk = S[p][k][l];
+        const REAL Sqk = S[q][k][l];
+
+        // tan(2 theta) = 2 Spq / (Spp - Sqq), taking the root with |theta| <= pi / 4
+        const REAL a = Spp - Sqq;
+        const REAL b = 2.0 * Spq;
+        const REAL r = sqrt(a * a + b * b);
+        const REAL cos2 = (r > 0.0) ? fabs(a) / r : 1.0;
+        const REAL sin2 = (r > 0.0) ? ((a >= 0.0) ? b : -b) / r : 0.0;
+        const REAL c = sqrt(0.5 * (1.0 + cos2));
+        const REAL s = sin2 / (2.0 * c);
+
+        const REAL cc = c * c;
+        const REAL ss = s * s;
+        const REAL cs2 = 2.0 * c * s;
+        S[p][p][l] = cc * Spp + cs2 * Spq + ss * Sqq;
+        S[q][q][l] = ss * Spp - cs2 * Spq + cc * Sqq;
+        S[p][q][l] = S[q][p][l] = 0.0;
+        S[p][k][l] = S[k][p][l] = c * Spk + s * Sqk;
+        S[q][k][l] = S[k][q][l] = -s * Spk + c * Sqk;
+
+        // the same rotation as a quaternion, with the half angle
+        const REAL ch = sqrt(0.5 * (1.0 + c));
+        const REAL sh = s / (2.0 * ch);
+        const REAL w  = quaternion[0][l];
+        const REAL vp = quaternion[1 + p][l];
+        const REAL vq = quaternion[1 + q][l];
+        const REAL vk = quaternion[1 + k][l];
+        quaternion[0][l]     = ch * w - sh * vk;
+        quaternion[1 + p][l] = ch * vp + sh * vq;
+        quaternion[1 + q][l] = ch * vq - sh * vp;
+        quaternion[1 + k][l] = ch * vk + sh * w;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////
+// if column i of B is shorter than column j, swap them, and negate
+// one so that V stays a rotation
+///////////////////////////////////////////////////////////////////////
+static inline void conditionalSwap(const int i, const int j, REAL B[3][3][SVD_LANES],
+                                   REAL V[3][3][SVD_LANES], REAL rho[3][SVD_LANES]) {
+#pragma omp simd
+    for (int l = 0; l < SVD_LANES; l++) {
+        const bool swap = rho[i][l] < rho[j][l];
+        for (int row = 0; row < 3; row++) {
+            const REAL Bi = B[row][i][l];
+            const REAL Bj = B[row][j][l];
+            B[row][i][l] = swap ? Bj : Bi;
+            B[row][j][l] = swap ? -Bi : Bj;
+
+            const REAL Vi = V[row][i][l];
+            const REAL Vj = V[row][j][l];
+            V[row][i][l] = swap ? Vj : Vi;
+            V[row][j][l] = swap ? -Vi : Vj;
+        }
+        const REAL rhoi = rho[i][l];
+        const REAL rhoj = rho[j][l];
+        rho[i][l] = swap ? rhoj : rhoi;
+        rho[j][l] = swap ? rhoi : rhoj;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////
+// zero B(q, column) by a Givens rotation of rows p and q, and
+// multiply its transpose onto U
+///////////////////////////////////////////////////////////////////////
+static inline void givensQR(const int p, const int q, const int column,
+                            REAL B[3][3][SVD_LANES], REAL U[3][3][SVD_LANES]) {
+#pragma omp simd
+    for (int l = 0; l < SVD_LANES; l++) {
+        const REAL a = B[p][column][l];
+        const REAL b = B[q][column][l];
+        const REAL r = sqrt(a * a + b * b);
+        const REAL c = (r > 0.0) ? a / r : 1.0;
+        const REAL s = (r > 0.0) ? b / r : 0.0;
+
+        for (int x = 0; x < 3; x++) {
+            const REAL Bp = B[p][x][l];
+            const REAL Bq = B[q][x][l];
+            B[p][x][l] = c * Bp + s * Bq;
+            B[q][x][l] = -s * Bp + c * Bq;
+
+            const REAL Up = U[x][p][l];
+            const REAL Uq = U[x][q][l];
+            U[x][p][l] = c * Up + s * Uq;
+            U[x][q][l] = -s * Up + c * Uq;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////
+// the kernel itself, on SVD_LANES matrices stored side by side
+///////////////////////////////////////////////////////////////////////
+static void svdLanes(const REAL F[3][3][SVD_LANES], REAL U[3][3][SVD_LANES],
+                     REAL Sigma[3][SVD_LANES], REAL V[3][3][SVD_LANES]) {
+    // S = F^T F
+    REAL S[3][3][SVD_LANES];
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++) {
+#pragma omp simd
+            for (int l = 0; l < SVD_LANES; l++)
+                S[i][j][l] = F[0][i][l] * F[0][j][l] + F[1][i][l] * F[1][j][l] + F[2][i][l] * F[2][j][l];
+        }
+
+    // diagonalize S, accumulating V as a quaternion so it stays a rotation
+    REAL quaternion[4][SVD_LANES];
+#pragma omp simd
+    for (int l = 0; l < SVD_LANES; l++) {
+        quaternion[0][l] = 1.0;
+        quaternion[1][l] = quaternion[2][l] = quaternion[3][l] = 0.0;
+    }
+    for (int sweep = 0; sweep < jacobiSweeps; sweep++) {
+        jacobiConjugate(0, 1, 2, S, quaternion);
+        jacobiConjugate(1, 2, 0, S, quaternion);
+        jacobiConjugate(2, 0, 1, S, quaternion);
+    }
+
+#pragma omp simd
+    for (int l = 0; l < SVD_LANES; l++) {
+        const REAL norm = sqrt(quaternion[0][l] * quaternion[0][l] + quaternion[1][l] * quaternion[1][l] +
+                               quaternion[2][l] * quaternion[2][l] + quaternion[3][l] * quaternion[3][l]);
+        const REAL w = quaternion[0][l] / norm;
+        const REAL x = quaternion[1][l] / norm;
+        const REAL y = quaternion[2][l] / norm;
+        const REAL z = quaternion[3][l] / norm;
+
+        V[0][0][l] = 1.0 - 2.0 * (y * y + z * z);
+        V[0][1][l] = 2.0 * (x * y - w * z);
+        V[0][2][l] = 2.0 * (x * z + w * y);
+        V[1][0][l] = 2.0 * (x * y + w * z);
+        V[1][1][l] = 1.0 - 2.0 * (x * x + z * z);
+        V[1][2][l] = 2.0 * (y * z - w * x);
+        V[2][0][l] = 2.0 * (x * z - w * y);
+        V[2][1][l] = 2.0 * (y * z + w * x);
+        V[2][2][l] = 1.0 - 2.0 * (x * x + y * y);
+    }
+
+    // B = F V, and sort its columns so the singular values come out in decreasing order
+    REAL B[3][3][SVD_LANES];
+    REAL rho[3][SVD_LANES];
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++) {
+#pragma omp simd
+            for (int l = 0; l < SVD_LANES; l++)
+                B[i][j][l] = F[i][0][l] * V[0][j][l] + F[i][1][l] * V[1][j][l] + F[i][2][l] * V[2][j][l];
+        }
+    for (int j = 0; j < 3; j++) {
+#pragma omp simd
+        for (int l = 0; l < SVD_LANES; l++)
+            rho[j][l] = B[0][j][l] * B[0][j][l] + B[1][j][l] * B[1][j][l] + B[2][j][l] * B[2][j][l];
+    }
+    conditionalSwap(0, 1, B, V, rho);
+    conditionalSwap(0, 2, B, V, rho);
+    conditionalSwap(1, 2, B, V, rho);
+
+    // B = U R, and R is diagonal since the columns of B are orthogonal. The first two
+    // diagonal entries come out positive, so any reflection lands in the last one.
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++) {
+#pragma omp simd
+            for (int l = 0; l < SVD_LANES; l++)
+                U[i][j][l] = (i == j) ? 1.0 : 0.0;
+        }
+    givensQR(0, 1, 0, B, U);
+    givensQR(0, 2, 0, B, U);
+    givensQR(1, 2, 1, B, U);
+
+    for (int i = 0; i < 3; i++) {
+#pragma omp simd
+        for (int l = 0; l < SVD_LANES; l++)
+            Sigma[i][l] = B[i][i][l];
+    }
+}
+
+///////////////////////////////////////////////////////////////////////
+// run up to SVD_LANES matrices through the kernel, padding out the
+// unused lanes with the identity
+///////////////////////////////////////////////////////////////////////
+void svdBlock(const MATRIX3* Fs, const int count, MATRIX3* Us, VECTOR3* Sigmas, MATRIX3* Vs) {
+    REAL F[3][3][SVD_LANES];
+    REAL U[3][3][SVD_LANES];
+    REAL Sigma[3][SVD_LANES];
+    REAL V[3][3][SVD_LANES];
+
+    for (int l = 0; l < SVD_LANES; l++)
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                F[i][j][l] = (l < count) ? Fs[l](i, j) : ((i == j) ? 1.0 : 0.0);
+
+    svdLanes(F, U, Sigma, V);
+
+    for (int l = 0; l < count; l++)
+        for (int i = 0; i < 3; i++) {
+            Sigmas[l][i] = Sigma[i][l];
+            for (int j = 0; j < 3; j++) {
+                Us[l](i, j) = U[i][j][l];
+                Vs[l](i, j) = V[i][j][l];
+            }
+        }
+}
+
+// how far off is U * Sigma * V^T from F, relative to F?
+static REAL reconstructionError(const MATRIX3& F, const MATRIX3& U, const VECTOR3& Sigma, const MATRIX3& V) {
+    const REAL error = (U * Sigma.asDiagonal() * V.transpose() - F).norm();
+    return error / max(F.norm(), (REAL)1.0);
+}
+
+///////////////////////////////////////////////////////////////////////
+// run svd_rv on count <= SVD_LANES matrices in one go
+///////////////////////////////////////////////////////////////////////
+void svd_rv(const MATRIX3* Fs, const int count, MATRIX3* Us, VECTOR3* Sigmas, MATRIX3* Vs) {
+    svdBlock(Fs, count, Us, Sigmas, Vs);
+
+    // the negated test also catches NaNs
+    for (int x = 0; x < count; x++)
+        if (!(reconstructionError(Fs[x], Us[x], Sigmas[x], Vs[x]) <= fallbackTolerance))
+            svd_rv(Fs[x], Us[x], Sigmas[x], Vs[x]);
+}
+
+///////////////////////////////////////////////////////////////////////
+// run svd_rv on all of Fs
+///////////////////////////////////////////////////////////////////////
+void svd_rv(const vector<MATRIX3>& Fs, vector<MATRIX3>& Us, vector<VECTOR3>& Sigmas, vector<MATRIX3>& Vs) {
+    const int total = Fs.size();
+    Us.resize(total);
+    Sigmas.resize(total);
+    Vs.resize(total);
+
+    const int totalBlocks = (total + SVD_LANES - 1) / SVD_LANES;
+#pragma omp parallel for schedule(static)
+    for (int block = 0; block < totalBlocks; block++) {
+        const int begin = block * SVD_LANES;
+        const int count = min(SVD_LANES, total - begin);
+        svd_rv(&Fs[begin], count, &Us[begin], &Sigmas[begin], &Vs[begin]);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////
+// run svd_rv on all of Fs, in structure-of-arrays storage
+///////////////////////////////////////////////////////////////////////
+void svd_rv(const MATRIX3_SOA& Fs, MATRIX3_SOA& Us, VECTOR3_SOA& Sigmas, MATRIX3_SOA& Vs) {
+    const int total = Fs.size();
+    if (Us.size() != total) Us.resize(total);
+    if (Sigmas.size() != total) Sigmas.resize(total);
+    if (Vs.size() != total) Vs.resize(total);
+
+    // the padding is zero, so it can go through the kernel with everything else
+    const int totalBlocks = Fs.paddedSize() / SVD_LANES;
+#pragma omp parallel for schedule(static)
+    for (int block = 0; block < totalBlocks; block++) {
+        const int begin = block * SVD_LANES;
+        REAL F[3][3][SVD_LANES];
+        REAL U[3][3][SVD_LANES];
+        REAL Sigma[3][SVD_LANES];
+        REAL V[3][3][SVD_LANES];
+
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++) {
+                const REAL* lane = Fs.lane(i, j) + begin;
+#pragma omp simd
+                for (int l = 0; l < SVD_LANES; l++)
+                    F[i][j][l] = lane[l];
+            }
+
+        svdLanes(F, U, Sigma, V);
+
+        for (int i = 0; i < 3; i++) {
+            REAL* sigmaLane = Sigmas.lane(i, 0) + begin;
+#pragma omp simd
+            for (int l = 0; l < SVD_LANES; l++)
+                sigmaLane[l] = Sigma[i][l];
+            for (int j = 0; j < 3; j++) {
+                REAL* uLane = Us.lane(i, j) + begin;
+                REAL* vLane = Vs.lane(i, j) + begin;
+#pragma omp simd
+                for (int l = 0; l < SVD_LANES; l++) {
+                    uLane[l] = U[i][j][l];
+                    vLane[l] = V[i][j][l];
+                }
+            }
+        }
+
+        const int end = min(begin + SVD_LANES, total);
+        for (int x = begin; x < end; x++) {
+            const MATRIX3 Fx = Fs[x];
+            if (reconstructionError(Fx, Us[x], Sigmas[x], Vs[x]) <= fallbackTolerance)
+                continue;
+
+            MATRIX3 Ux, Vx;
+            VECTOR3 Sigmax;
+            svd_rv(Fx, Ux, Sigmax, Vx);
+            Us[x] = Ux;
+            Sigmas[x] = Sigmax;
+            Vs[x] = Vx;
+        }
+    }
+}
+
+}
@@ -0,0 +1,171 @@
+#include <BlockSparseMatrix.h>
+#include <algorithm>
+#include <cassert>
+
+namespace Ryao {
+using namespace std;
+
+BlockSparseMatrix::BlockSparseMatrix() :
+    _blockRows(0), _blockCols(0), _upperOnly(false) {
+    _rowStarts.push_back(0);
+}
+
+///////////////////////////////////////////////////////////////////////
+// build the sparsity pattern from a list of block pairs
+///////////////////////////////////////////////////////////////////////
+void BlockSparseMatrix::setPattern(const int blockRows, const int blockCols,
+                                   vector<pair<int, int> > blockPairs, const bool upperOnly) {
+    assert(!upperOnly || blockRows == blockCols);
+    _blockRows = blockRows;
+    _blockCols = blockCols;
+    _upperOnly = upperOnly;
+
+    if (_upperOnly)
+        for (unsigned int x = 0; x < blockPairs.size(); x++)
+            if (blockPairs[x].first > blockPairs[x].second)
+                swap(blockPairs[x].first, blockPairs[x].second);
+
+    sort(blockPairs.begin(), blockPairs.end());
+    blockPairs.erase(unique(blockPairs.begin(), blockPairs.end()), blockPairs.end());
+
+    _rowStarts.assign(_blockRows + 1, 0);
+    _columns.resize(blockPairs.size());
+    for (unsigned int x = 0; x < blockPairs.size(); x++) {
+        _rowStarts[blockPairs[x].first + 1]++;
+        _columns[x] = blockPairs[x].second;
+    }
+    for (int x = 0; x < _blockRows; x++)
+        _rowStarts[x + 1] += _rowStarts[x];
+
+    _blocks.assign(blockPairs.size(), MATRIX3::Zero());
+
+    // the mirrored blocks, bucketed by the row they land in, i.e. their column
+    _mirrorStarts.clear();
+    _mirrorRows.clear();
+    _mirrorBlocks.clear();
+    if (!_upperOnly)
+        return;
+
+    _mirrorStarts.assign(_blockRows + 1, 0);
+    for (unsigned int x = 0; x < _columns.size(); x++)
+        if (blockPairs[x].first != blockPairs[x].second)
+            _mirrorStarts[_columns[x] + 1]++;
+    for (int x = 0; x < _blockRows; x++)
+        _mirrorStarts[x + 1] += _mirrorStarts[x];
+
+    // the blocks go in row order, so each bucket comes out sorted by the row they're stored in
+    vector<int> next(_mirrorStarts.begin(), _mirrorStarts.end() - 1);
+    _mirrorRows.resize(_mirrorStarts.back());
+    _mirrorBlocks.resize(_mirrorStarts.back());
+    for (unsigned int x = 0; x < _columns.size(); x++) {
+        if (blockPairs[x].first == blockPairs[x].second)
+            continue;
+        const int slot = next[_columns[x]]++;
+        _mirrorRows[slot] = blockPairs[x].first;
+        _mirrorBlocks[slot] = x;
+    }
+}
+
+int BlockSparseMatrix::blockIndex(const int blockRow, const int blockCol) const {
+    const auto begin = _columns.begin() + _rowStarts[blockRow];
+    const auto end   = _columns.begin() + _rowStarts[blockRow + 1];
+    const auto found = lower_bound(begin, end, blockCol);
+    if (found == end || *found != blockCol)
+        return -1;
+    return (int)(found - _columns.begin());
+}
+
+void BlockSparseMatrix::setZero() {
+#pragma omp parallel for schedule(static)
+    for (int x = 0; x < (int)_blocks.size(); x++)
+        _blocks[x].setZero();
+}
+
+///////////////////////////////////////////////////////////////////////
+// y = A * x
+///////////////////////////////////////////////////////////////////////
+void BlockSparseMatrix::multiply(const VECTOR& x, VECTOR& y) const {
+    assert(x.size() == cols());
+    y.resize(rows());
+
+    // the stored blocks, and in upper-only storage the mirrored blocks that land
+    // in this row as well. Each row is only written by its own thread.
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < _blockRows; i++) {
+        VECTOR3 sum = VECTOR3::Zero();
+        for (int k = _rowStarts[i]; k < _rowStarts[i + 1]; k++)
+            sum += _blocks[k] * x.segment<3>(3 * _columns[k]);
+        if (_upperOnly)
+            for (int k = _mirrorStarts[i]; k < _mirrorStarts[i + 1]; k++)
+                sum += _blocks[_mirrorBlocks[k]].transpose() * x.segment<3>(3 * _mirrorRows[k]);
+        y.segment<3>(3 * i) = sum;
+    }
+}
+
+VECTOR BlockSparseMatrix::operator*(const VECTOR& x) const {
+    VECTOR y;
+    multiply(x, y);
+    return y;
+}
+
+void BlockSparseMatrix::addDiagonalBlocks(const REAL scale, vector<MATRIX3>& blocks) const {
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < _blockRows; i++) {
+        const int index = blockIndex(i, i);
+        if (index >= 0)
+            blocks[i] += scale * _blocks[index];
+    }
+}
+
+///////////////////////////////////////////////////////////////////////
+// conversions to and from Eigen
+///////////////////////////////////////////////////////////////////////
+SPARSE_MATRIX BlockSparseMatrix::toSparseMatrix() const {
+    typedef Eigen::Triplet<REAL> TRIPLET;
+    vector<TRIPLET> triplets;
+    triplets.reserve((_upperOnly ? 18 : 9) * _blocks.size());
+
+    for (int i = 0; i < _blockRows; i++)
+        for (int k = _rowStarts[i]; k < _rowStarts[i + 1]; k++) {
+            const int j = _columns[k];
+            const MATRIX3& B = _blocks[k];
+            for (int b = 0; b < 3; b++)
+                for (int a = 0; a < 3; a++) {
+                    triplets.push_back(TRIPLET(3 * i + a, 3 * j + b, B(a, b)));
+                    if (_upperOnly && j != i)
+                        triplets.push_back(TRIPLET(3 * j + b, 3 * i + a, B(a, b)));
+                }
+        }
+
+    SPARSE_MATRIX A(rows(), cols());
+    A.setFromTriplets(triplets.begin(), triplets.end());
+    return A;
+}
+
+BlockSparseMatrix BlockSparseMatrix::fromSparseMatrix(const SPARSE_MATRIX& A, const bool upperOnly) {
+    assert(A.rows() % 3 == 0 && A.cols() % 3 == 0);
+    vector<pair<int, int> > blockPairs;
+    for (int col = 0; col < A.outerSize(); col++)
+        for (SPARSE_MATRIX::InnerIterator it(A, col); it; ++it)
+            if (!upperOnly || it.row() / 3 <= col / 3)
+                blockPairs.push_back(make_pair((int)it.row() / 3, col / 3));
+
+    BlockSparseMatrix B;
+    B.setPattern(A.rows() / 3, A.cols() / 3, blockPairs, upperOnly);
+
+    for (int col = 0; col < A.outerSize(); col++)
+        for (SPARSE_MATRIX::InnerIterator it(A, col); it; ++it) {
+            if (upperOnly && it.row() / 3 > col / 3)
+                continue;
+            const int index = B.blockIndex(it.row() / 3, col / 3);
+            B._blocks[index](it.row() % 3, col % 3) = it.value();
+        }
+    return B;
+}
+
+size_t BlockSparseMatrix::indexBytes() const {
+    return (_rowStarts.size() + _columns.size() +
+            _mirrorStarts.size() + _mirrorRows.size() + _mirrorBlocks.size()) * sizeof(int);
+}
+
+}
@@ -78,6 +78,24 @@ REAL ddot(const MATRIX3& A, const MATRIX3& B) {
     return result;
 }
 
+///////////////////////////////////////////////////////////////////////
+// Dot product, accumulated in REAL_ACCUMULATE. When that's just REAL,
+// Eigen's own dot product does the same thing faster.
+///////////////////////////////////////////////////////////////////////
+REAL_ACCUMULATE accumulatedDot(const VECTOR& a, const VECTOR& b) {
+    assert(a.size() == b.size());
+#if RYAO_SINGLE_PRECISION
+    REAL_ACCUMULATE result = 0;
+    const int size = a.size();
+#pragma omp parallel for simd schedule(static) reduction(+:result)
+    for (int x = 0; x < size; x++)
+        result += (REAL_ACCUMULATE)a[x] * (REAL_ACCUMULATE)b[x];
+    return result;
+#else
+    return a.dot(b);
+#endif
+}
+
 ///////////////////////////////////////////////////////////////////////
 // rotation gradient, w.r.t. deformation gradient F
 // \frac{\partial R}{\partial F}
@@ -89,8 +89,7 @@ MATRIX3 randomRotation() {
     const VECTOR3 axis = randomVector3().normalized();
     MATRIX3 R;
 
-    // assumes that REAL is a double
-    R = Eigen::AngleAxisd(angle, axis);
+    R = Eigen::AngleAxis<REAL>(angle, axis);
     return R;
 }
 }
\ No newline at end of file
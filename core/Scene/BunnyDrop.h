@@ -23,9 +23,9 @@ virtual bool buildScene() override {
     using namespace Eigen;
     using namespace std;
     MATRIX3 M;
-    M =   AngleAxisd(0.5 * M_PI, VECTOR3::UnitX())
-          * AngleAxisd(0,  VECTOR3::UnitY())
-          * AngleAxisd(0, VECTOR3::UnitZ());
+    M =   ANGLE_AXIS(0.5 * M_PI, VECTOR3::UnitX())
+          * ANGLE_AXIS(0,  VECTOR3::UnitY())
+          * ANGLE_AXIS(0, VECTOR3::UnitZ());
 
     // the target position
     VECTOR3 half(0.5, 0.5, 1.0);
@@ -64,6 +64,8 @@ virtual bool buildScene() override {
     // build the time integrator
     _solver = new SOLVER::BackwardEulerVelocity(*_tetMesh, *_hyperelastic);
     //_solver = new TIMESTEPPER::BACKWARD_EULER_VELOCITY(*_tetMesh, *_hyperelastic);
+    //_solver = new SOLVER::ProjectiveDynamics(*_tetMesh, *_hyperelastic);
+    //_solver = new SOLVER::VertexBlockDescent(*_tetMesh, *_hyperelastic);
     _solver->setDt(1.0 / 60.0);
 
     _kinematicShapes.reserve(10);
@@ -79,49 +81,49 @@ virtual bool buildScene() override {
     center = VECTOR3(-1.0, 0.0, 0.25);
     centers.push_back(center);
     addCube(centers.back(), 1.0);
-    _kinematicShapes.back()->rotation() = AngleAxisd(M_PI * 0.25, VECTOR3::UnitZ());
+    _kinematicShapes.back()->rotation() = ANGLE_AXIS(M_PI * 0.25, VECTOR3::UnitZ());
     _solver->addKinematicCollisionObject(_kinematicShapes.back());
 
     center = VECTOR3(1.0, -0.75, 0.25);
     centers.push_back(center);
     addCube(centers.back(), 1.0);
-    _kinematicShapes.back()->rotation() = AngleAxisd(M_PI * 0.25, VECTOR3::UnitZ());
+    _kinematicShapes.back()->rotation() = ANGLE_AXIS(M_PI * 0.25, VECTOR3::UnitZ());
     _solver->addKinematicCollisionObject(_kinematicShapes.back());
 
     center = VECTOR3(-1.0, -1.5, 0.25);
     centers.push_back(center);
     addCube(centers.back(), 1.0);
-    _kinematicShapes.back()->rotation() = AngleAxisd(M_PI * 0.25, VECTOR3::UnitZ());
+    _kinematicShapes.back()->rotation() = ANGLE_AXIS(M_PI * 0.25, VECTOR3::UnitZ());
     _solver->addKinematicCollisionObject(_kinematicShapes.back());
 
     center = VECTOR3(1.0, -2.25, 0.25);
     centers.push_back(center);
     addCube(centers.back(), 1.0);
-    _kinematicShapes.back()->rotation() = AngleAxisd(M_PI * 0.25, VECTOR3::UnitZ());
+    _kinematicShapes.back()->rotation() = ANGLE_AXIS(M_PI * 0.25, VECTOR3::UnitZ());
     _solver->addKinematicCollisionObject(_kinematicShapes.back());
 
     center = VECTOR3(-1.0, -3.0, 0.25);
     centers.push_back(center);
     addCube(centers.back(), 1.0);
-    _kinematicShapes.back()->rotation() = AngleAxisd(M_PI * 0.25, VECTOR3::UnitZ());
+    _kinematicShapes.back()->rotation() = ANGLE_AXIS(M_PI * 0.25, VECTOR3::UnitZ());
     _solver->addKinematicCollisionObject(_kinematicShapes.back());
 
     center = VECTOR3(1.0, -3.75, 0.25);
     centers.push_back(center);
     addCube(centers.back(), 1.0);
-    _kinematicShapes.back()->rotation() = AngleAxisd(M_PI * 0.25, VECTOR3::UnitZ());
+    _kinematicShapes.back()->rotation() = ANGLE_AXIS(M_PI * 0.25, VECTOR3::UnitZ());
     _solver->addKinematicCollisionObject(_kinematicShapes.back());
 
     center = VECTOR3(-1.0, -4.5, 0.25);
     centers.push_back(center);
     addCube(centers.back(), 1.0);
-    _kinematicShapes.back()->rotation() = AngleAxisd(M_PI * 0.25, VECTOR3::UnitZ());
+    _kinematicShapes.back()->rotation() = ANGLE_AXIS(M_PI * 0.25, VECTOR3::UnitZ());
     _solver->addKinematicCollisionObject(_kinematicShapes.back());
 
     center = VECTOR3(1.0, -5.25, 0.25);
     centers.push_back(center);
     addCube(centers.back(), 1.0);
-    _kinematicShapes.back()->rotation() = AngleAxisd(M_PI * 0.25, VECTOR3::UnitZ());
+    _kinematicShapes.back()->rotation() = ANGLE_AXIS(M_PI * 0.25, VECTOR3::UnitZ());
     _solver->addKinematicCollisionObject(_kinematicShapes.back());
 
     // collision constants
@@ -15,6 +15,8 @@
 #include "Hyperelastic/include/NeoHookeanBW.h"
 #include "Solver/include/SOLVER.h"
 #include "Solver/include/BackwardEulerVelocity.h"
+#include "Solver/include/ProjectiveDynamics.h"
+#include "Solver/include/VertexBlockDescent.h"
 #include "Platform/include/Logger.h"
 #include <string>
 
@@ -139,6 +141,17 @@ public:
         return _tetMesh->vertices();
     }
 
+    // how often the collision detection could reuse its candidates
+    void printCollisionStats() const {
+        if (_tetMesh != nullptr)
+            _tetMesh->printCandidateCacheStats();
+    }
+
+    // the time integrator, so its solver options can be changed after buildScene()
+    SOLVER::SOLVER* getSolver() const {
+        return _solver;
+    }
+
 protected:
     // set the positions to previous timestep, in case the user wants to 
     // look at that instead of the current step
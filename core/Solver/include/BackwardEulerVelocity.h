@@ -8,6 +8,21 @@
 namespace Ryao {
 namespace SOLVER {
 
+// convergence statistics of the Newton iterations in a single timestep. Residuals are the
+// norm of the filtered gradient of the incremental potential, relative to the filtered
+// right hand side of the first, linearized solve
+struct NEWTON_STATS {
+    // linear solves, including the first, linearized one
+    int iterations;
+
+    // total number of times the line search halved the step
+    int lineSearchSteps;
+
+    REAL initialResidual;
+    REAL finalResidual;
+    bool converged;
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // This is an implementation of the Baraff-Witkin-style velocity-level solver from
 // "Large Steps in Cloth Simulation", SIGGRAPH 1998
@@ -22,12 +37,35 @@ public:
     virtual bool solve(const bool verbose) override;
     bool solveRayleighDamped(const bool verbose);
     bool solveEnergyDamped(const bool verbose);
+
+    // Newton iterations per timestep. The default of 1 is the single linearized solve of [BW98],
+    // anything more keeps iterating on the incremental potential with a backtracking line search.
+    // Only the Rayleigh-damped solve iterates, since the energy-based damping has no potential.
+    int& maxNewtonIterations()              { return _maxNewtonIterations; };
+    REAL& newtonTolerance()                 { return _newtonTolerance; };
+    int& maxLineSearchSteps()               { return _maxLineSearchSteps; };
+    const NEWTON_STATS& newtonStats() const { return _newtonStats; };
 private:
     // update the displacement targets the Baraff-Witkin-style constraints
     // are trying to hit. Assumes that buildConstraintMatrix() has already been called
     // Only PLANE_CONSTRAINT is token into consideration.
     virtual void updateConstraintTargets() override;
 
+    // solve the [TJM15] projected system for y, either by assembling S * A * S + (I - S)
+    // and handing it to PCG or the direct solver, or by applying it matrix-free. Newton updates
+    // pass coldStart, since the previous \Delta v is no guess for them.
+    VECTOR solveProjectedSystem(const SPARSE_MATRIX& C, const SPARSE_MATRIX& K, const VECTOR& z, const bool verbose,
+                                const bool coldStart = false);
+
+    // the incremental potential of Backward Euler, as a function of \Delta v:
+    // 1/2 dv^T M dv + Psi(x) - dt f^T dv - dt/2 v^T C v, where x = x_n + dt * (v_n + dv)
+    // Leaves the mesh at x, with its Fs computed.
+    REAL incrementalPotential(const SPARSE_MATRIX& C, const VECTOR& vDelta);
+
+    // keep refining \Delta v after the first, linearized solve with Newton iterations
+    // and a backtracking line search on the incremental potential
+    void newtonIterations(const SPARSE_MATRIX& C, VECTOR& vDelta, const bool verbose);
+
     // Baraff-Witkin solves for change in velocity
     VECTOR _vDelta;
 
@@ -36,6 +74,12 @@ private:
 
     // current simulation step
     int _currentTimestep;
+
+    // Newton settings, and how the last timestep went
+    int _maxNewtonIterations;
+    REAL _newtonTolerance;
+    int _maxLineSearchSteps;
+    NEWTON_STATS _newtonStats;
 };
 
 }
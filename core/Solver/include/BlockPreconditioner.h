@@ -0,0 +1,117 @@
+#ifndef RYAO_BLOCKPRECONDITIONER_H
+#define RYAO_BLOCKPRECONDITIONER_H
+
+#include "Platform/include/RYAO.h"
+#include <string>
+#include <vector>
+
+namespace Ryao {
+namespace SOLVER {
+
+enum PreconditionerType {
+    DIAGONAL,
+    BLOCK_JACOBI,
+    BLOCK_INCOMPLETE_CHOLESKY
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// A preconditioner that works on the per-vertex 3x3 blocks of the system matrix. It follows the
+// interface of Eigen::DiagonalPreconditioner, so it can be plugged straight into
+// Eigen::ConjugateGradient, and the type can be switched at runtime.
+//
+// DIAGONAL:                  the same as Eigen::DiagonalPreconditioner
+// BLOCK_JACOBI:              inverts each 3x3 diagonal block. For the [TJM15] system this is
+//                            S_i * A_ii * S_i + (I - S_i), so the plane constraint filter is included
+// BLOCK_INCOMPLETE_CHOLESKY: zero fill-in block Cholesky on the block sparsity of the matrix
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class BlockPreconditioner {
+public:
+    typedef REAL Scalar;
+    typedef VECTOR Vector;
+    enum {
+        ColsAtCompileTime = Eigen::Dynamic,
+        MaxColsAtCompileTime = Eigen::Dynamic
+    };
+
+    BlockPreconditioner();
+
+    template<typename MatType>
+    explicit BlockPreconditioner(const MatType& mat) : BlockPreconditioner() {
+        compute(mat);
+    }
+
+    Eigen::Index rows() const { return _size; }
+    Eigen::Index cols() const { return _size; }
+
+    PreconditionerType type() const { return _type; }
+    void setType(const PreconditionerType type) { _type = type; }
+    std::string name() const;
+
+    // the Eigen iterative solver interface
+    template<typename MatType>
+    BlockPreconditioner& analyzePattern(const MatType&) { return *this; }
+
+    template<typename MatType>
+    BlockPreconditioner& factorize(const MatType& mat) { return compute(mat); }
+
+    template<typename MatType>
+    BlockPreconditioner& compute(const MatType& mat) {
+        const Eigen::Ref<const SPARSE_MATRIX> A(mat);
+        build(A);
+        return *this;
+    }
+
+    // build from just the 3x3 diagonal blocks, for when the matrix is never assembled.
+    // BLOCK_INCOMPLETE_CHOLESKY needs the whole matrix, so it falls back to BLOCK_JACOBI here
+    void computeFromDiagonalBlocks(const std::vector<MATRIX3>& blocks);
+
+    template<typename Rhs>
+    VECTOR solve(const Rhs& b) const {
+        const VECTOR rhs = b;
+        return apply(rhs);
+    }
+
+    Eigen::ComputationInfo info() { return Eigen::Success; }
+
+    // how much diagonal shift did the incomplete Cholesky need to not break down?
+    REAL incompleteCholeskyShift() const { return _shift; }
+
+private:
+    void build(const Eigen::Ref<const SPARSE_MATRIX>& A);
+    void buildDiagonal(const Eigen::Ref<const SPARSE_MATRIX>& A);
+    void buildBlockJacobi(const std::vector<MATRIX3>& blocks);
+    void buildIncompleteCholesky(const Eigen::Ref<const SPARSE_MATRIX>& A);
+
+    // try to factor the lower block triangle with a given diagonal shift,
+    // returns false if a pivot block was not positive definite
+    bool factorIncompleteCholesky(const REAL shift);
+
+    VECTOR apply(const VECTOR& b) const;
+
+    PreconditionerType _type;
+    int _size;
+
+    // DIAGONAL
+    VECTOR _invDiagonal;
+
+    // BLOCK_JACOBI, and the inverses of the Cholesky factors of the
+    // diagonal blocks for BLOCK_INCOMPLETE_CHOLESKY
+    std::vector<MATRIX3> _invBlocks;
+
+    // lower block triangle, stored by block rows, with the diagonal excluded
+    std::vector<int> _rowStarts;
+    std::vector<int> _columns;
+    std::vector<MATRIX3> _lowerBlocks;
+    std::vector<MATRIX3> _diagonalBlocks;
+
+    // unfactored copies, in case the factorization needs to be restarted with a shift
+    std::vector<MATRIX3> _originalLower;
+    std::vector<MATRIX3> _originalDiagonal;
+
+    REAL _shift;
+};
+
+}
+}
+
+#endif //RYAO_BLOCKPRECONDITIONER_H
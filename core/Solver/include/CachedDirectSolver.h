@@ -0,0 +1,72 @@
+#ifndef RYAO_CACHEDDIRECTSOLVER_H
+#define RYAO_CACHEDDIRECTSOLVER_H
+
+#include "Platform/include/RYAO.h"
+#include <string>
+#include <vector>
+
+namespace Ryao {
+namespace SOLVER {
+
+enum DirectSolverType {
+    SIMPLICIAL_LDLT,
+    SIMPLICIAL_LLT
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// A sparse direct solver that keeps its symbolic analysis around across timesteps.
+//
+// The elastic sparsity pattern is fixed once TET_Mesh_Faster bakes _sparseA, so most steps only
+// need a numeric refactorization. The symbolic phase is redone only when the pattern of the
+// incoming matrix differs from the last one, i.e. when collision pairs or constraints changed it.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class CachedDirectSolver {
+public:
+    CachedDirectSolver();
+
+    DirectSolverType type() const { return _type; }
+    void setType(const DirectSolverType type);
+    std::string name() const;
+
+    // factorize A, only redoing the symbolic analysis if its pattern changed.
+    // Returns false if the factorization failed.
+    bool compute(const SPARSE_MATRIX& A);
+
+    // solve using the last factorization
+    VECTOR solve(const VECTOR& b) const;
+
+    // forget the cached pattern, so the next compute() redoes the symbolic phase
+    void reset();
+
+    // how many times did each phase run?
+    int totalSymbolicFactorizations() const { return _totalSymbolic; }
+    int totalNumericFactorizations() const  { return _totalNumeric; }
+
+    // did the last compute() have to redo the symbolic phase?
+    bool lastComputeWasSymbolic() const     { return _lastWasSymbolic; }
+
+private:
+    // does A have the same sparsity pattern as the cached one?
+    bool samePattern(const SPARSE_MATRIX& A) const;
+    void cachePattern(const SPARSE_MATRIX& A);
+
+    DirectSolverType _type;
+
+    Eigen::SimplicialLDLT<SPARSE_MATRIX> _ldlt;
+    Eigen::SimplicialLLT<SPARSE_MATRIX> _llt;
+
+    // the pattern the symbolic analysis was done on
+    bool _analyzed;
+    int _rows;
+    std::vector<int> _outerIndices;
+    std::vector<int> _innerIndices;
+
+    int _totalSymbolic;
+    int _totalNumeric;
+    bool _lastWasSymbolic;
+};
+
+}
+}
+
+#endif //RYAO_CACHEDDIRECTSOLVER_H
@@ -0,0 +1,124 @@
+#ifndef RYAO_PERSISTENTSYSTEMMATRIX_H
+#define RYAO_PERSISTENTSYSTEMMATRIX_H
+
+#include "Platform/include/RYAO.h"
+#include "Platform/include/BlockSparseMatrix.h"
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace Ryao {
+namespace SOLVER {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// The clamped 12x12 Hessians of the collisions, each with the four vertices it acts on. In persistent
+// system mode these stand in for the collision parts of K and C, so they never need to be built as
+// sparse matrices. clear() and resize() keep the capacity, so the arrays stop allocating once they've
+// seen the most collisions.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+struct CollisionHessians {
+    std::vector<VECTOR4I> vertices;
+    std::vector<MATRIX12> hessians;
+
+    void clear()      { vertices.clear(); hessians.clear(); }
+    int size() const  { return hessians.size(); }
+
+    // y += scale * H * x, where H is the sum of the collision Hessians
+    void multiplyAdd(const VECTOR& x, const REAL scale, VECTOR& y) const;
+
+    // accumulate scale times the 3x3 diagonal blocks of H into blocks
+    void addDiagonalBlocks(const REAL scale, std::vector<MATRIX3>& blocks) const;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// The [TJM15] system matrix S * (M - dt * C - dt * dt * K) * S + (I - S), kept in a sparsity pattern
+// that persists across timesteps, so it can be written in place instead of built out of fresh
+// Eigen sparse products every step.
+//
+// The pattern is the union of the elastic pattern (which contains the mass matrix), and a slack
+// pattern of collision blocks. Collision blocks are sticky: once a pair of vertices has collided,
+// its block stays reserved. If a collision lands outside of the pattern, the slack overflows,
+// it is grown, and the matrix is re-patterned.
+//
+// S is block diagonal, so S_i * A_ij * S_j has the same pattern as A, and the projection
+// is done in place as well.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class PersistentSystemMatrix {
+public:
+    PersistentSystemMatrix();
+
+    // write the system matrix into the persistent pattern. K is split into the elastic part,
+    // which lives in blocks, whatever is left in the sparse K, and the collisions, whose Hessians
+    // get stamped straight into the slack. The collision damping is stamped the same way, on top of C.
+    void assemble(const SPARSE_MATRIX& M, const BlockSparseMatrix& elastic, const SPARSE_MATRIX& C,
+                  const SPARSE_MATRIX& K, const CollisionHessians& collisionK, const CollisionHessians& collisionC,
+                  const BlockSparseMatrix& S, const REAL dt);
+
+    const SPARSE_MATRIX& matrix() const { return _matrix; }
+
+    // how many times did collisions land outside of the pattern?
+    int slackOverflows() const          { return _slackOverflows; }
+
+    // how many times was the pattern rebuilt, including the first one?
+    int repatterns() const              { return _repatterns; }
+
+    // how many collision blocks are reserved outside of the elastic pattern?
+    int slackBlocks() const             { return _slack.size(); }
+
+    // drop the collision slack, so the next assemble() re-patterns from just the elastic pattern
+    void reset();
+
+private:
+    struct BlockEntry {
+        int row;
+        int col;
+
+        // where column b of the block starts in the value array
+        int slots[3];
+
+        // where the block lives in the elastic blocks, -1 if it doesn't
+        int elastic;
+        bool elasticTransposed;
+    };
+
+    // rebuild the pattern from the elastic blocks and the slack
+    void setPattern(const BlockSparseMatrix& elastic);
+
+    // where does entry (row, col) live in the value array? -1 if it's not in the pattern
+    int slot(const int row, const int col) const;
+
+    // add scale * A into the matrix. Returns false if some entry of A was not in the pattern.
+    bool scatter(const SPARSE_MATRIX& A, const REAL scale);
+
+    // add scale * H for each collision into the matrix. Returns false if some block was not in the pattern.
+    bool stamp(const CollisionHessians& collisions, const REAL scale);
+
+    // add the blocks of A, or of the collisions, that are not in the pattern to the slack
+    void growSlack(const SPARSE_MATRIX& A);
+    void growSlack(const CollisionHessians& collisions);
+
+    SPARSE_MATRIX _matrix;
+    std::vector<BlockEntry> _blocks;
+
+    // which of _blocks is the diagonal block for each vertex?
+    std::vector<int> _diagonalBlocks;
+
+    // which vertices have a non-identity filter block in S?
+    std::vector<char> _filtered;
+
+    // collision blocks outside of the elastic pattern
+    std::set<std::pair<int, int> > _slack;
+
+    // the elastic pattern the block mapping was built for
+    const BlockSparseMatrix* _elasticSource;
+    int _elasticBlocks;
+    bool _elasticUpperOnly;
+
+    int _slackOverflows;
+    int _repatterns;
+};
+
+}
+}
+
+#endif //RYAO_PERSISTENTSYSTEMMATRIX_H
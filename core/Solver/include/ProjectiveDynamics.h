@@ -0,0 +1,101 @@
+#ifndef RYAO_PROJECTIVEDYNAMICS_H
+#define RYAO_PROJECTIVEDYNAMICS_H
+
+#include "SOLVER.h"
+#include "Geometry/include/TET_Mesh_Faster.h"
+
+namespace Ryao {
+namespace SOLVER {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// This is an implementation of "Projective Dynamics: Fusing Constraint Projections for Fast
+// Simulation", SIGGRAPH 2014. It is a faster-but-approximate alternative to BackwardEulerVelocity.
+//
+// Every tet gets an ARAP term w / 2 * ||F - R||^2, where the local step projects F onto its
+// rotation R, and the global step solves a matrix that only changes when the constraints do:
+//
+//      (M / dt^2 + sum_t w_t G_t^T G_t + W) x = M / dt^2 * (x_n + dt * v_n) + f
+//                                              + sum_t w_t G_t^T R_t + W p
+//
+// Kinematic and plane constraints go in as projection terms W, with targets p. The hyperelastic
+// material is only used to pick the ARAP stiffness, and self-collisions are explicit forces
+// evaluated at the start of the timestep.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class ProjectiveDynamics : public SOLVER {
+public:
+    ProjectiveDynamics(TET_Mesh_Faster& tetMesh, VOLUME::HYPERELASTIC& hyperelastic);
+
+    // take a timestep
+    virtual bool solve(const bool verbose) override;
+
+    // the global matrix depends on dt, so this rebuilds it
+    virtual void setDt(const REAL dt) override;
+
+    // local/global iterations per timestep
+    int& iterations()                               { return _iterations; };
+
+    // the ARAP weight per unit rest volume, defaults to the shear modulus of the material
+    REAL arapStiffness() const                      { return _arapStiffness; };
+    void setArapStiffness(const REAL stiffness);
+
+    // the weight of a constraint, relative to the mass of its vertex over dt^2
+    REAL constraintStiffness() const                { return _constraintStiffness; };
+    void setConstraintStiffness(const REAL stiffness);
+
+private:
+    // store the world space closest point of each plane constraint in _constraintTargets,
+    // so the projections can slide vertices along the plane through it
+    virtual void updateConstraintTargets() override;
+
+    // build M / dt^2 + sum_t w_t G_t^T G_t, the part of the global matrix without constraints
+    void buildGlobalMatrix();
+
+    // the per-vertex weight of the constraint projections
+    VECTOR computeConstraintWeights() const;
+
+    // add the constraint weights to the diagonal and refactorize, but only if they changed.
+    // If the factorization fails, the global steps use PCG instead
+    void factorGlobalMatrix(const VECTOR& constraintWeights, const bool verbose);
+
+    // project every tet onto its closest rotation, and add sum_t w_t G_t^T R_t to the RHS
+    void addLocalProjections(VECTOR& rhs);
+
+    // project the constrained vertices onto their targets, and add W p to the RHS
+    void addConstraintProjections(const VECTOR& positions, VECTOR& rhs) const;
+
+    // the explicit self-collision forces at the current positions
+    VECTOR computeCollisionForces();
+
+    // ARAP weight of each tet, 2 * stiffness * rest volume
+    vector<REAL> _tetWeights;
+
+    // the rotations from the last local step
+    vector<MATRIX3> _rotations;
+
+    // rest positions, so that positions are just rest positions plus displacements
+    VECTOR _restPositions;
+
+    // the global matrix without constraints, and with the constraints that were last factorized
+    SPARSE_MATRIX _globalBase;
+    SPARSE_MATRIX _global;
+    VECTOR _factorizedWeights;
+    bool _globalDirty;
+
+    // did the last factorization of _global succeed?
+    bool _globalFactored;
+
+    int _iterations;
+    REAL _arapStiffness;
+    REAL _constraintStiffness;
+
+    // current simulation time
+    REAL _time;
+
+    // current simulation step
+    int _currentTimestep;
+};
+
+}
+}
+
+#endif //RYAO_PROJECTIVEDYNAMICS_H
@@ -7,11 +7,22 @@
 #include "Geometry/include/KINEMATIC_SHAPE.h"
 #include "Hyperelastic/include/HYPERELASTIC.h"
 #include "Damping/include/Damping.h"
+#include "BlockPreconditioner.h"
+#include "CachedDirectSolver.h"
+#include "PersistentSystemMatrix.h"
 #include "Platform/include/Logger.h"
 #include "Platform/include/Timer.h"
 
 namespace Ryao {
 namespace SOLVER {
+
+// what should PCG use as its initial guess?
+enum WarmStartType {
+    COLD_START,             // zero, the default
+    PREVIOUS_DELTA,         // the last solution, projected through the current S
+    EXTRAPOLATED_DELTA      // linear extrapolation from the last two solutions, projected through S
+};
+
 class SOLVER {
 public:
     SOLVER(TET_Mesh_Faster& tetMesh, VOLUME::HYPERELASTIC& hyperelastic);
@@ -44,6 +55,32 @@ public:
     bool& edgeEdgeSelfCollisionsOn()               { return _edgeEdgeSelfCollisionsOn; };
     REAL& collisionStiffness()                     { return _collisionStiffness; };
     REAL& collisionDampingBeta()                   { return _collisionDampingBeta; };
+    const bool& matrixFreePCG() const              { return _matrixFreePCG; };
+    bool& matrixFreePCG()                          { return _matrixFreePCG; };
+    const int& seenPCGIterations() const           { return _seenPCGIterations; };
+    WarmStartType warmStart() const                { return _warmStart; };
+    void setWarmStart(const WarmStartType type)    { _warmStart = type; };
+
+    // PCG telemetry. The warm start residual is ||RHS - LHS * guess|| / ||RHS|| of the
+    // initial guess, so a cold start is always 1.
+    REAL warmStartResidual() const                 { return _warmStartResidual; };
+    REAL averagePCGIterations() const;
+    void resetPCGStatistics()                      { _totalPCGIterations = 0; _totalPCGSolves = 0; };
+    PreconditionerType preconditioner() const      { return _cgSolver.preconditioner().type(); };
+    void setPreconditioner(const PreconditionerType type) { _cgSolver.preconditioner().setType(type); };
+    const bool& directSolve() const                { return _directSolve; };
+    bool& directSolve()                            { return _directSolve; };
+    const CachedDirectSolver& directSolver() const { return _directSolver; };
+    void setDirectSolver(const DirectSolverType type) { _directSolver.setType(type); };
+    const bool& blockSparse() const                { return _blockSparse; };
+    bool& blockSparse()                            { return _blockSparse; };
+    const bool& symmetricBlockStorage() const      { return _symmetricBlockStorage; };
+    bool& symmetricBlockStorage()                  { return _symmetricBlockStorage; };
+    const bool& persistentSystem() const           { return _persistentSystem; };
+    bool& persistentSystem()                       { return _persistentSystem; };
+    const PersistentSystemMatrix& systemMatrix() const { return _systemMatrix; };
+    const bool& fusedElasticPass() const           { return _fusedElasticPass; };
+    bool& fusedElasticPass()                       { return _fusedElasticPass; };
     virtual void setDt(const REAL dt)             { _dt = dt; };
     void setRayeligh(const REAL alpha, const REAL beta);
 
@@ -74,7 +111,11 @@ public:
     void addKinematicCollisionObject(const KINEMATIC_SHAPE* shape);
 
     // make all objects lighter or heavier
-    void scaleMass(const REAL& scalar)  { _M *= scalar; };
+    void scaleMass(const REAL& scalar)  { _M *= scalar; _rayleighDampingCached = false; };
+
+    // the rest-state stiffness and Rayleigh damping are cached across timesteps.
+    // If the material parameters are changed behind the solver's back, call this.
+    void invalidateRestState()          { _restStiffnessCached = false; _rayleighDampingCached = false; };
 protected:
     // shared initialization across constructors
     void initialize();
@@ -111,8 +152,12 @@ protected:
     // build the mass matrix based on the one-ring volume
     SPARSE_MATRIX buildMassMatrix();
 
-    // build the damping matrix based on the rest pose stiffness
-    SPARSE_MATRIX buildRayleighDampingMatrix();
+    // build the stiffness matrix at the rest pose
+    SPARSE_MATRIX buildRestStiffnessMatrix();
+
+    // get the damping matrix based on the rest pose stiffness, only
+    // rebuilding it if the mass, material or Rayleigh constants changed
+    const SPARSE_MATRIX& buildRayleighDampingMatrix();
 
     // do the collision detection, in anticipation of collision response
     // only for the collision between mesh and mesh
@@ -120,8 +165,59 @@ protected:
     void computeCollisionDetection();
 
     // compute collision forces, add them to the forces and stiffness matrix
-    // R = forces, K = stiffness matrix, C = damping
-    void computeCollisionResponse(VECTOR& R, SPARSE_MATRIX& K, SPARSE_MATRIX& C, const bool verbose = false);
+    // R = forces, K = stiffness matrix, C = damping. C can be NULL if the
+    // damping isn't needed, i.e. inside the Newton iterations
+    void computeCollisionResponse(VECTOR& R, SPARSE_MATRIX& K, SPARSE_MATRIX* C, const bool verbose = false);
+
+    // the persistent system version of computeCollisionResponse(). The collision Hessians are
+    // kept per collision in _collisionHessians and _collisionDampingHessians, instead of in K and C
+    void computeCollisionHessians(VECTOR& R, SPARSE_MATRIX* C);
+
+    // the energy of the collisions found by the last computeCollisionDetection(),
+    // at the current vertex positions
+    REAL computeCollisionEnergy() const;
+
+    // get the elastic stiffness matrix. In block sparse or persistent system mode, the elastic part is kept
+    // in _elasticBlocks, and an empty matrix is returned for the collision terms to go in
+    SPARSE_MATRIX computeHyperelasticStiffness();
+
+    // does the material need the SVDs of the Fs for its forces or clamped Hessian?
+    bool hyperelasticNeedsSVDs() const;
+
+    // the elastic forces and stiffness at the current vertex positions, from F onwards. With
+    // _fusedElasticPass this is one pass over the tets, otherwise it's the separate passes.
+    void computeElasticForcesAndStiffness(VECTOR& R, SPARSE_MATRIX& K);
+
+    // K * x, including the elastic blocks in block sparse mode, and the collision Hessians in
+    // persistent system mode
+    VECTOR applyStiffness(const SPARSE_MATRIX& K, const VECTOR& x) const;
+
+    // C * x, including the collision damping Hessians in persistent system mode
+    VECTOR applyDamping(const SPARSE_MATRIX& C, const VECTOR& x) const;
+
+    // S * x, using the block version of S in block sparse mode
+    VECTOR applyConstraintFilter(const VECTOR& x) const;
+
+    // apply A = M - dt * C - dt * dt * K to a vector without assembling A
+    VECTOR applySystemMatrix(const SPARSE_MATRIX& C, const SPARSE_MATRIX& K, const VECTOR& x) const;
+
+    // apply the [TJM15] projected matrix S * A * S + (I - S) to a vector without assembling it
+    VECTOR applyProjectedSystemMatrix(const SPARSE_MATRIX& C, const SPARSE_MATRIX& K, const VECTOR& x) const;
+
+    // gather the 3x3 diagonal blocks of a sparse matrix, scaled and accumulated into blocks
+    static void addDiagonalBlocks(const SPARSE_MATRIX& A, const REAL scale, vector<MATRIX3>& blocks);
+
+    // solve (S * A * S + (I - S)) y = rhs with a preconditioned CG that
+    // only ever applies M, C, K and S as operators, so the LHS is never formed
+    VECTOR solveMatrixFreePPCG(const SPARSE_MATRIX& C, const SPARSE_MATRIX& K, const VECTOR& rhs,
+                               const VECTOR& guess, const bool verbose = false);
+
+    // build the initial PCG guess for y according to _warmStart. Assumes that
+    // _solution and _solutionOld still hold the last two solutions.
+    VECTOR warmStartGuess() const;
+
+    // record the iteration count of the last PCG solve
+    void recordPCGIterations(const int iterations);
 
     REAL _residual;
     int _seenPCGIterations;
@@ -140,6 +236,15 @@ protected:
     // solution of the linear system
     VECTOR _solution;
 
+    // solution of the linear system in the previous timestep, used for warm starting
+    VECTOR _solutionOld;
+
+    // how to warm start PCG, and how much it helped
+    WarmStartType _warmStart;
+    REAL _warmStartResidual;
+    long _totalPCGIterations;
+    int _totalPCGSolves;
+
     // A scratchpad for temporary storage of data
     VECTOR _temp;
 
@@ -147,6 +252,9 @@ protected:
     SPARSE_MATRIX _S;
     SPARSE_MATRIX _IminusS;
 
+    // the constraint matrix in 3x3 blocks, for block sparse mode
+    BlockSparseMatrix _SBlocks;
+
     // constraint targets
     VECTOR _constraintTargets;
 
@@ -181,8 +289,45 @@ protected:
     // global Hessian matrix
     SPARSE_MATRIX _H;
 
-    // A CG solver
-    Eigen::ConjugateGradient<SPARSE_MATRIX, Eigen::Lower|Eigen::Upper> _cgSolver;
+    // cached rest-state operators for Rayleigh damping
+    SPARSE_MATRIX _restStiffness;
+    SPARSE_MATRIX _rayleighDamping;
+    bool _restStiffnessCached;
+    bool _rayleighDampingCached;
+
+    // A CG solver, the preconditioner type can be swapped with setPreconditioner()
+    Eigen::ConjugateGradient<SPARSE_MATRIX, Eigen::Lower|Eigen::Upper, BlockPreconditioner> _cgSolver;
+
+    // apply the system matrix as an operator instead of assembling it?
+    bool _matrixFreePCG;
+
+    // use a direct solver that caches its symbolic factorization instead of PCG?
+    // this takes precedence over _matrixFreePCG, since it needs the assembled matrix
+    bool _directSolve;
+    CachedDirectSolver _directSolver;
+
+    // assemble and apply the elastic stiffness in 3x3 blocks? Only the
+    // blocks on or above the diagonal are stored if _symmetricBlockStorage is set.
+    // When the system matrix is needed, it is written into _systemMatrix in place
+    bool _blockSparse;
+    bool _symmetricBlockStorage;
+
+    // the elastic stiffness from the tet mesh, in block sparse mode
+    const BlockSparseMatrix* _elasticBlocks;
+
+    // write the system matrix in place into a pattern that persists across timesteps?
+    // This keeps the elastic stiffness in blocks, like _blockSparse does.
+    bool _persistentSystem;
+    PersistentSystemMatrix _systemMatrix;
+
+    // in persistent system mode, the collision parts of K and C, one Hessian per collision.
+    // The damping ones are already scaled by _collisionDampingBeta. Both are empty otherwise.
+    CollisionHessians _collisionHessians;
+    CollisionHessians _collisionDampingHessians;
+
+    // compute F, the SVDs, the elastic forces and the clamped Hessians in a single
+    // pass over the tets? The separate passes are still there for debugging.
+    bool _fusedElasticPass;
 
     // what's this timestepper called
     string _name;
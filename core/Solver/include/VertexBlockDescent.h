@@ -0,0 +1,74 @@
+#ifndef RYAO_VERTEXBLOCKDESCENT_H
+#define RYAO_VERTEXBLOCKDESCENT_H
+
+#include "SOLVER.h"
+#include "Geometry/include/TET_Mesh_Faster.h"
+
+namespace Ryao {
+namespace SOLVER {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// This is an implementation of "Vertex Block Descent", SIGGRAPH 2024
+//
+// Backward Euler is minimized one vertex at a time: each vertex gathers the 3x3 gradient and
+// clamped Hessian blocks of its incident tets, and takes a local Newton step. Vertices of the
+// same color share no tets, so each color is swept in parallel. Nothing global is ever
+// assembled, so memory scales with the vertices and tets, not the nonzeros of the Hessian.
+//
+// Kinematic constraints pin their vertices, and plane constraints project penetrating vertices back
+// onto the plane. Self-collisions are linearized at the start of the timestep, and each vertex
+// only sees the diagonal block of their Hessian.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+class VertexBlockDescent : public SOLVER {
+public:
+    VertexBlockDescent(TET_Mesh_Faster& tetMesh, VOLUME::HYPERELASTIC& hyperelastic);
+
+    // take a timestep
+    virtual bool solve(const bool verbose) override;
+
+    // sweeps over all the colors per timestep
+    int& iterations()                               { return _iterations; };
+
+    // how many colors did the tet connectivity need?
+    int totalColors() const                         { return _colors.size(); };
+
+private:
+    // store the world space closest point of each plane constraint in _constraintTargets
+    virtual void updateConstraintTargets() override;
+
+    // minimize the incremental potential over a single vertex with a Newton step
+    void solveVertex(const int vertexID, const VECTOR& inertial, const VECTOR& positionsOld,
+                     VECTOR& positions) const;
+
+    // the self-collision forces at the start of the timestep, and the
+    // diagonal blocks of their clamped Hessian
+    void computeCollisionTerms();
+
+    // vertices in each color class
+    vector<vector<int>> _colors;
+
+    // per-vertex constraint state: -1 is free, otherwise the index of its plane constraint.
+    // Kinematically constrained vertices are pinned.
+    vector<int> _planeConstraintIDs;
+    vector<bool> _pinned;
+
+    // self-collision forces at the start of the timestep, and the per-vertex diagonal of their Hessian
+    VECTOR _collisionForces;
+    vector<MATRIX3> _collisionBlocks;
+
+    // rest positions, so that positions are just rest positions plus displacements
+    VECTOR _restPositions;
+
+    int _iterations;
+
+    // current simulation time
+    REAL _time;
+
+    // current simulation step
+    int _currentTimestep;
+};
+
+}
+}
+
+#endif //RYAO_VERTEXBLOCKDESCENT_H
@@ -14,6 +14,11 @@ BackwardEulerVelocity::BackwardEulerVelocity(TET_Mesh_Faster& tetMesh, VOLUME::H
     _time = 0.0;
     _currentTimestep = 0;
 
+    _maxNewtonIterations = 1;
+    _newtonTolerance = 1e-3;
+    _maxLineSearchSteps = 10;
+    _newtonStats = NEWTON_STATS{1, 0, 0.0, 0.0, true};
+
     _name = string("Backward Euler Velocity Solver");
 }
 
@@ -46,6 +51,197 @@ void BackwardEulerVelocity::updateConstraintTargets() {
     }
 }
 
+VECTOR BackwardEulerVelocity::solveProjectedSystem(const SPARSE_MATRIX& C, const SPARSE_MATRIX& K,
+                                                   const VECTOR& z, const bool verbose, const bool coldStart) {
+    if (_matrixFreePCG && !_directSolve) {
+        // from [TJM15], this is c = b - Az (page 8, top of column 2)
+        Timer projectionTimer("PPCG projection");
+        VECTOR RHS = applyConstraintFilter(_b - applySystemMatrix(C, K, z));
+        projectionTimer.stop();
+
+        Timer pcgTimer("PCG Solve");
+        const VECTOR guess = coldStart ? VECTOR(VECTOR::Zero(_DOFs)) : warmStartGuess();
+        VECTOR y = solveMatrixFreePPCG(C, K, RHS, guess, verbose);
+        pcgTimer.stop();
+
+        if (verbose && _warmStart != COLD_START && !coldStart)
+            RYAO_INFO("Warm start initial residual: {}, average PCG iters: {}",
+                      (float)_warmStartResidual, (float)averagePCGIterations());
+        return y;
+    }
+
+    VECTOR RHS;
+    SPARSE_MATRIX assembledLHS;
+    const bool inPlace = _persistentSystem || _blockSparse;
+    if (inPlace) {
+        // write S * A * S + (I - S) in place, the collisions are stamped in one Hessian at a time.
+        // Block sparse mode comes through here too, so its elastic blocks never get converted
+        // to a SPARSE_MATRIX. Its collisions are still in K.
+        Timer systemTimer("Forming linear system");
+        _systemMatrix.assemble(_M, *_elasticBlocks, C, K, _collisionHessians, _collisionDampingHessians, _SBlocks, _dt);
+        systemTimer.stop();
+
+        // from [TJM15], this is c = b - Az (page 8, top of column 2)
+        Timer projectionTimer("PPCG projection");
+        RHS = applyConstraintFilter(_b - applySystemMatrix(C, K, z));
+        projectionTimer.stop();
+
+        if (verbose)
+            RYAO_INFO("Persistent system matrix: {} slack blocks, {} slack overflows, {} re-patterns",
+                      _systemMatrix.slackBlocks(), _systemMatrix.slackOverflows(), _systemMatrix.repatterns());
+    } else {
+        Timer systemTimer("Forming linear system");
+        _A = _M - _dt * C - _dt * _dt * K;
+
+        // from [TJM15], this is c = b - Az (page 8, top of column 2)
+        VECTOR c = _b - _A * z;
+        systemTimer.stop();
+
+        Timer projectionTimer("PPCG projection");
+        RHS = _S * c;
+        assembledLHS = _S * _A * _S + _IminusS;
+        projectionTimer.stop();
+    }
+    const SPARSE_MATRIX& LHS = inPlace ? _systemMatrix.matrix() : assembledLHS;
+
+    if (_directSolve) {
+        Timer directTimer("Direct Solve");
+        const bool factored = _directSolver.compute(LHS);
+        if (factored) {
+            VECTOR y = _directSolver.solve(RHS);
+            directTimer.stop();
+
+            if (verbose)
+                RYAO_INFO("{} solve, symbolic phase redone: {}, symbolic/numeric factorizations so far: {}/{}",
+                          _directSolver.name(), _directSolver.lastComputeWasSymbolic(),
+                          _directSolver.totalSymbolicFactorizations(), _directSolver.totalNumericFactorizations());
+            return y;
+        }
+        directTimer.stop();
+
+        // the system isn't definite enough for the factorization, so let PCG have a go at it
+        RYAO_WARN("{} factorization failed, falling back to PCG", _directSolver.name());
+    }
+
+    Timer pcgTimer("PCG Solve");
+    _cgSolver.compute(LHS);
+    VECTOR y;
+    if (_warmStart == COLD_START || coldStart) {
+        y = _cgSolver.solve(RHS);
+        _warmStartResidual = 1.0;
+    } else {
+        const VECTOR guess = warmStartGuess();
+        const REAL rhsNorm = RHS.norm();
+        _warmStartResidual = (rhsNorm > 0.0) ? (RHS - LHS * guess).norm() / rhsNorm : 1.0;
+        y = _cgSolver.solveWithGuess(RHS, guess);
+    }
+    pcgTimer.stop();
+    recordPCGIterations((int)_cgSolver.iterations());
+
+    if (verbose) {
+        RYAO_INFO("PCG iters: {}, err: {}, preconditioner: {}", _seenPCGIterations, (float)_cgSolver.error(),
+                  _cgSolver.preconditioner().name());
+        if (_warmStart != COLD_START && !coldStart)
+            RYAO_INFO("Warm start initial residual: {}, average PCG iters: {}",
+                      (float)_warmStartResidual, (float)averagePCGIterations());
+    }
+
+    return y;
+}
+
+REAL BackwardEulerVelocity::incrementalPotential(const SPARSE_MATRIX& C, const VECTOR& vDelta) {
+    const VECTOR velocity = _velocity + vDelta;
+    _tetMesh.setDisplacement(_position + _dt * velocity);
+    _tetMesh.computeFs();
+
+    REAL energy = 0.5 * vDelta.dot(_M * vDelta);
+    energy += _tetMesh.computeElasticEnergy(_hyperelastic) + computeCollisionEnergy();
+    energy -= _dt * _externalForces.dot(vDelta);
+
+    // the damping force C * v comes from the dissipation potential -1/2 v^T C v,
+    // C is negative semi-definite, same as K
+    energy -= 0.5 * _dt * velocity.dot(applyDamping(C, velocity));
+    return energy;
+}
+
+void BackwardEulerVelocity::newtonIterations(const SPARSE_MATRIX& C, VECTOR& vDelta, const bool verbose) {
+    Timer functionTimer(__FUNCTION__);
+    const REAL armijo = 1e-4;
+
+    // the linearized RHS is needed later to find separating constraints
+    const VECTOR linearizedB = _b;
+    REAL scale = applyConstraintFilter(_b).norm();
+    if (scale <= 0.0) scale = 1.0;
+
+    // the collisions found at the start of the step stay fixed, only their forces get updated
+    const VECTOR zero = VECTOR::Zero(_DOFs);
+
+    REAL energy = incrementalPotential(C, vDelta);
+    while (true) {
+        // forces and stiffnesses at the current iterate
+        VECTOR R;
+        SPARSE_MATRIX K;
+        computeElasticForcesAndStiffness(R, K);
+        computeCollisionResponse(R, K, NULL);
+
+        // the negative gradient of the incremental potential
+        _b = _dt * (R + _externalForces + applyDamping(C, _velocity + vDelta)) - _M * vDelta;
+        const REAL residual = applyConstraintFilter(_b).norm() / scale;
+        if (_newtonStats.iterations == 1)
+            _newtonStats.initialResidual = residual;
+        _newtonStats.finalResidual = residual;
+
+        if (residual <= _newtonTolerance) {
+            _newtonStats.converged = true;
+            break;
+        }
+        if (_newtonStats.iterations >= _maxNewtonIterations)
+            break;
+
+        // the constrained components of \Delta v already hit their targets, so z = 0. This is
+        // inexact Newton, the correction only needs to be as accurate as the residual is small.
+        const REAL tolerance = _cgSolver.tolerance();
+        _cgSolver.setTolerance(std::max(tolerance, std::min((REAL)0.1, residual)));
+        const VECTOR step = solveProjectedSystem(C, K, zero, verbose, true);
+        _cgSolver.setTolerance(tolerance);
+        _newtonStats.iterations++;
+
+        // the clamped Hessian is SPD, so this should always be a descent direction
+        const REAL slope = -_b.dot(step);
+        if (slope >= 0.0) {
+            RYAO_WARN("Newton step is not a descent direction, stopping at iteration {}", _newtonStats.iterations);
+            break;
+        }
+
+        // backtrack until the Armijo condition holds
+        REAL alpha = 1.0;
+        bool accepted = false;
+        for (int x = 0; x <= _maxLineSearchSteps; x++) {
+            const VECTOR trial = vDelta + alpha * step;
+            const REAL trialEnergy = incrementalPotential(C, trial);
+            if (trialEnergy <= energy + armijo * alpha * slope) {
+                vDelta = trial;
+                energy = trialEnergy;
+                accepted = true;
+                break;
+            }
+            alpha *= 0.5;
+            _newtonStats.lineSearchSteps++;
+        }
+
+        // the line search stalled, so put the mesh back at the last good iterate
+        if (!accepted) {
+            incrementalPotential(C, vDelta);
+            break;
+        }
+    }
+
+    // leave everything the way the linearized solve would have
+    _b = linearizedB;
+    _tetMesh.setDisplacement(_position);
+    _tetMesh.computeFs();
+}
+
 bool BackwardEulerVelocity::solve(const bool verbose) {
     if (_damping != NULL)
         return solveEnergyDamped(verbose);
@@ -62,9 +258,8 @@ bool BackwardEulerVelocity::solveRayleighDamped(const bool verbose) {
     if (_currentTimestep == 141) {
         RYAO_INFO("HERE!");
     }
-    // get the damping matrix
-    // OPT TAG
-    // we do not need to call this function every step
+    // get the damping matrix, this is cached across timesteps. Take a copy,
+    // since the collision response writes into it.
     SPARSE_MATRIX C = buildRayleighDampingMatrix();
 
     // only caching this for visualization purposes
@@ -82,8 +277,6 @@ bool BackwardEulerVelocity::solveRayleighDamped(const bool verbose) {
 
     // update the position so that the tetMesh can do collision detection itself
     _tetMesh.setDisplacement(_position);
-    _tetMesh.computeFs();
-    _tetMesh.computeSVDs();
 
     // do collision detection, including spatial data structure updates
     computeCollisionDetection();
@@ -94,45 +287,41 @@ bool BackwardEulerVelocity::solveRayleighDamped(const bool verbose) {
     updateConstraintTargets();
     VECTOR z = _IminusS * _constraintTargets;
 
-    // get the internal forces
-    VECTOR R = _tetMesh.computeHyperelasticForces(_hyperelastic);
-
-    // get the reduced stiffness matrix
-    SPARSE_MATRIX K = _tetMesh.computeHyperelasticClampedHessian(_hyperelastic);
+    // get the internal forces and the reduced stiffness matrix
+    VECTOR R;
+    SPARSE_MATRIX K;
+    computeElasticForcesAndStiffness(R, K);
 
     /// get the reduced forces and stiffnesses
-    computeCollisionResponse(R, K, C);
+    computeCollisionResponse(R, K, &C);
 
     // assemble RHS from Eqn. 18 in [BW98]
     Timer systemTimer("Forming linear system");
-    _b = _dt * (R + _dt * K * _velocity + _externalForces);
+    _b = _dt * (R + _dt * applyStiffness(K, _velocity) + _externalForces);
+    systemTimer.stop();
 
     // here use rayleigh damping matrix C as the \partial f / \partial v
     // why we can use these ?
     // What will rayleigh damping bring us?
-    _A = _M - _dt * C - _dt * _dt * K;
-
-    // from [TJM15], this is c = b - Az (page 8, top of column 2)
-    VECTOR c = _b - _A * z;
-    systemTimer.stop();
-
-    Timer projectionTimer("PPCG projection");
-    VECTOR RHS = _S * c;
-    SPARSE_MATRIX LHS = _S * _A * _S + _IminusS;
-    projectionTimer.stop();
-
-    Timer pcgTimer("PCG Solve");
-    _cgSolver.compute(LHS);
-    VECTOR y = _cgSolver.solve(RHS);
-    pcgTimer.stop();
+    VECTOR y = solveProjectedSystem(C, K, z, verbose);
 
-    if (verbose)
-        RYAO_INFO("PCG iters: {}, err: {}", (int)_cgSolver.iterations(), (float)_cgSolver.error());
+    // keep the previous \Delta v around for warm starting
+    _solutionOld = _solution;
 
     // aliasing _solution to \Delta v just to make clear what we're doing here
     VECTOR& vDelta = _solution;
     vDelta = y + z;
 
+    // optionally keep going with Newton iterations, for large timesteps
+    _newtonStats = NEWTON_STATS{1, 0, 0.0, 0.0, _maxNewtonIterations <= 1};
+    if (_maxNewtonIterations > 1) {
+        newtonIterations(C, vDelta, verbose);
+        if (verbose)
+            RYAO_INFO("Newton iters: {}, line search steps: {}, residual: {} -> {}, converged: {}",
+                      _newtonStats.iterations, _newtonStats.lineSearchSteps, (float)_newtonStats.initialResidual,
+                      (float)_newtonStats.finalResidual, _newtonStats.converged);
+    }
+
     // update velocity
     _velocity = _velocity + vDelta;
     _position = _position + _dt * _velocity;
@@ -142,7 +331,7 @@ bool BackwardEulerVelocity::solveRayleighDamped(const bool verbose) {
     // of this update. For now, stoping these components to zero will at least keep the things stable,
     // so keeping it for future work.
     // QUASTION TAG: why we need to do this?
-    _velocity = _S * _velocity;
+    _velocity = applyConstraintFilter(_velocity);
 
     const bool constraintsChanged = findSeparatingSurfaceConstraints(_b);
 
@@ -183,6 +372,13 @@ bool BackwardEulerVelocity::solveEnergyDamped(const bool verbose) {
         RYAO_INFO(" BACKWARD_EULER_VELOCITY ENERGY-DAMPED SOLVE {}", _currentTimestep);
         RYAO_INFO("==================================================");
     }
+    if (_maxNewtonIterations > 1) {
+        static bool warned = false;
+        if (!warned) {
+            RYAO_WARN("Energy-based damping has no potential to line search on, taking a single linearized solve");
+            warned = true;
+        }
+    }
 
     // only caching this for visualization purposes
     _positionOld = _position;
@@ -202,7 +398,8 @@ bool BackwardEulerVelocity::solveEnergyDamped(const bool verbose) {
 
     _tetMesh.setDisplacement(_position);
     _tetMesh.computeFs();
-    _tetMesh.computeSVDs();
+    if (hyperelasticNeedsSVDs())
+        _tetMesh.computeSVDs();
 
     // z is a vector of the desired values for the constrained variables
     // We apply the _IminusS because _constraintTargets did not project off
@@ -214,35 +411,22 @@ bool BackwardEulerVelocity::solveEnergyDamped(const bool verbose) {
     VECTOR R = _tetMesh.computeInternalForce(_hyperelastic, *_damping);
 
     // get the stiffness matrix
-    SPARSE_MATRIX K = _tetMesh.computeHyperelasticClampedHessian(_hyperelastic);
+    SPARSE_MATRIX K = computeHyperelasticStiffness();
     SPARSE_MATRIX C = _tetMesh.computeDampingHessian(*_damping);
 
     // compute collision forces and stiffnesses
-    computeCollisionResponse(R, K, C);
+    computeCollisionResponse(R, K, &C);
 
     // assemble RHS from Eqn. 18 in [BW98]
     Timer systemTimer("Forming linear system");
-    _b = _dt * (R + _dt * K * _velocity + _externalForces);
-
-    // assemble system matrix A, LHS from Eqn.18 in [BW98]
-    _A = _M - _dt * C - _dt * _dt * K;
-
-    // from [TJM15], this is c = b - Az (page 8, top of column 2)
-    VECTOR c = _b - _A * z;
+    _b = _dt * (R + _dt * applyStiffness(K, _velocity) + _externalForces);
     systemTimer.stop();
 
-    Timer projectionTimer("PPCG projection");
-    VECTOR RHS = _S * c;
-    SPARSE_MATRIX LHS = _S * _A * _S + _IminusS;
-    projectionTimer.stop();
-
-    Timer pcgTimer("PCG Solve");
-    _cgSolver.compute(LHS);
-    VECTOR y = _cgSolver.solve(RHS);
-    pcgTimer.stop();
+    // solve with the system matrix A, LHS from Eqn.18 in [BW98]
+    VECTOR y = solveProjectedSystem(C, K, z, verbose);
 
-    if (verbose)
-        RYAO_INFO("PCG iters: {}, err: {}", (int)_cgSolver.iterations(), (float)_cgSolver.error());
+    // keep the previous \Delta v around for warm starting
+    _solutionOld = _solution;
 
     // aliasing _solution to \Delta v just to make clear what we're doing here
     VECTOR& vDelta = _solution;
@@ -257,7 +441,7 @@ bool BackwardEulerVelocity::solveEnergyDamped(const bool verbose) {
     // of this update. For now, stoping these components to zero will at least keep the things stable,
     // so keeping it for future work.
     // QUASTION TAG: why we need to do this?
-    _velocity = _S * _velocity;
+    _velocity = applyConstraintFilter(_velocity);
 
     const bool constraintsChanged = findSeparatingSurfaceConstraints(_b);
 
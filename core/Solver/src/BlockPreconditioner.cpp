@@ -0,0 +1,250 @@
+#include "BlockPreconditioner.h"
+#include "Platform/include/Logger.h"
+#include "Platform/include/Timer.h"
+#include <algorithm>
+
+namespace Ryao {
+namespace SOLVER {
+using namespace std;
+
+BlockPreconditioner::BlockPreconditioner() :
+    _type(DIAGONAL), _size(0), _shift(0.0) {
+}
+
+string BlockPreconditioner::name() const {
+    switch (_type) {
+        case DIAGONAL:
+            return string("Diagonal");
+        case BLOCK_JACOBI:
+            return string("Block Jacobi");
+        case BLOCK_INCOMPLETE_CHOLESKY:
+            return string("Block incomplete Cholesky");
+    }
+    return string("UNKNOWN");
+}
+
+void BlockPreconditioner::build(const Eigen::Ref<const SPARSE_MATRIX>& A) {
+    Timer functionTimer(__FUNCTION__);
+    _size = A.rows();
+
+    if (_type == DIAGONAL) {
+        buildDiagonal(A);
+        return;
+    }
+
+    if (_type == BLOCK_INCOMPLETE_CHOLESKY) {
+        buildIncompleteCholesky(A);
+        return;
+    }
+
+    // gather the diagonal blocks
+    vector<MATRIX3> blocks(_size / 3, MATRIX3::Zero());
+    for (int col = 0; col < A.outerSize(); col++) {
+        const int block = col / 3;
+        for (Eigen::Ref<const SPARSE_MATRIX>::InnerIterator it(A, col); it; ++it) {
+            if (it.row() / 3 != block)
+                continue;
+            blocks[block](it.row() % 3, col % 3) = it.value();
+        }
+    }
+    buildBlockJacobi(blocks);
+}
+
+void BlockPreconditioner::computeFromDiagonalBlocks(const vector<MATRIX3>& blocks) {
+    _size = 3 * blocks.size();
+
+    if (_type == DIAGONAL) {
+        _invDiagonal.resize(_size);
+        for (unsigned int x = 0; x < blocks.size(); x++)
+            for (int i = 0; i < 3; i++) {
+                const REAL entry = blocks[x](i, i);
+                _invDiagonal[3 * x + i] = (entry != 0.0) ? 1.0 / entry : 1.0;
+            }
+        return;
+    }
+
+    if (_type == BLOCK_INCOMPLETE_CHOLESKY) {
+        static bool warned = false;
+        if (!warned) {
+            RYAO_WARN("Block incomplete Cholesky needs an assembled matrix, falling back to block Jacobi");
+            warned = true;
+        }
+    }
+    buildBlockJacobi(blocks);
+}
+
+void BlockPreconditioner::buildDiagonal(const Eigen::Ref<const SPARSE_MATRIX>& A) {
+    // same as Eigen::DiagonalPreconditioner
+    _invDiagonal.resize(_size);
+    for (int col = 0; col < A.outerSize(); col++) {
+        Eigen::Ref<const SPARSE_MATRIX>::InnerIterator it(A, col);
+        while (it && it.index() != col) ++it;
+        if (it && it.value() != 0.0)
+            _invDiagonal[col] = 1.0 / it.value();
+        else
+            _invDiagonal[col] = 1.0;
+    }
+}
+
+void BlockPreconditioner::buildBlockJacobi(const vector<MATRIX3>& blocks) {
+    _invBlocks.resize(blocks.size());
+    _rowStarts.clear();
+
+#pragma omp parallel for schedule(static)
+    for (int x = 0; x < (int)blocks.size(); x++) {
+        // kinematically constrained blocks are exactly the identity, and everything
+        // else should be SPD. If it isn't, fall back to the diagonal.
+        Eigen::LLT<MATRIX3> llt(blocks[x]);
+        if (llt.info() == Eigen::Success)
+            _invBlocks[x] = llt.solve(MATRIX3::Identity());
+        else {
+            _invBlocks[x].setZero();
+            for (int i = 0; i < 3; i++)
+                _invBlocks[x](i, i) = (blocks[x](i, i) != 0.0) ? 1.0 / blocks[x](i, i) : 1.0;
+        }
+    }
+}
+
+void BlockPreconditioner::buildIncompleteCholesky(const Eigen::Ref<const SPARSE_MATRIX>& A) {
+    const int totalBlocks = _size / 3;
+
+    // the matrix is symmetric, so column c of A is also row c. Gather the
+    // blocks left of the diagonal of each block row.
+    _rowStarts.resize(totalBlocks + 1);
+    _columns.clear();
+    _originalLower.clear();
+    _originalDiagonal.assign(totalBlocks, MATRIX3::Zero());
+
+    vector<int> position(totalBlocks, -1);
+    _rowStarts[0] = 0;
+    for (int blockRow = 0; blockRow < totalBlocks; blockRow++) {
+        const int rowStart = _columns.size();
+        for (int i = 0; i < 3; i++) {
+            const int row = 3 * blockRow + i;
+            for (Eigen::Ref<const SPARSE_MATRIX>::InnerIterator it(A, row); it; ++it) {
+                const int blockColumn = it.index() / 3;
+                if (blockColumn > blockRow)
+                    break;
+
+                if (blockColumn == blockRow) {
+                    _originalDiagonal[blockRow](i, it.index() % 3) = it.value();
+                    continue;
+                }
+
+                if (position[blockColumn] < 0) {
+                    position[blockColumn] = _columns.size();
+                    _columns.push_back(blockColumn);
+                    _originalLower.push_back(MATRIX3::Zero());
+                }
+                _originalLower[position[blockColumn]](i, it.index() % 3) = it.value();
+            }
+        }
+
+        // the three rows may have visited the block columns in a different order
+        const int rowEnd = _columns.size();
+        vector<pair<int, MATRIX3> > sorted;
+        for (int x = rowStart; x < rowEnd; x++) {
+            sorted.push_back(make_pair(_columns[x], _originalLower[x]));
+            position[_columns[x]] = -1;
+        }
+        sort(sorted.begin(), sorted.end(),
+             [](const pair<int, MATRIX3>& a, const pair<int, MATRIX3>& b) { return a.first < b.first; });
+        for (int x = rowStart; x < rowEnd; x++) {
+            _columns[x] = sorted[x - rowStart].first;
+            _originalLower[x] = sorted[x - rowStart].second;
+        }
+        _rowStarts[blockRow + 1] = rowEnd;
+    }
+
+    // if a pivot breaks down, restart with a growing diagonal shift, like Eigen::IncompleteCholesky
+    _shift = 0.0;
+    for (int attempt = 0; attempt < 20; attempt++) {
+        if (factorIncompleteCholesky(_shift))
+            return;
+        _shift = (_shift == 0.0) ? 1e-3 : 2.0 * _shift;
+    }
+
+    RYAO_WARN("Block incomplete Cholesky broke down, falling back to block Jacobi");
+    buildBlockJacobi(_originalDiagonal);
+    _rowStarts.clear();
+}
+
+bool BlockPreconditioner::factorIncompleteCholesky(const REAL shift) {
+    const int totalBlocks = _size / 3;
+    _lowerBlocks = _originalLower;
+    _diagonalBlocks.resize(totalBlocks);
+    _invBlocks.resize(totalBlocks);
+
+    for (int i = 0; i < totalBlocks; i++) {
+        // L_ik = (A_ik - sum_m L_im L_km^T) L_kk^{-T}, only over the existing pattern
+        for (int p = _rowStarts[i]; p < _rowStarts[i + 1]; p++) {
+            const int k = _columns[p];
+            MATRIX3 sum = _lowerBlocks[p];
+
+            int q = _rowStarts[i];
+            int r = _rowStarts[k];
+            while (q < p && r < _rowStarts[k + 1]) {
+                if (_columns[q] < _columns[r])
+                    q++;
+                else if (_columns[q] > _columns[r])
+                    r++;
+                else {
+                    sum -= _lowerBlocks[q] * _lowerBlocks[r].transpose();
+                    q++;
+                    r++;
+                }
+            }
+            _lowerBlocks[p] = sum * _invBlocks[k].transpose();
+        }
+
+        // L_ii L_ii^T = A_ii - sum_k L_ik L_ik^T
+        MATRIX3 pivot = _originalDiagonal[i];
+        for (int i3 = 0; i3 < 3; i3++)
+            pivot(i3, i3) *= 1.0 + shift;
+        for (int p = _rowStarts[i]; p < _rowStarts[i + 1]; p++)
+            pivot -= _lowerBlocks[p] * _lowerBlocks[p].transpose();
+
+        Eigen::LLT<MATRIX3> llt(pivot);
+        if (llt.info() != Eigen::Success)
+            return false;
+
+        _diagonalBlocks[i] = llt.matrixL();
+        _invBlocks[i] = _diagonalBlocks[i].triangularView<Eigen::Lower>().solve(MATRIX3::Identity());
+    }
+    return true;
+}
+
+VECTOR BlockPreconditioner::apply(const VECTOR& b) const {
+    if (_type == DIAGONAL)
+        return _invDiagonal.cwiseProduct(b);
+
+    VECTOR x(b.size());
+    const int totalBlocks = _size / 3;
+
+    if (_rowStarts.empty()) {
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < totalBlocks; i++)
+            x.segment<3>(3 * i) = _invBlocks[i] * b.segment<3>(3 * i);
+        return x;
+    }
+
+    // forward substitution, L y = b
+    for (int i = 0; i < totalBlocks; i++) {
+        VECTOR3 sum = b.segment<3>(3 * i);
+        for (int p = _rowStarts[i]; p < _rowStarts[i + 1]; p++)
+            sum -= _lowerBlocks[p] * x.segment<3>(3 * _columns[p]);
+        x.segment<3>(3 * i) = _invBlocks[i] * sum;
+    }
+
+    // backward substitution, L^T x = y
+    for (int i = totalBlocks - 1; i >= 0; i--) {
+        const VECTOR3 xi = _invBlocks[i].transpose() * x.segment<3>(3 * i);
+        x.segment<3>(3 * i) = xi;
+        for (int p = _rowStarts[i]; p < _rowStarts[i + 1]; p++)
+            x.segment<3>(3 * _columns[p]) -= _lowerBlocks[p].transpose() * xi;
+    }
+    return x;
+}
+
+}
+}
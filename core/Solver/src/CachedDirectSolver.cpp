@@ -0,0 +1,112 @@
+#include "CachedDirectSolver.h"
+#include "Platform/include/Logger.h"
+#include "Platform/include/Timer.h"
+
+namespace Ryao {
+namespace SOLVER {
+using namespace std;
+
+CachedDirectSolver::CachedDirectSolver() :
+    _type(SIMPLICIAL_LDLT), _analyzed(false), _rows(0),
+    _totalSymbolic(0), _totalNumeric(0), _lastWasSymbolic(false) {
+}
+
+void CachedDirectSolver::setType(const DirectSolverType type) {
+    if (type != _type)
+        reset();
+    _type = type;
+}
+
+string CachedDirectSolver::name() const {
+    switch (_type) {
+        case SIMPLICIAL_LDLT:
+            return string("SimplicialLDLT");
+        case SIMPLICIAL_LLT:
+            return string("SimplicialLLT");
+    }
+    return string("UNKNOWN");
+}
+
+void CachedDirectSolver::reset() {
+    _analyzed = false;
+    _outerIndices.clear();
+    _innerIndices.clear();
+}
+
+bool CachedDirectSolver::samePattern(const SPARSE_MATRIX& A) const {
+    if (!_analyzed || A.rows() != _rows)
+        return false;
+    if (A.nonZeros() != (int)_innerIndices.size())
+        return false;
+
+    // the matrices coming in are compressed, so the index arrays fully describe the pattern
+    const int* outer = A.outerIndexPtr();
+    for (int x = 0; x <= A.outerSize(); x++)
+        if (outer[x] != _outerIndices[x])
+            return false;
+
+    const int* inner = A.innerIndexPtr();
+    for (unsigned int x = 0; x < _innerIndices.size(); x++)
+        if (inner[x] != _innerIndices[x])
+            return false;
+
+    return true;
+}
+
+void CachedDirectSolver::cachePattern(const SPARSE_MATRIX& A) {
+    _rows = A.rows();
+    _outerIndices.assign(A.outerIndexPtr(), A.outerIndexPtr() + A.outerSize() + 1);
+    _innerIndices.assign(A.innerIndexPtr(), A.innerIndexPtr() + A.nonZeros());
+    _analyzed = true;
+}
+
+bool CachedDirectSolver::compute(const SPARSE_MATRIX& input) {
+    Timer functionTimer(__FUNCTION__);
+
+    // make sure the index arrays are the whole story
+    SPARSE_MATRIX compressed;
+    const SPARSE_MATRIX* A = &input;
+    if (!input.isCompressed()) {
+        compressed = input;
+        compressed.makeCompressed();
+        A = &compressed;
+    }
+
+    _lastWasSymbolic = !samePattern(*A);
+    if (_lastWasSymbolic) {
+        Timer symbolicTimer("Symbolic factorization");
+        if (_type == SIMPLICIAL_LDLT)
+            _ldlt.analyzePattern(*A);
+        else
+            _llt.analyzePattern(*A);
+        cachePattern(*A);
+        _totalSymbolic++;
+    }
+
+    Timer numericTimer("Numeric factorization");
+    Eigen::ComputationInfo info;
+    if (_type == SIMPLICIAL_LDLT) {
+        _ldlt.factorize(*A);
+        info = _ldlt.info();
+    } else {
+        _llt.factorize(*A);
+        info = _llt.info();
+    }
+    _totalNumeric++;
+
+    if (info != Eigen::Success) {
+        RYAO_ERROR("{} factorization failed!", name());
+        reset();
+        return false;
+    }
+    return true;
+}
+
+VECTOR CachedDirectSolver::solve(const VECTOR& b) const {
+    if (_type == SIMPLICIAL_LDLT)
+        return _ldlt.solve(b);
+    return _llt.solve(b);
+}
+
+}
+}
@@ -0,0 +1,243 @@
+#include "PersistentSystemMatrix.h"
+#include "Platform/include/Logger.h"
+#include "Platform/include/Timer.h"
+#include <algorithm>
+
+namespace Ryao {
+namespace SOLVER {
+using namespace std;
+
+void CollisionHessians::multiplyAdd(const VECTOR& x, const REAL scale, VECTOR& y) const {
+    // collisions share vertices, so this stays serial. There are only ever a handful of them.
+    VECTOR12 local;
+    for (unsigned int i = 0; i < hessians.size(); i++) {
+        const VECTOR4I& v = vertices[i];
+        for (int j = 0; j < 4; j++)
+            local.segment<3>(3 * j) = x.segment<3>(3 * v[j]);
+        local = scale * (hessians[i] * local);
+        for (int j = 0; j < 4; j++)
+            y.segment<3>(3 * v[j]) += local.segment<3>(3 * j);
+    }
+}
+
+void CollisionHessians::addDiagonalBlocks(const REAL scale, vector<MATRIX3>& blocks) const {
+    for (unsigned int i = 0; i < hessians.size(); i++)
+        for (int j = 0; j < 4; j++)
+            blocks[vertices[i][j]] += scale * hessians[i].block<3, 3>(3 * j, 3 * j);
+}
+
+PersistentSystemMatrix::PersistentSystemMatrix() :
+    _elasticSource(NULL), _elasticBlocks(-1), _elasticUpperOnly(false),
+    _slackOverflows(0), _repatterns(0) {
+}
+
+void PersistentSystemMatrix::reset() {
+    _slack.clear();
+    _elasticSource = NULL;
+}
+
+void PersistentSystemMatrix::setPattern(const BlockSparseMatrix& elastic) {
+    Timer functionTimer(__FUNCTION__);
+    _repatterns++;
+
+    // the union of the elastic blocks, mirrored if they are only stored
+    // in the upper triangle, and the collision slack
+    vector<pair<int, int> > blockPairs;
+    const vector<int>& rowStarts = elastic.rowStarts();
+    const vector<int>& columns = elastic.columns();
+    for (int i = 0; i < elastic.blockRows(); i++)
+        for (int k = rowStarts[i]; k < rowStarts[i + 1]; k++) {
+            blockPairs.push_back(make_pair(i, columns[k]));
+            if (elastic.upperOnly() && columns[k] != i)
+                blockPairs.push_back(make_pair(columns[k], i));
+        }
+    blockPairs.insert(blockPairs.end(), _slack.begin(), _slack.end());
+    sort(blockPairs.begin(), blockPairs.end());
+    blockPairs.erase(unique(blockPairs.begin(), blockPairs.end()), blockPairs.end());
+
+    // bake out the sparsity, every block is dense
+    typedef Eigen::Triplet<REAL> TRIPLET;
+    vector<TRIPLET> triplets;
+    triplets.reserve(9 * blockPairs.size());
+    for (unsigned int x = 0; x < blockPairs.size(); x++)
+        for (int b = 0; b < 3; b++)
+            for (int a = 0; a < 3; a++)
+                triplets.push_back(TRIPLET(3 * blockPairs[x].first + a, 3 * blockPairs[x].second + b, 0.0));
+
+    const int DOFs = elastic.rows();
+    _matrix = SPARSE_MATRIX(DOFs, DOFs);
+    _matrix.setFromTriplets(triplets.begin(), triplets.end());
+    _matrix.makeCompressed();
+
+    // find where each block lives, both here and in the elastic blocks
+    _blocks.resize(blockPairs.size());
+    _diagonalBlocks.assign(elastic.blockRows(), -1);
+    for (unsigned int x = 0; x < blockPairs.size(); x++) {
+        BlockEntry& entry = _blocks[x];
+        entry.row = blockPairs[x].first;
+        entry.col = blockPairs[x].second;
+        for (int b = 0; b < 3; b++)
+            entry.slots[b] = slot(3 * entry.row, 3 * entry.col + b);
+
+        entry.elasticTransposed = elastic.upperOnly() && entry.row > entry.col;
+        entry.elastic = entry.elasticTransposed ? elastic.blockIndex(entry.col, entry.row)
+                                                : elastic.blockIndex(entry.row, entry.col);
+        if (entry.row == entry.col)
+            _diagonalBlocks[entry.row] = x;
+    }
+
+    _elasticSource = &elastic;
+    _elasticBlocks = elastic.nonZeroBlocks();
+    _elasticUpperOnly = elastic.upperOnly();
+}
+
+int PersistentSystemMatrix::slot(const int row, const int col) const {
+    const int* inner = _matrix.innerIndexPtr();
+    const int* begin = inner + _matrix.outerIndexPtr()[col];
+    const int* end   = inner + _matrix.outerIndexPtr()[col + 1];
+    const int* found = lower_bound(begin, end, row);
+    if (found == end || *found != row)
+        return -1;
+    return (int)(found - inner);
+}
+
+bool PersistentSystemMatrix::scatter(const SPARSE_MATRIX& A, const REAL scale) {
+    REAL* values = _matrix.valuePtr();
+    int missing = 0;
+
+    // each column only writes into the same column here, so there are no conflicts
+#pragma omp parallel for schedule(static) reduction(+:missing)
+    for (int col = 0; col < A.outerSize(); col++)
+        for (SPARSE_MATRIX::InnerIterator it(A, col); it; ++it) {
+            const int index = slot(it.row(), col);
+            if (index < 0) {
+                missing++;
+                continue;
+            }
+            values[index] += scale * it.value();
+        }
+    return missing == 0;
+}
+
+bool PersistentSystemMatrix::stamp(const CollisionHessians& collisions, const REAL scale) {
+    REAL* values = _matrix.valuePtr();
+    int missing = 0;
+
+    // collisions share vertices, so this stays serial, same as CollisionHessians::multiplyAdd()
+    for (int i = 0; i < collisions.size(); i++) {
+        const VECTOR4I& v = collisions.vertices[i];
+        const MATRIX12& H = collisions.hessians[i];
+        for (int y = 0; y < 4; y++)
+            for (int x = 0; x < 4; x++) {
+                // the rows of a block column are contiguous, so only its top needs to be found
+                for (int b = 0; b < 3; b++) {
+                    const int index = slot(3 * v[x], 3 * v[y] + b);
+                    if (index < 0) {
+                        missing++;
+                        continue;
+                    }
+                    for (int a = 0; a < 3; a++)
+                        values[index + a] += scale * H(3 * x + a, 3 * y + b);
+                }
+            }
+    }
+    return missing == 0;
+}
+
+void PersistentSystemMatrix::growSlack(const CollisionHessians& collisions) {
+    for (int i = 0; i < collisions.size(); i++)
+        for (int y = 0; y < 4; y++)
+            for (int x = 0; x < 4; x++)
+                if (slot(3 * collisions.vertices[i][x], 3 * collisions.vertices[i][y]) < 0)
+                    _slack.insert(make_pair(collisions.vertices[i][x], collisions.vertices[i][y]));
+}
+
+void PersistentSystemMatrix::growSlack(const SPARSE_MATRIX& A) {
+    for (int col = 0; col < A.outerSize(); col++)
+        for (SPARSE_MATRIX::InnerIterator it(A, col); it; ++it)
+            if (slot(it.row(), col) < 0)
+                _slack.insert(make_pair((int)it.row() / 3, col / 3));
+}
+
+void PersistentSystemMatrix::assemble(const SPARSE_MATRIX& M, const BlockSparseMatrix& elastic, const SPARSE_MATRIX& C,
+                                      const SPARSE_MATRIX& K, const CollisionHessians& collisionK,
+                                      const CollisionHessians& collisionC,
+                                      const BlockSparseMatrix& S, const REAL dt) {
+    Timer functionTimer(__FUNCTION__);
+
+    // if the elastic blocks got re-patterned underneath us, so do we
+    if (_elasticSource != &elastic || _elasticBlocks != elastic.nonZeroBlocks() ||
+        _elasticUpperOnly != elastic.upperOnly())
+        setPattern(elastic);
+
+    REAL* values = _matrix.valuePtr();
+    const REAL dtSquared = dt * dt;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        // stomp every block with its elastic part, so nothing needs to be zeroed first
+        const int totalBlocks = _blocks.size();
+#pragma omp parallel for schedule(static)
+        for (int x = 0; x < totalBlocks; x++) {
+            const BlockEntry& entry = _blocks[x];
+            MATRIX3 B = MATRIX3::Zero();
+            if (entry.elastic >= 0)
+                B = entry.elasticTransposed ? MATRIX3(-dtSquared * elastic.block(entry.elastic).transpose())
+                                            : MATRIX3(-dtSquared * elastic.block(entry.elastic));
+            for (int b = 0; b < 3; b++)
+                for (int a = 0; a < 3; a++)
+                    values[entry.slots[b] + a] = B(a, b);
+        }
+
+        // add the rest
+        if (scatter(M, 1.0) && scatter(C, -dt) && scatter(K, -dtSquared) &&
+            stamp(collisionK, -dtSquared) && stamp(collisionC, -dt))
+            break;
+
+        // the collisions landed outside the slack, so grow it and try again
+        _slackOverflows++;
+        growSlack(M);
+        growSlack(C);
+        growSlack(K);
+        growSlack(collisionK);
+        growSlack(collisionC);
+        setPattern(elastic);
+        values = _matrix.valuePtr();
+    }
+
+    // apply the constraint filter in place, only the blocks touching
+    // a filtered vertex need to be visited
+    const int totalVertices = _diagonalBlocks.size();
+    _filtered.resize(totalVertices);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < totalVertices; i++) {
+        const int index = S.blockIndex(i, i);
+        _filtered[i] = (index >= 0) && !S.block(index).isIdentity(0.0);
+    }
+
+    const int totalBlocks = _blocks.size();
+#pragma omp parallel for schedule(static)
+    for (int x = 0; x < totalBlocks; x++) {
+        const BlockEntry& entry = _blocks[x];
+        if (!_filtered[entry.row] && !_filtered[entry.col])
+            continue;
+
+        MATRIX3 B;
+        for (int b = 0; b < 3; b++)
+            for (int a = 0; a < 3; a++)
+                B(a, b) = values[entry.slots[b] + a];
+
+        const int rowIndex = S.blockIndex(entry.row, entry.row);
+        const int colIndex = S.blockIndex(entry.col, entry.col);
+        const MATRIX3 Si = (rowIndex >= 0) ? S.block(rowIndex) : MATRIX3::Identity();
+        const MATRIX3 Sj = (colIndex >= 0) ? S.block(colIndex) : MATRIX3::Identity();
+        B = Si * B * Sj;
+        if (entry.row == entry.col)
+            B += MATRIX3::Identity() - Si;
+
+        for (int b = 0; b < 3; b++)
+            for (int a = 0; a < 3; a++)
+                values[entry.slots[b] + a] = B(a, b);
+    }
+}
+
+}
+}
@@ -0,0 +1,303 @@
+#include "ProjectiveDynamics.h"
+
+namespace Ryao {
+namespace SOLVER {
+using namespace std;
+
+// F = sum_j x_j c_j^T, where x_j are the tet vertices. This is G_t, spelled out.
+static void gradientCoefficients(const MATRIX3& DmInv, VECTOR3 c[4]) {
+    c[1] = DmInv.row(0).transpose();
+    c[2] = DmInv.row(1).transpose();
+    c[3] = DmInv.row(2).transpose();
+    c[0] = -(c[1] + c[2] + c[3]);
+}
+
+ProjectiveDynamics::ProjectiveDynamics(TET_Mesh_Faster& tetMesh, VOLUME::HYPERELASTIC& hyperelastic) :
+    SOLVER(tetMesh, hyperelastic) {
+    _dt = 1.0 / 60;
+
+    _time = 0.0;
+    _currentTimestep = 0;
+
+    _iterations = 10;
+    _constraintStiffness = 1000.0;
+
+    // entry (1, 1) of the rest Hessian is d^2 Psi / d F(1,0)^2, since F is flattened column-wise.
+    // F(1,0) is a pure shear, which doesn't change the volume to first order, so only the shear
+    // term of an isotropic material contributes there, and the entry is the shear modulus mu.
+    // ARAP's mu * ||F - R||^2 has the same mu there.
+    _arapStiffness = _hyperelastic.hessian(MATRIX3::Identity())(1, 1);
+
+    const vector<VECTOR3>& restVertices = _tetMesh.restVertices();
+    _restPositions.resize(_DOFs);
+    for (unsigned int x = 0; x < restVertices.size(); x++)
+        _restPositions.segment<3>(3 * x) = restVertices[x];
+
+    _globalDirty = true;
+    _globalFactored = false;
+
+    _name = string("Projective Dynamics Solver");
+}
+
+void ProjectiveDynamics::setDt(const REAL dt) {
+    _dt = dt;
+    _globalDirty = true;
+}
+
+void ProjectiveDynamics::setArapStiffness(const REAL stiffness) {
+    _arapStiffness = stiffness;
+    _globalDirty = true;
+}
+
+void ProjectiveDynamics::setConstraintStiffness(const REAL stiffness) {
+    _constraintStiffness = stiffness;
+    _globalDirty = true;
+}
+
+void ProjectiveDynamics::updateConstraintTargets() {
+    Timer functionTimer(__FUNCTION__);
+    _constraintTargets.setZero();
+    for (unsigned int x = 0; x < _planeConstraints.size(); x++) {
+        // should ignore if we've tagged it for deletion
+        if (_planeConstraints[x].isSeparating)
+            continue;
+
+        const PLANE_CONSTRAINT& constraint = _planeConstraints[x];
+        const VECTOR3 closestPoint = constraint.shape->localVertexToWorld(constraint.localClosestPoint);
+        _constraintTargets.segment<3>(3 * constraint.vertexID) = closestPoint;
+    }
+}
+
+void ProjectiveDynamics::buildGlobalMatrix() {
+    Timer functionTimer(__FUNCTION__);
+    const vector<VECTOR4I>& tets = _tetMesh.tets();
+    const MATRIX3_SOA& DmInvs = _tetMesh.DmInvs();
+    const vector<REAL>& volumes = _tetMesh.restTetVolumes();
+
+    typedef Eigen::Triplet<REAL> TRIPLET;
+    vector<TRIPLET> triplets;
+    triplets.reserve(_DOFs + 48 * tets.size());
+
+    // the inertia term, the mass matrix is diagonal
+    const REAL invDtSquared = 1.0 / (_dt * _dt);
+    for (int x = 0; x < _DOFs; x++)
+        triplets.push_back(TRIPLET(x, x, invDtSquared * _M.coeff(x, x)));
+
+    // the ARAP terms, G_t^T G_t is c_i . c_j times the identity for each vertex pair
+    _tetWeights.resize(tets.size());
+    for (unsigned int t = 0; t < tets.size(); t++) {
+        _tetWeights[t] = 2.0 * _arapStiffness * volumes[t];
+
+        VECTOR3 c[4];
+        gradientCoefficients(DmInvs[t], c);
+        for (int j = 0; j < 4; j++)
+            for (int i = 0; i < 4; i++) {
+                const REAL entry = _tetWeights[t] * c[i].dot(c[j]);
+                for (int a = 0; a < 3; a++)
+                    triplets.push_back(TRIPLET(3 * tets[t][i] + a, 3 * tets[t][j] + a, entry));
+            }
+    }
+
+    _globalBase = SPARSE_MATRIX(_DOFs, _DOFs);
+    _globalBase.setFromTriplets(triplets.begin(), triplets.end());
+    _globalBase.makeCompressed();
+
+    // force a refactorization
+    _factorizedWeights.resize(0);
+    _globalDirty = false;
+}
+
+VECTOR ProjectiveDynamics::computeConstraintWeights() const {
+    const vector<REAL>& masses = _tetMesh.restOneRingVolumes();
+    const REAL scale = _constraintStiffness / (_dt * _dt);
+
+    VECTOR weights = VECTOR::Zero(_DOFs / 3);
+    for (unsigned int x = 0; x < _kinematicConstraints.size(); x++) {
+        const int vertexID = _kinematicConstraints[x].vertexID;
+        weights[vertexID] += scale * masses[vertexID];
+    }
+    for (unsigned int x = 0; x < _planeConstraints.size(); x++) {
+        if (_planeConstraints[x].isSeparating)
+            continue;
+        const int vertexID = _planeConstraints[x].vertexID;
+        weights[vertexID] += scale * masses[vertexID];
+    }
+    return weights;
+}
+
+void ProjectiveDynamics::factorGlobalMatrix(const VECTOR& constraintWeights, const bool verbose) {
+    if (_factorizedWeights.size() == constraintWeights.size() && _factorizedWeights == constraintWeights)
+        return;
+
+    Timer functionTimer(__FUNCTION__);
+
+    // the diagonal is always in the pattern, so only the numeric factorization gets redone
+    _global = _globalBase;
+    for (int x = 0; x < constraintWeights.size(); x++) {
+        if (constraintWeights[x] == 0.0)
+            continue;
+        for (int a = 0; a < 3; a++)
+            _global.coeffRef(3 * x + a, 3 * x + a) += constraintWeights[x];
+    }
+
+    // the global matrix is SPD, so if the factorization still fails, CG can solve it instead
+    _globalFactored = _directSolver.compute(_global);
+    if (!_globalFactored) {
+        RYAO_WARN("{} factorization of the global matrix failed, falling back to PCG", _directSolver.name());
+        _cgSolver.compute(_global);
+    }
+    _factorizedWeights = constraintWeights;
+
+    if (verbose)
+        RYAO_INFO("Refactorized the global matrix, symbolic/numeric factorizations so far: {}/{}",
+                  _directSolver.totalSymbolicFactorizations(), _directSolver.totalNumericFactorizations());
+}
+
+void ProjectiveDynamics::addLocalProjections(VECTOR& rhs) {
+    Timer functionTimer(__FUNCTION__);
+    const vector<VECTOR4I>& tets = _tetMesh.tets();
+    const MATRIX3_SOA& DmInvs = _tetMesh.DmInvs();
+    const MATRIX3_SOA& Fs = _tetMesh.Fs();
+
+    // the local step, every tet is independent
+    const int totalTets = tets.size();
+    _rotations.resize(totalTets);
+#pragma omp parallel for schedule(static)
+    for (int t = 0; t < totalTets; t++) {
+        MATRIX3 R, S;
+        polarDecomposition(Fs[t], R, S);
+        _rotations[t] = R;
+    }
+
+    // gather w_t G_t^T R_t, each vertex pulls from its own tets
+    const vector<int>& vertexTetStarts = _tetMesh.vertexTetStarts();
+    const vector<int>& vertexTets = _tetMesh.vertexTets();
+    const int totalVertices = _DOFs / 3;
+#pragma omp parallel for schedule(static)
+    for (int x = 0; x < totalVertices; x++) {
+        VECTOR3 sum = VECTOR3::Zero();
+        for (int y = vertexTetStarts[x]; y < vertexTetStarts[x + 1]; y++) {
+            const int t = vertexTets[y] / 4;
+            VECTOR3 c[4];
+            gradientCoefficients(DmInvs[t], c);
+            sum += _tetWeights[t] * (_rotations[t] * c[vertexTets[y] % 4]);
+        }
+        rhs.segment<3>(3 * x) += sum;
+    }
+}
+
+void ProjectiveDynamics::addConstraintProjections(const VECTOR& positions, VECTOR& rhs) const {
+    const vector<REAL>& masses = _tetMesh.restOneRingVolumes();
+    const REAL scale = _constraintStiffness / (_dt * _dt);
+
+    // kinematic constraints project onto the point they're attached to
+    for (unsigned int x = 0; x < _kinematicConstraints.size(); x++) {
+        const KINEMATIC_CONSTRAINT& constraint = _kinematicConstraints[x];
+        const int vertexID = constraint.vertexID;
+        const VECTOR3 target = constraint.shape->localVertexToWorld(constraint.localPosition);
+        rhs.segment<3>(3 * vertexID) += scale * masses[vertexID] * target;
+    }
+
+    // plane constraints project out of the plane, but are free to slide along it
+    for (unsigned int x = 0; x < _planeConstraints.size(); x++) {
+        const PLANE_CONSTRAINT& constraint = _planeConstraints[x];
+        if (constraint.isSeparating)
+            continue;
+
+        const int vertexID = constraint.vertexID;
+        const VECTOR3 vertex = positions.segment<3>(3 * vertexID);
+        const VECTOR3 closestPoint = _constraintTargets.segment<3>(3 * vertexID);
+        const VECTOR3 normal = constraint.shape->localNormalToWorld(constraint.localNormal);
+
+        const REAL depth = (vertex - closestPoint).dot(normal);
+        const VECTOR3 target = (depth < 0.0) ? VECTOR3(vertex - depth * normal) : vertex;
+        rhs.segment<3>(3 * vertexID) += scale * masses[vertexID] * target;
+    }
+}
+
+VECTOR ProjectiveDynamics::computeCollisionForces() {
+    VECTOR forces = VECTOR::Zero(_DOFs);
+    if (!_vertexFaceSelfCollisionsOn && !_edgeEdgeSelfCollisionsOn)
+        return forces;
+
+    computeCollisionDetection();
+    _tetMesh.setCollisionStiffness(_collisionStiffness);
+    if (_vertexFaceSelfCollisionsOn)
+        forces += _tetMesh.computeVertexFaceCollisionForces();
+    if (_edgeEdgeSelfCollisionsOn)
+        forces += _tetMesh.computeEdgeEdgeCollisionForces();
+    return forces;
+}
+
+bool ProjectiveDynamics::solve(const bool verbose) {
+    Timer functionTimer(__FUNCTION__);
+    if (verbose) {
+        RYAO_INFO("==================================================");
+        RYAO_INFO(" PROJECTIVE DYNAMICS SOLVE {}", _currentTimestep);
+        RYAO_INFO("==================================================");
+    }
+
+    // only caching this for visualization purposes
+    _positionOld = _position;
+
+    // should need to call once, but then preserved throughout
+    applyKinematicConstraints();
+
+    // build new constraints, and see where their planes are
+    _tetMesh.setDisplacement(_position);
+    findNewSurfaceConstraints(verbose);
+    updateConstraintTargets();
+
+    // self-collisions are explicit, since they would change the global matrix
+    const VECTOR collisionForces = computeCollisionForces();
+
+    // the global matrix only gets refactorized if the constraints changed
+    if (_globalDirty)
+        buildGlobalMatrix();
+    const VECTOR constraintWeights = computeConstraintWeights();
+    factorGlobalMatrix(constraintWeights, verbose);
+
+    // the inertia and external force terms of the RHS are fixed across iterations
+    const VECTOR positionsOld = _restPositions + _position;
+    const VECTOR inertial = positionsOld + _dt * _velocity;
+    const VECTOR rhsFixed = (1.0 / (_dt * _dt)) * (_M * inertial) + _externalForces + collisionForces;
+
+    // start from the inertial prediction
+    VECTOR positions = inertial;
+    for (int i = 0; i < _iterations; i++) {
+        _tetMesh.setDisplacement(positions - _restPositions);
+        _tetMesh.computeFs();
+
+        VECTOR rhs = rhsFixed;
+        addLocalProjections(rhs);
+        addConstraintProjections(positions, rhs);
+
+        Timer globalTimer("PD global solve");
+        if (_globalFactored)
+            positions = _directSolver.solve(rhs);
+        else {
+            positions = _cgSolver.solveWithGuess(rhs, positions);
+            recordPCGIterations((int)_cgSolver.iterations());
+        }
+    }
+
+    // update position and velocity
+    _position = positions - _restPositions;
+    _velocity = (_position - _positionOld) / _dt;
+    _tetMesh.setDisplacement(_position);
+
+    // let go of the constraints that are outside, or moving away
+    if (findSeparatingSurfaceConstraints(_velocity))
+        deleteSurfaceConstraints(verbose);
+    updateSurfaceConstraints();
+    updateConstraintTargets();
+
+    // record which timestep we're on
+    _time += _dt;
+    _currentTimestep++;
+
+    return true;
+}
+
+}
+}
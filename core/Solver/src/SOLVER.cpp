@@ -38,12 +38,19 @@ void SOLVER::initialize() {
     _velocity.resize(_DOFs);
     _temp.resize(_DOFs);
     _solution.resize(_DOFs);
+    _solutionOld.resize(_DOFs);
 
     _position.setZero();
     _positionOld.setZero();
     _velocity.setZero();
     _temp.setZero();
     _solution.setZero();
+    _solutionOld.setZero();
+
+    _warmStart = COLD_START;
+    _warmStartResidual = 1.0;
+    _totalPCGIterations = 0;
+    _totalPCGSolves = 0;
 
     _name = string("UNKNOWN");
 
@@ -52,10 +59,24 @@ void SOLVER::initialize() {
     _collisionStiffness         = 1.0;
     _collisionDampingBeta       = 0.001;
 
+    // float builds default to matrix-free PCG, since it's the one
+    // that accumulates its dot products in REAL_ACCUMULATE
+    _matrixFreePCG = (RYAO_SINGLE_PRECISION != 0);
+    _directSolve = false;
+    _blockSparse = false;
+    _symmetricBlockStorage = false;
+    _elasticBlocks = NULL;
+    _persistentSystem = false;
+    _fusedElasticPass = true;
+
     _dt = 1.0 / 30.0;
 
     // build the mass matrix once and for all
     _M = buildMassMatrix();
+
+    // the rest-state operators get built the first time they are needed
+    _restStiffnessCached = false;
+    _rayleighDampingCached = false;
 }
 
 void SOLVER::applyKinematicConstraints() {
@@ -117,6 +138,10 @@ void SOLVER::buildConstraintMatrix() {
 
     // store the complement
     _IminusS = I - _S;
+
+    // S only ever has 3x3 blocks on the diagonal
+    if (_blockSparse || _persistentSystem)
+        _SBlocks = BlockSparseMatrix::fromSparseMatrix(_S);
 }
 
 SPARSE_MATRIX SOLVER::buildMassMatrix() {
@@ -140,10 +165,9 @@ SPARSE_MATRIX SOLVER::buildMassMatrix() {
     return A;
 }
 
-// maybe we can optimize this function
-// we do not need to call this function every step
-// TODO: optimize this function
-SPARSE_MATRIX SOLVER::buildRayleighDampingMatrix() {
+SPARSE_MATRIX SOLVER::buildRestStiffnessMatrix() {
+    Timer functionTimer(__FUNCTION__);
+
     // back up current state
     _temp = _tetMesh.getDisplacement();
 
@@ -154,15 +178,31 @@ SPARSE_MATRIX SOLVER::buildRayleighDampingMatrix() {
 
     // get stiffness matrix at that state
     _tetMesh.computeFs();
-    _tetMesh.computeSVDs();
+    if (hyperelasticNeedsSVDs())
+        _tetMesh.computeSVDs();
     SPARSE_MATRIX K = _tetMesh.computeHyperelasticClampedHessian(_hyperelastic);
 
     // restore state
     _tetMesh.setDisplacement(_temp);
 
+    return K;
+}
+
+const SPARSE_MATRIX& SOLVER::buildRayleighDampingMatrix() {
+    // the rest pose never changes, so the stiffness there only
+    // needs to be recomputed if the material did
+    if (!_restStiffnessCached) {
+        _restStiffness = buildRestStiffnessMatrix();
+        _restStiffnessCached = true;
+        _rayleighDampingCached = false;
+    }
+
     // build out the Rayleigh damping
-    SPARSE_MATRIX C = _rayleighAlpha * _M + _rayleighBeta * K;
-    return C;
+    if (!_rayleighDampingCached) {
+        _rayleighDamping = _rayleighAlpha * _M + _rayleighBeta * _restStiffness;
+        _rayleighDampingCached = true;
+    }
+    return _rayleighDamping;
 }
 
 static void printEntry(const VECTOR& v, const int i, const string& varname) {
@@ -443,15 +483,14 @@ const VECTOR3 SOLVER::velocity(unsigned int index) const {
 void SOLVER::setRayeligh(const REAL alpha, const REAL beta) {
     _rayleighAlpha = alpha;
     _rayleighBeta = beta;
+    _rayleighDampingCached = false;
 }
 
 void SOLVER::computeCollisionDetection() {
     Timer functionTimer(__FUNCTION__);
 
-    // if the tet mesh has an AABB accelerator, refit it
-//    auto fast = dynamic_cast<TET_Mesh_Faster*>(&_tetMesh);
-//    if (_tetMesh != NULL)
-    _tetMesh.refitAABB();
+    // the collision detection refits the AABB trees itself, and only when it
+    // can't reuse the candidates it found before
 
     // do the collision processing
     const REAL invDt = 1.0 / _dt;
@@ -467,9 +506,16 @@ void SOLVER::computeCollisionDetection() {
         _tetMesh.computeEdgeEdgeCollisions();
 }
 
-void SOLVER::computeCollisionResponse(VECTOR& R, SPARSE_MATRIX& K, SPARSE_MATRIX& collisionC, const bool verbose) {
+void SOLVER::computeCollisionResponse(VECTOR& R, SPARSE_MATRIX& K, SPARSE_MATRIX* collisionC, const bool verbose) {
     Timer functionTimer(__FUNCTION__);
 
+    if (_persistentSystem) {
+        computeCollisionHessians(R, collisionC);
+        return;
+    }
+    _collisionHessians.clear();
+    _collisionDampingHessians.clear();
+
     // build the collision forces and Hessians
     const int rank = R.size();
     VECTOR collisionForces(rank);
@@ -477,7 +523,8 @@ void SOLVER::computeCollisionResponse(VECTOR& R, SPARSE_MATRIX& K, SPARSE_MATRIX
 
     collisionForces.setZero();
     collisionK.setZero();
-    collisionC.setZero();
+    if (collisionC != NULL)
+        collisionC->setZero();
 
     const REAL dampingBeta = _collisionDampingBeta;
     _tetMesh.setCollisionStiffness(_collisionStiffness);
@@ -492,7 +539,8 @@ void SOLVER::computeCollisionResponse(VECTOR& R, SPARSE_MATRIX& K, SPARSE_MATRIX
 
         collisionForces += forcesVF;
         collisionK += hessianVF;
-        collisionC += dampingBeta * hessianVF;
+        if (collisionC != NULL)
+            *collisionC += dampingBeta * hessianVF;
     }
 
     // edge-edge case
@@ -505,7 +553,8 @@ void SOLVER::computeCollisionResponse(VECTOR& R, SPARSE_MATRIX& K, SPARSE_MATRIX
 
         collisionForces += forcesEE;
         collisionK += hessianEE;
-        collisionC += dampingBeta * hessianEE;
+        if (collisionC != NULL)
+            *collisionC += dampingBeta * hessianEE;
     }
 
     // add self-collisions to both LHS and RHS
@@ -515,5 +564,227 @@ void SOLVER::computeCollisionResponse(VECTOR& R, SPARSE_MATRIX& K, SPARSE_MATRIX
     }
 }
 
+void SOLVER::computeCollisionHessians(VECTOR& R, SPARSE_MATRIX* collisionC) {
+    _tetMesh.setCollisionStiffness(_collisionStiffness);
+
+    // the forces go straight into R, and the Hessians into the per-collision arrays
+    _collisionHessians.clear();
+    if (_vertexFaceSelfCollisionsOn) {
+        _tetMesh.addVertexFaceCollisionForces(R);
+        _tetMesh.addVertexFaceCollisionClampedHessians(_collisionHessians.vertices, _collisionHessians.hessians);
+    }
+    if (_edgeEdgeSelfCollisionsOn) {
+        _tetMesh.addEdgeEdgeCollisionForces(R);
+        _tetMesh.addEdgeEdgeCollisionClampedHessians(_collisionHessians.vertices, _collisionHessians.hessians);
+    }
+
+    // same as the sparse version, C is replaced by the collision damping
+    if (collisionC == NULL)
+        return;
+    collisionC->setZero();
+
+    const REAL dampingBeta = _collisionDampingBeta;
+    const int totalCollisions = _collisionHessians.size();
+    _collisionDampingHessians.vertices = _collisionHessians.vertices;
+    _collisionDampingHessians.hessians.resize(totalCollisions);
+    for (int x = 0; x < totalCollisions; x++)
+        _collisionDampingHessians.hessians[x] = dampingBeta * _collisionHessians.hessians[x];
+}
+
+REAL SOLVER::computeCollisionEnergy() const {
+    REAL energy = 0.0;
+    if (_vertexFaceSelfCollisionsOn)
+        energy += _tetMesh.computeVertexFaceCollisionEnergy();
+    if (_edgeEdgeSelfCollisionsOn)
+        energy += _tetMesh.computeEdgeEdgeCollisionEnergy();
+    return energy;
+}
+
+SPARSE_MATRIX SOLVER::computeHyperelasticStiffness() {
+    if (!_blockSparse && !_persistentSystem) {
+        _elasticBlocks = NULL;
+        return _tetMesh.computeHyperelasticClampedHessian(_hyperelastic);
+    }
+
+    _elasticBlocks = &_tetMesh.computeHyperelasticClampedHessianBlocks(_hyperelastic, _symmetricBlockStorage);
+    return SPARSE_MATRIX(_DOFs, _DOFs);
+}
+
+bool SOLVER::hyperelasticNeedsSVDs() const {
+    return _hyperelastic.PK1NeedsSVD() || _hyperelastic.clampedHessianNeedsSVD();
+}
+
+void SOLVER::computeElasticForcesAndStiffness(VECTOR& R, SPARSE_MATRIX& K) {
+    if (!_fusedElasticPass) {
+        _tetMesh.computeFs();
+        if (hyperelasticNeedsSVDs())
+            _tetMesh.computeSVDs();
+        R = _tetMesh.computeHyperelasticForces(_hyperelastic);
+        K = computeHyperelasticStiffness();
+        return;
+    }
+
+    const bool blocks = _blockSparse || _persistentSystem;
+    R = _tetMesh.computeFusedElasticTerms(_hyperelastic, blocks, _symmetricBlockStorage);
+    if (!blocks) {
+        _elasticBlocks = NULL;
+        K = _tetMesh.hyperelasticClampedHessian();
+        return;
+    }
+
+    _elasticBlocks = &_tetMesh.hyperelasticClampedHessianBlocks();
+    K = SPARSE_MATRIX(_DOFs, _DOFs);
+}
+
+VECTOR SOLVER::applyStiffness(const SPARSE_MATRIX& K, const VECTOR& x) const {
+    VECTOR Kx = K * x;
+    if (_elasticBlocks != NULL)
+        Kx += (*_elasticBlocks) * x;
+    _collisionHessians.multiplyAdd(x, 1.0, Kx);
+    return Kx;
+}
+
+VECTOR SOLVER::applyDamping(const SPARSE_MATRIX& C, const VECTOR& x) const {
+    VECTOR Cx = C * x;
+    _collisionDampingHessians.multiplyAdd(x, 1.0, Cx);
+    return Cx;
+}
+
+VECTOR SOLVER::applyConstraintFilter(const VECTOR& x) const {
+    if (_blockSparse)
+        return _SBlocks * x;
+    return _S * x;
+}
+
+VECTOR SOLVER::applySystemMatrix(const SPARSE_MATRIX& C, const SPARSE_MATRIX& K, const VECTOR& x) const {
+    VECTOR Ax = _M * x;
+    Ax -= _dt * applyDamping(C, x);
+    Ax -= (_dt * _dt) * applyStiffness(K, x);
+    return Ax;
+}
+
+VECTOR SOLVER::applyProjectedSystemMatrix(const SPARSE_MATRIX& C, const SPARSE_MATRIX& K, const VECTOR& x) const {
+    const VECTOR Sx = applyConstraintFilter(x);
+    VECTOR LHSx = applyConstraintFilter(applySystemMatrix(C, K, Sx));
+    LHSx += x - Sx;
+    return LHSx;
+}
+
+void SOLVER::addDiagonalBlocks(const SPARSE_MATRIX& A, const REAL scale, vector<MATRIX3>& blocks) {
+    for (int col = 0; col < A.outerSize(); col++) {
+        const int block = col / 3;
+        for (SPARSE_MATRIX::InnerIterator it(A, col); it; ++it) {
+            if (it.row() / 3 != block)
+                continue;
+            blocks[block](it.row() % 3, col % 3) += scale * it.value();
+        }
+    }
+}
+
+VECTOR SOLVER::warmStartGuess() const {
+    switch (_warmStart) {
+        case PREVIOUS_DELTA:
+            return applyConstraintFilter(_solution);
+        case EXTRAPOLATED_DELTA:
+            return applyConstraintFilter(2.0 * _solution - _solutionOld);
+        default:
+            break;
+    }
+    VECTOR guess(_DOFs);
+    guess.setZero();
+    return guess;
+}
+
+void SOLVER::recordPCGIterations(const int iterations) {
+    _seenPCGIterations = iterations;
+    _totalPCGIterations += iterations;
+    _totalPCGSolves++;
+}
+
+REAL SOLVER::averagePCGIterations() const {
+    if (_totalPCGSolves == 0)
+        return 0.0;
+    return (REAL)_totalPCGIterations / _totalPCGSolves;
+}
+
+VECTOR SOLVER::solveMatrixFreePPCG(const SPARSE_MATRIX& C, const SPARSE_MATRIX& K, const VECTOR& rhs,
+                                   const VECTOR& guess, const bool verbose) {
+    Timer functionTimer(__FUNCTION__);
+
+    // the preconditioner needs the diagonal blocks of S * A * S + (I - S). S is
+    // block diagonal, so only the diagonal blocks of A and S are needed for it.
+    const int totalBlocks = _DOFs / 3;
+    vector<MATRIX3> ABlocks(totalBlocks, MATRIX3::Zero());
+    vector<MATRIX3> SBlocks(totalBlocks, MATRIX3::Zero());
+    addDiagonalBlocks(_M, 1.0, ABlocks);
+    addDiagonalBlocks(C, -_dt, ABlocks);
+    addDiagonalBlocks(K, -_dt * _dt, ABlocks);
+    if (_elasticBlocks != NULL)
+        _elasticBlocks->addDiagonalBlocks(-_dt * _dt, ABlocks);
+    _collisionHessians.addDiagonalBlocks(-_dt * _dt, ABlocks);
+    _collisionDampingHessians.addDiagonalBlocks(-_dt, ABlocks);
+    addDiagonalBlocks(_S, 1.0, SBlocks);
+
+    vector<MATRIX3> LHSBlocks(totalBlocks);
+#pragma omp parallel for schedule(static)
+    for (int x = 0; x < totalBlocks; x++)
+        LHSBlocks[x] = SBlocks[x] * ABlocks[x] * SBlocks[x] + MATRIX3::Identity() - SBlocks[x];
+
+    BlockPreconditioner preconditioner;
+    preconditioner.setType(_cgSolver.preconditioner().type());
+    preconditioner.computeFromDiagonalBlocks(LHSBlocks);
+
+    // same stopping criteria as Eigen::ConjugateGradient, so both paths agree
+    const REAL tolerance = _cgSolver.tolerance();
+    const int maxIterations = 2 * _DOFs;
+
+    VECTOR y = guess;
+    const REAL_ACCUMULATE rhsNorm2 = accumulatedDot(rhs, rhs);
+    if (rhsNorm2 == 0.0) {
+        y.setZero();
+        _warmStartResidual = 1.0;
+        recordPCGIterations(0);
+        return y;
+    }
+    const REAL_ACCUMULATE threshold = std::max(tolerance * tolerance * rhsNorm2,
+                                               (REAL_ACCUMULATE)(std::numeric_limits<REAL>::min)());
+
+    VECTOR residual = rhs - applyProjectedSystemMatrix(C, K, y);
+    REAL_ACCUMULATE residualNorm2 = accumulatedDot(residual, residual);
+    _warmStartResidual = std::sqrt(residualNorm2 / rhsNorm2);
+    VECTOR direction = preconditioner.solve(residual);
+    REAL_ACCUMULATE deltaNew = accumulatedDot(residual, direction);
+
+    int iterations = 0;
+    while (residualNorm2 >= threshold && iterations < maxIterations) {
+        const VECTOR q = applyProjectedSystemMatrix(C, K, direction);
+        const REAL alpha = deltaNew / accumulatedDot(direction, q);
+        y += alpha * direction;
+        residual -= alpha * q;
+        residualNorm2 = accumulatedDot(residual, residual);
+        iterations++;
+        if (residualNorm2 < threshold)
+            break;
+
+        const VECTOR s = preconditioner.solve(residual);
+        const REAL_ACCUMULATE deltaOld = deltaNew;
+        deltaNew = accumulatedDot(residual, s);
+        direction = s + (REAL)(deltaNew / deltaOld) * direction;
+    }
+    recordPCGIterations(iterations);
+
+    if (verbose) {
+        // the assembled path would have stored both A and S * A * S + (I - S),
+        // each of which has at least the sparsity of K
+        const int nonZeros = K.nonZeros() + ((_elasticBlocks != NULL) ? 9 * _elasticBlocks->nonZeroBlocks() : 0);
+        const REAL skippedMB = 2.0 * nonZeros * (sizeof(REAL) + sizeof(int)) / (1024.0 * 1024.0);
+        RYAO_INFO("Matrix-free PCG iters: {}, err: {}, preconditioner: {}", iterations,
+                  (float)std::sqrt(residualNorm2 / rhsNorm2), preconditioner.name());
+        RYAO_INFO("Matrix-free PCG skipped assembling ~{} MB of system matrices", (float)skippedMB);
+    }
+
+    return y;
+}
+
+}
 }
-}
\ No newline at end of file
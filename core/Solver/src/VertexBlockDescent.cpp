@@ -0,0 +1,224 @@
+#include "VertexBlockDescent.h"
+
+namespace Ryao {
+namespace SOLVER {
+using namespace std;
+
+VertexBlockDescent::VertexBlockDescent(TET_Mesh_Faster& tetMesh, VOLUME::HYPERELASTIC& hyperelastic) :
+    SOLVER(tetMesh, hyperelastic) {
+    _rayleighAlpha = 0.01;
+    _rayleighBeta = 0.01;
+
+    _dt = 1.0 / 60;
+
+    _time = 0.0;
+    _currentTimestep = 0;
+
+    _iterations = 20;
+
+    const vector<VECTOR3>& restVertices = _tetMesh.restVertices();
+    _restPositions.resize(_DOFs);
+    for (unsigned int x = 0; x < restVertices.size(); x++)
+        _restPositions.segment<3>(3 * x) = restVertices[x];
+
+    _colors = _tetMesh.computeVertexColors();
+    RYAO_INFO("Vertex block descent needs {} colors", _colors.size());
+
+    _name = string("Vertex Block Descent Solver");
+}
+
+void VertexBlockDescent::updateConstraintTargets() {
+    Timer functionTimer(__FUNCTION__);
+    _constraintTargets.setZero();
+    for (unsigned int x = 0; x < _planeConstraints.size(); x++) {
+        // should ignore if we've tagged it for deletion
+        if (_planeConstraints[x].isSeparating)
+            continue;
+
+        const PLANE_CONSTRAINT& constraint = _planeConstraints[x];
+        const VECTOR3 closestPoint = constraint.shape->localVertexToWorld(constraint.localClosestPoint);
+        _constraintTargets.segment<3>(3 * constraint.vertexID) = closestPoint;
+    }
+}
+
+void VertexBlockDescent::computeCollisionTerms() {
+    _collisionForces = VECTOR::Zero(_DOFs);
+    _collisionBlocks.assign(_DOFs / 3, MATRIX3::Zero());
+    if (!_vertexFaceSelfCollisionsOn && !_edgeEdgeSelfCollisionsOn)
+        return;
+
+    // the Hessians come back negated, same as the stiffness matrix
+    computeCollisionDetection();
+    _tetMesh.setCollisionStiffness(_collisionStiffness);
+    if (_vertexFaceSelfCollisionsOn) {
+        _collisionForces += _tetMesh.computeVertexFaceCollisionForces();
+        addDiagonalBlocks(_tetMesh.computeVertexFaceCollisionClampedHessian(), -1.0, _collisionBlocks);
+    }
+    if (_edgeEdgeSelfCollisionsOn) {
+        _collisionForces += _tetMesh.computeEdgeEdgeCollisionForces();
+        addDiagonalBlocks(_tetMesh.computeEdgeEdgeCollisionClampedHessian(), -1.0, _collisionBlocks);
+    }
+}
+
+void VertexBlockDescent::solveVertex(const int vertexID, const VECTOR& inertial, const VECTOR& positionsOld,
+                                     VECTOR& positions) const {
+    const vector<VECTOR4I>& tets = _tetMesh.tets();
+    const MATRIX3_SOA& DmInvs = _tetMesh.DmInvs();
+    const vector<REAL>& volumes = _tetMesh.restTetVolumes();
+    const vector<int>& vertexTetStarts = _tetMesh.vertexTetStarts();
+    const vector<int>& vertexTets = _tetMesh.vertexTets();
+    const REAL mass = _M.coeff(3 * vertexID, 3 * vertexID);
+    const REAL invDtSquared = 1.0 / (_dt * _dt);
+
+    const VECTOR3 vertex = positions.segment<3>(3 * vertexID);
+    const VECTOR3 displacement = vertex - positionsOld.segment<3>(3 * vertexID);
+
+    // the inertia term, and the mass-proportional part of the Rayleigh damping
+    VECTOR3 force = -mass * invDtSquared * (vertex - inertial.segment<3>(3 * vertexID))
+                    - _rayleighAlpha * mass / _dt * displacement;
+    MATRIX3 H = (mass * invDtSquared + _rayleighAlpha * mass / _dt) * MATRIX3::Identity();
+
+    // the collisions, linearized around the start of the timestep in this vertex only
+    const MATRIX3& collisionBlock = _collisionBlocks[vertexID];
+    force += _collisionForces.segment<3>(3 * vertexID) - collisionBlock * displacement;
+    H += collisionBlock;
+
+    // gather from the incident tets
+    for (int x = vertexTetStarts[vertexID]; x < vertexTetStarts[vertexID + 1]; x++) {
+        const int tetIndex = vertexTets[x] / 4;
+        const int which = vertexTets[x] % 4;
+        const VECTOR4I& tet = tets[tetIndex];
+        const MATRIX3& DmInv = DmInvs[tetIndex];
+
+        MATRIX3 Ds, DsOld;
+        for (int y = 0; y < 3; y++) {
+            Ds.col(y) = positions.segment<3>(3 * tet[y + 1]) - positions.segment<3>(3 * tet[0]);
+            DsOld.col(y) = positionsOld.segment<3>(3 * tet[y + 1]) - positionsOld.segment<3>(3 * tet[0]);
+        }
+        const MATRIX3 F = Ds * DmInv;
+
+        // F = sum_j x_j c_j^T, so dF / dx_which only needs c_which
+        const VECTOR3 c = (which == 0) ? VECTOR3(-DmInv.transpose() * VECTOR3::Ones())
+                                       : VECTOR3(DmInv.row(which - 1).transpose());
+
+        // gradient and clamped Hessian block for this vertex
+        const MATRIX9 hessian = _hyperelastic.clampedHessian(F);
+        MATRIX3 block = MATRIX3::Zero();
+        for (int b = 0; b < 3; b++)
+            for (int e = 0; e < 3; e++)
+                block += (c[b] * c[e]) * hessian.block<3, 3>(3 * b, 3 * e);
+        block *= volumes[tetIndex];
+
+        // the stiffness-proportional part of the Rayleigh damping is the whole row of the tet
+        // Hessian applied to the displacements, i.e. the Hessian applied to the change in F,
+        // so rigid translations are not damped
+        const VECTOR9 damped = hessian * flatten((Ds - DsOld) * DmInv);
+        MATRIX3 P = _hyperelastic.PK1(F);
+        for (int b = 0; b < 3; b++)
+            P.col(b) += (_rayleighBeta / _dt) * damped.segment<3>(3 * b);
+
+        force -= volumes[tetIndex] * P * c;
+        H += (1.0 + _rayleighBeta / _dt) * block;
+    }
+
+    // H should be SPD, but skip the vertex if it isn't
+    const Eigen::LDLT<MATRIX3> ldlt(H);
+    if (ldlt.info() != Eigen::Success || ldlt.vectorD().minCoeff() <= 0.0)
+        return;
+    VECTOR3 updated = vertex + ldlt.solve(force);
+
+    // project back onto the plane if it went in, but let it slide along it
+    const int constraintID = _planeConstraintIDs[vertexID];
+    if (constraintID >= 0) {
+        const PLANE_CONSTRAINT& constraint = _planeConstraints[constraintID];
+        const VECTOR3 normal = constraint.shape->localNormalToWorld(constraint.localNormal);
+        const REAL depth = (updated - _constraintTargets.segment<3>(3 * vertexID)).dot(normal);
+        if (depth < 0.0)
+            updated -= depth * normal;
+    }
+
+    positions.segment<3>(3 * vertexID) = updated;
+}
+
+bool VertexBlockDescent::solve(const bool verbose) {
+    Timer functionTimer(__FUNCTION__);
+    if (verbose) {
+        RYAO_INFO("==================================================");
+        RYAO_INFO(" VERTEX BLOCK DESCENT SOLVE {}", _currentTimestep);
+        RYAO_INFO("==================================================");
+    }
+
+    // only caching this for visualization purposes
+    _positionOld = _position;
+
+    // should need to call once, but then preserved throughout
+    applyKinematicConstraints();
+
+    // build new constraints, and see where their planes are
+    _tetMesh.setDisplacement(_position);
+    findNewSurfaceConstraints(verbose);
+    updateConstraintTargets();
+
+    const int totalVertices = _DOFs / 3;
+    _planeConstraintIDs.assign(totalVertices, -1);
+    for (unsigned int x = 0; x < _planeConstraints.size(); x++)
+        if (!_planeConstraints[x].isSeparating)
+            _planeConstraintIDs[_planeConstraints[x].vertexID] = x;
+    _pinned.assign(totalVertices, false);
+    for (unsigned int x = 0; x < _kinematicConstraints.size(); x++)
+        _pinned[_kinematicConstraints[x].vertexID] = true;
+
+    // self-collisions couple vertices across colors, so they are only implicit in each vertex itself
+    computeCollisionTerms();
+
+    // the inertial target, x_n + dt * v_n + dt^2 * M^-1 f
+    const VECTOR positionsOld = _restPositions + _position;
+    VECTOR inertial = positionsOld + _dt * _velocity;
+    for (int x = 0; x < totalVertices; x++) {
+        const REAL mass = _M.coeff(3 * x, 3 * x);
+        if (mass > 0.0)
+            inertial.segment<3>(3 * x) += (_dt * _dt / mass) * _externalForces.segment<3>(3 * x);
+    }
+
+    // start from the inertial target, except for the pinned vertices
+    VECTOR positions = inertial;
+    for (int x = 0; x < totalVertices; x++)
+        if (_pinned[x])
+            positions.segment<3>(3 * x) = positionsOld.segment<3>(3 * x);
+
+    Timer sweepTimer("VBD sweeps");
+    for (int i = 0; i < _iterations; i++)
+        for (unsigned int color = 0; color < _colors.size(); color++) {
+            const vector<int>& vertices = _colors[color];
+            const int totalColored = vertices.size();
+
+            // no two vertices of the same color share a tet, so there are no races here
+#pragma omp parallel for schedule(static)
+            for (int x = 0; x < totalColored; x++) {
+                if (_pinned[vertices[x]])
+                    continue;
+                solveVertex(vertices[x], inertial, positionsOld, positions);
+            }
+        }
+    sweepTimer.stop();
+
+    // update position and velocity
+    _position = positions - _restPositions;
+    _velocity = (_position - _positionOld) / _dt;
+    _tetMesh.setDisplacement(_position);
+
+    // let go of the constraints that are outside, or moving away
+    if (findSeparatingSurfaceConstraints(_velocity))
+        deleteSurfaceConstraints(verbose);
+    updateSurfaceConstraints();
+    updateConstraintTargets();
+
+    // record which timestep we're on
+    _time += _dt;
+    _currentTimestep++;
+
+    return true;
+}
+
+}
+}
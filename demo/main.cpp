@@ -39,6 +39,7 @@ int main()
     viewer.launch();
 
     Ryao::Timer::printTimings();
+    simulation->printCollisionStats();
 
     return 0;
 }
\ No newline at end of file
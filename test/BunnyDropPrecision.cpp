@@ -0,0 +1,182 @@
+#include "Scene/BunnyDrop.h"
+#include <Logger.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace Ryao;
+using namespace std;
+
+///////////////////////////////////////////////////////////////////////
+// Runs BunnyDrop without a window, and writes the centroid of the
+// bunny after every step, and how long the step took, to a trajectory
+// file. Given the trajectory of another build, usually the double one,
+// it also reports how far this build drifted from it, and how the
+// timings compare:
+//
+//   BunnyDropPrecision <steps> <trajectory out> [reference trajectory in]
+//
+// It fails if this build drifted further from the reference than the
+// tolerances below allow.
+///////////////////////////////////////////////////////////////////////
+
+// how far the centroids can drift apart before the trajectories count as separated.
+// Two runs in the same precision should never get this far apart.
+#define TRAJECTORY_SEPARATION 1e-4
+
+// float can't stay that close to double for the whole run. Once the bunny is bouncing
+// off the obstacles, roundoff decides how each contact goes, and the runs separate.
+// With matrix-free PCG the float run stays within TRAJECTORY_SEPARATION through step
+// 120, and its worst deviation over 300 steps is 0.18.
+// It has to stay that close through FLOAT_SEPARATION_STEPS, and within
+// FLOAT_TRAJECTORY_TOLERANCE after that, so it still lands the same way.
+#define FLOAT_SEPARATION_STEPS 100
+#define FLOAT_TRAJECTORY_TOLERANCE 0.5
+
+typedef Eigen::Matrix<REAL_ACCUMULATE, 3, 1> CENTROID;
+
+struct TRAJECTORY {
+    string precision;
+    vector<CENTROID> centroids;
+    vector<double> seconds;
+};
+
+static const char* precisionName() {
+    return (sizeof(REAL) == sizeof(float)) ? "float" : "double";
+}
+
+static CENTROID computeCentroid(const vector<VECTOR3>& vertices) {
+    CENTROID sum = CENTROID::Zero();
+    for (unsigned int x = 0; x < vertices.size(); x++)
+        sum += vertices[x].cast<REAL_ACCUMULATE>();
+    return sum / (REAL_ACCUMULATE)vertices.size();
+}
+
+static bool writeTrajectory(const string& filename, const TRAJECTORY& trajectory) {
+    FILE* file = fopen(filename.c_str(), "w");
+    if (file == NULL) return false;
+
+    fprintf(file, "%s\n", trajectory.precision.c_str());
+    for (unsigned int x = 0; x < trajectory.centroids.size(); x++) {
+        const CENTROID& c = trajectory.centroids[x];
+        fprintf(file, "%.17g %.17g %.17g %.17g\n", c[0], c[1], c[2], trajectory.seconds[x]);
+    }
+    fclose(file);
+    return true;
+}
+
+static bool readTrajectory(const string& filename, TRAJECTORY& trajectory) {
+    ifstream file(filename);
+    if (!(file >> trajectory.precision)) return false;
+
+    CENTROID c;
+    double seconds;
+    while (file >> c[0] >> c[1] >> c[2] >> seconds) {
+        trajectory.centroids.push_back(c);
+        trajectory.seconds.push_back(seconds);
+    }
+    return true;
+}
+
+// the wall clock time of the whole run
+static double totalSeconds(const TRAJECTORY& trajectory) {
+    double total = 0.0;
+    for (unsigned int x = 0; x < trajectory.seconds.size(); x++)
+        total += trajectory.seconds[x];
+    return total;
+}
+
+// log how far the trajectory drifted from the reference, and whether that was too far
+static bool checkDeviation(const TRAJECTORY& trajectory, const TRAJECTORY& reference) {
+    const int steps = trajectory.centroids.size();
+    REAL_ACCUMULATE worstDeviation = 0.0;
+    int worstStep = 0;
+    int separatedStep = -1;
+    for (int x = 0; x < steps; x++) {
+        const REAL_ACCUMULATE deviation = (trajectory.centroids[x] - reference.centroids[x]).norm();
+        if (deviation > worstDeviation) {
+            worstDeviation = deviation;
+            worstStep = x + 1;
+        }
+        if (separatedStep < 0 && deviation > TRAJECTORY_SEPARATION)
+            separatedStep = x + 1;
+    }
+    const REAL_ACCUMULATE finalDeviation = (trajectory.centroids.back() - reference.centroids.back()).norm();
+
+    RYAO_INFO("Centroid deviation from {}: worst {} at step {}, final {}",
+              reference.precision, worstDeviation, worstStep, finalDeviation);
+    if (separatedStep < 0)
+        RYAO_INFO("The trajectories stay within {} for all {} steps", TRAJECTORY_SEPARATION, steps);
+    else
+        RYAO_INFO("The trajectories stay within {} through step {}", TRAJECTORY_SEPARATION, separatedStep - 1);
+
+    const double total = totalSeconds(trajectory);
+    const double referenceTotal = totalSeconds(reference);
+    RYAO_INFO("{}: {} s, {}: {} s, {}x the speed", precisionName(), total,
+              reference.precision, referenceTotal, referenceTotal / total);
+
+    // a run in the same precision has to stay within TRAJECTORY_SEPARATION the whole way
+    const bool samePrecision = (trajectory.precision == reference.precision);
+    const int separationSteps = samePrecision ? steps : min(steps, FLOAT_SEPARATION_STEPS);
+    const REAL_ACCUMULATE tolerance = samePrecision ? TRAJECTORY_SEPARATION : FLOAT_TRAJECTORY_TOLERANCE;
+    const bool separatedEarly = (separatedStep >= 0 && separatedStep <= separationSteps);
+    if (separatedEarly || worstDeviation > tolerance) {
+        RYAO_ERROR("BunnyDrop in {} FAILED: it has to stay within {} of {} through step {}, and within {} overall",
+                   precisionName(), TRAJECTORY_SEPARATION, reference.precision, separationSteps, tolerance);
+        return false;
+    }
+    RYAO_INFO("BunnyDrop in {} PASSED against {}", precisionName(), reference.precision);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Logger::Init();
+    if (argc < 3) {
+        RYAO_ERROR("Usage: {} <steps> <trajectory out> [reference trajectory in]", argv[0]);
+        return 1;
+    }
+    const int steps = atoi(argv[1]);
+
+    // buildScene() is only public through Simulation
+    BunnyDrop bunnyDrop;
+    Simulation& simulation = bunnyDrop;
+    simulation.buildScene();
+
+    // float builds already default to matrix-free PCG, the solver that accumulates in
+    // REAL_ACCUMULATE. Make the double build use it too, so both runs solve the same way.
+    simulation.getSolver()->matrixFreePCG() = true;
+
+    TRAJECTORY trajectory;
+    trajectory.precision = precisionName();
+    for (int x = 0; x < steps; x++) {
+        const auto begin = chrono::steady_clock::now();
+        simulation.stepSimulation(false);
+        const auto end = chrono::steady_clock::now();
+
+        trajectory.centroids.push_back(computeCentroid(simulation.getTetMeshVertices()));
+        trajectory.seconds.push_back(chrono::duration<double>(end - begin).count());
+    }
+
+    const double total = totalSeconds(trajectory);
+    RYAO_INFO("BunnyDrop in {}: {} steps in {} s, {} ms per step",
+              trajectory.precision, steps, total, 1e3 * total / steps);
+
+    if (!writeTrajectory(argv[2], trajectory)) {
+        RYAO_ERROR("Could not write the trajectory to {}", argv[2]);
+        return 1;
+    }
+
+    if (argc < 4)
+        return 0;
+
+    TRAJECTORY reference;
+    if (!readTrajectory(argv[3], reference) || reference.centroids.size() != trajectory.centroids.size()) {
+        RYAO_ERROR("{} is not a {} step trajectory", argv[3], steps);
+        return 1;
+    }
+    return checkDeviation(trajectory, reference) ? 0 : 1;
+}
@@ -0,0 +1,53 @@
+#include "RyaoTests.h"
+#include <Logger.h>
+#include <string>
+
+using namespace Ryao;
+
+struct TEST {
+    const char* name;
+    bool (*run)();
+};
+
+static const TEST tests[] = {
+    { "BatchedSVD",                     testBatchedSVD },
+    { "StVKClampedHessian",             testStVKClampedHessian },
+    { "SNHClampedHessian",              testSNHClampedHessian },
+    { "VertexFaceSqrtClampedHessian",   testVertexFaceSqrtClampedHessian },
+    { "EdgeSqrtClampedHessian",         testEdgeSqrtClampedHessian },
+};
+
+///////////////////////////////////////////////////////////////////////
+// run the tests named on the command line, or all of them if there
+// are none, and fail if any of them did
+///////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv) {
+    Logger::Init();
+
+    int failed = 0;
+    for (const TEST& test : tests) {
+        bool requested = (argc == 1);
+        for (int x = 1; x < argc; x++)
+            requested = requested || (std::string(argv[x]) == test.name);
+        if (!requested) continue;
+
+        RYAO_INFO("Running {}", test.name);
+        if (!test.run())
+            failed++;
+    }
+
+    // a misspelled name shouldn't pass by running nothing
+    for (int x = 1; x < argc; x++) {
+        bool found = false;
+        for (const TEST& test : tests)
+            found = found || (std::string(argv[x]) == test.name);
+        if (!found) {
+            RYAO_ERROR("There is no test called {}", argv[x]);
+            failed++;
+        }
+    }
+
+    if (failed > 0)
+        RYAO_ERROR("{} tests FAILED", failed);
+    return (failed > 0) ? 1 : 0;
+}
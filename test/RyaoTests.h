@@ -0,0 +1,23 @@
+#ifndef RYAO_TESTS_H
+#define RYAO_TESTS_H
+
+namespace Ryao {
+
+// compare the batched SVD against svd_rv on random matrices, including
+// inverted and nearly degenerate ones
+bool testBatchedSVD();
+
+// compare the analytic clamped Hessians against clampEigenvalues() on random,
+// inverted and nearly degenerate deformation gradients, and on random collision
+// pairs inside, outside and straddling the collision eps
+bool testStVKClampedHessian();
+
+// compare the SNH clamped Hessian that skips the SVD when it can against the
+// one that always takes it, on random, inverted and barely stretched F
+bool testSNHClampedHessian();
+bool testVertexFaceSqrtClampedHessian();
+bool testEdgeSqrtClampedHessian();
+
+}
+
+#endif // !RYAO_TESTS_H
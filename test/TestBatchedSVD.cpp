@@ -0,0 +1,75 @@
+#include "RyaoTests.h"
+#include <BatchedSVD.h>
+#include <MatrixUtils.h>
+#include <RandomUtils.h>
+#include <Logger.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace Ryao {
+using namespace std;
+
+// how far off is U * Sigma * V^T from F, relative to F?
+static REAL reconstructionError(const MATRIX3& F, const MATRIX3& U, const VECTOR3& Sigma, const MATRIX3& V) {
+    const REAL error = (U * Sigma.asDiagonal() * V.transpose() - F).norm();
+    return error / max(F.norm(), (REAL)1.0);
+}
+
+bool testBatchedSVD() {
+    const int samples = 10000;
+    const REAL tolerance = SVD_TOLERANCE;
+
+    vector<MATRIX3> Fs(samples);
+    for (int x = 0; x < samples; x++) {
+        switch (x % 6) {
+            case 0: Fs[x] = randomMatrix3(); break;
+            case 1: Fs[x] = randomPositiveDefiniteMatrix3(); break;
+            // inverted
+            case 2: Fs[x] = randomPositiveDefiniteMatrix3(); Fs[x].col(0) *= -1.0; break;
+            // a repeated singular value
+            case 3: Fs[x] = randomRotation() * VECTOR3(2.0, 2.0, 0.5).asDiagonal() * randomRotation(); break;
+            // nearly flat
+            case 4: Fs[x] = randomRotation() * VECTOR3(1.0, 0.5, 1e-7).asDiagonal() * randomRotation(); break;
+            // pure rotation
+            default: Fs[x] = randomRotation(); break;
+        }
+    }
+
+    // the raw kernel, without the fallback, so its failures show up here
+    vector<MATRIX3> Us(samples), Vs(samples);
+    vector<VECTOR3> Sigmas(samples);
+    for (int begin = 0; begin < samples; begin += SVD_LANES)
+        svdBlock(&Fs[begin], min(SVD_LANES, samples - begin), &Us[begin], &Sigmas[begin], &Vs[begin]);
+
+    REAL worstSigma = 0.0;
+    REAL worstReconstruction = 0.0;
+    REAL worstRotation = 0.0;
+    for (int x = 0; x < samples; x++) {
+        MATRIX3 U, V;
+        VECTOR3 Sigma;
+        svd_rv(Fs[x], U, Sigma, V);
+
+        const REAL scale = max(Sigma.cwiseAbs().maxCoeff(), (REAL)1.0);
+        worstSigma = max(worstSigma, (Sigmas[x] - Sigma).cwiseAbs().maxCoeff() / scale);
+        worstReconstruction = max(worstReconstruction, reconstructionError(Fs[x], Us[x], Sigmas[x], Vs[x]));
+
+        // U and V should be rotations, not reflections
+        const REAL rotationError = max((Us[x].transpose() * Us[x] - MATRIX3::Identity()).norm() +
+                                       fabs(Us[x].determinant() - 1.0),
+                                       (Vs[x].transpose() * Vs[x] - MATRIX3::Identity()).norm() +
+                                       fabs(Vs[x].determinant() - 1.0));
+        worstRotation = max(worstRotation, rotationError);
+    }
+
+    const bool passed = worstSigma <= tolerance && worstReconstruction <= tolerance && worstRotation <= tolerance;
+    if (passed)
+        RYAO_INFO("Batched SVD PASSED on {} matrices, worst Sigma error: {}, reconstruction: {}, rotation: {}",
+                  samples, worstSigma, worstReconstruction, worstRotation);
+    else
+        RYAO_ERROR("Batched SVD FAILED on {} matrices, worst Sigma error: {}, reconstruction: {}, rotation: {}",
+                   samples, worstSigma, worstReconstruction, worstRotation);
+    return passed;
+}
+
+}
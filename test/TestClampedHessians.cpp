@@ -0,0 +1,162 @@
+#include "RyaoTests.h"
+#include <StVK.h>
+#include <SNH.h>
+#include <VertexFaceSqrtCollision.h>
+#include <EdgeSqrtCollision.h>
+#include <CollisionUtils.h>
+#include <EigenUtils.h>
+#include <MatrixUtils.h>
+#include <RandomUtils.h>
+#include <Logger.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace Ryao {
+using namespace std;
+
+// how far off is the analytic clamp from clampEigenvalues(), relative to the clamped matrix?
+template <class MATRIX_TYPE>
+static REAL clampError(const MATRIX_TYPE& analytic, const MATRIX_TYPE& numeric) {
+    return (analytic - numeric).norm() / max(numeric.norm(), (REAL)1.0);
+}
+
+// every test below compares an analytic clamp against clampEigenvalues() on
+// random samples, so they all pass or fail on the worst error the same way
+static bool checkWorstError(const string& name, const int samples, const REAL worstError) {
+    const bool passed = worstError <= EIGENSYSTEM_TOLERANCE;
+    if (passed)
+        RYAO_INFO("{} clamped Hessian PASSED on {} samples, worst error: {}", name, samples, worstError);
+    else
+        RYAO_ERROR("{} clamped Hessian FAILED on {} samples, worst error: {}", name, samples, worstError);
+    return passed;
+}
+
+bool testStVKClampedHessian() {
+    const int samples = 10000;
+
+    REAL worstError = 0.0;
+    for (int x = 0; x < samples; x++) {
+        MATRIX3 F;
+        switch (x % 5) {
+            case 0: F = randomMatrix3(); break;
+            case 1: F = randomPositiveDefiniteMatrix3(); break;
+            // inverted
+            case 2: F = randomPositiveDefiniteMatrix3(); F.col(0) *= -1.0; break;
+            // a repeated singular value
+            case 3: F = randomRotation() * VECTOR3(2.0, 2.0, 0.5).asDiagonal() * randomRotation(); break;
+            // nearly flat
+            default: F = randomRotation() * VECTOR3(1.0, 0.5, 1e-7).asDiagonal() * randomRotation(); break;
+        }
+        const VECTOR3 moduli = randomVector3(10.0).cwiseAbs() + VECTOR3::Ones();
+        const VOLUME::StVK material(moduli[0], moduli[1]);
+
+        const MATRIX9 numeric = clampEigenvalues(material.hessian(F));
+        worstError = max(worstError, clampError(material.clampedHessian(F), numeric));
+    }
+
+    return checkWorstError("StVK", samples, worstError);
+}
+
+bool testSNHClampedHessian() {
+    const int samples = 10000;
+    const REAL stretches[] = {1e-2, 1e-5, 1e-8};
+
+    // clampedHessian(F) skips the SVD when nothing needs clamping, so compare it
+    // against the one that always takes the SVD, rather than clampEigenvalues()
+    REAL worstError = 0.0;
+    int withoutSVD = 0;
+    for (int x = 0; x < samples; x++) {
+        MATRIX3 F;
+        switch (x % 4) {
+            case 0: F = randomMatrix3(); break;
+            case 1: F = randomPositiveDefiniteMatrix3(); break;
+            // inverted
+            case 2: F = randomPositiveDefiniteMatrix3(); F.col(0) *= -1.0; break;
+            // the twist and flip eigenvalues are all zero at rest, so a barely
+            // stretched rotation sits right on the clamping threshold
+            default: {
+                const VECTOR3 Sigma = VECTOR3::Ones() + randomVector3(stretches[(x / 4) % 3]);
+                F = randomRotation() * Sigma.asDiagonal() * randomRotation();
+                break;
+            }
+        }
+        const VECTOR3 moduli = randomVector3(10.0).cwiseAbs() + VECTOR3::Ones();
+        const VOLUME::SNH material(moduli[0], moduli[1]);
+
+        MATRIX3 U, V;
+        VECTOR3 Sigma;
+        svd_rv(F, U, Sigma, V);
+        const MATRIX9 withSVD = material.clampedHessian(U, Sigma, V);
+        worstError = max(worstError, clampError(material.clampedHessian(F), withSVD));
+
+        MATRIX9 H;
+        if (material.clampedHessianWithoutSVD(F, H))
+            withoutSVD++;
+    }
+
+    // both the early return and the SVD fallback need to have been checked
+    RYAO_INFO("SNH clamped Hessian skipped the SVD on {} of {} samples", withoutSVD, samples);
+    if (withoutSVD == 0 || withoutSVD == samples) {
+        RYAO_ERROR("SNH clamped Hessian FAILED, the samples only ever took one branch");
+        return false;
+    }
+    return checkWorstError("SNH", samples, worstError);
+}
+
+bool testVertexFaceSqrtClampedHessian() {
+    const int samples = 10000;
+    const REAL eps = 0.01;
+    const VOLUME::VertexFaceSqrtCollision energy(1.0, eps);
+    const REAL scalings[] = {0.5 * eps, 2.0 * eps, 1.0};
+
+    REAL worstError = 0.0;
+    for (int x = 0; x < samples; x++) {
+        // a random triangle, and a vertex near a random point on it
+        vector<VECTOR3> v(4);
+        for (int y = 1; y < 4; y++)
+            v[y] = randomVector3(1.0);
+        const VECTOR2 b0 = randomBarycentric();
+        const VECTOR2 b1 = randomBarycentric();
+        const VECTOR3 inside = b0[0] * v[1] + b0[1] * (b1[0] * v[2] + b1[1] * v[3]);
+        v[0] = inside + randomVector3(scalings[x % 3]);
+
+        const MATRIX12 numeric = clampEigenvalues(energy.hessian(v));
+        worstError = max(worstError, clampError(energy.clampedHessian(v), numeric));
+    }
+
+    return checkWorstError("Vertex-face sqrt", samples, worstError);
+}
+
+bool testEdgeSqrtClampedHessian() {
+    const int samples = 10000;
+    const REAL eps = 0.01;
+    const VOLUME::EdgeSqrtCollision energy(1.0, eps);
+    const REAL scalings[] = {0.5 * eps, 2.0 * eps, 1.0};
+
+    REAL worstError = 0.0;
+    for (int x = 0; x < samples; x++) {
+        // a random first edge, and a second edge whose interpolated point
+        // is a random offset away from the first one's
+        vector<VECTOR3> v(4);
+        v[0] = randomVector3(1.0);
+        v[1] = randomVector3(1.0);
+        const VECTOR2 a = randomBarycentric();
+        const VECTOR2 b = randomBarycentric();
+        const VECTOR3 va = a[0] * v[0] + a[1] * v[1];
+        const VECTOR3 half = randomVector3(1.0);
+        const VECTOR3 center = va + randomVector3(scalings[x % 3]) - (b[0] - b[1]) * half;
+        v[2] = center + half;
+        v[3] = center - half;
+
+        const VECTOR12 flat = flattenVertices(v);
+        const MATRIX12 numeric = clampEigenvalues(energy.hessian(flat, a, b));
+        const MATRIX12 numericNegated = clampEigenvalues(energy.hessianNegated(flat, a, b));
+        worstError = max(worstError, clampError(energy.clampedHessian(flat, a, b), numeric));
+        worstError = max(worstError, clampError(energy.clampedHessianNegated(flat, a, b), numericNegated));
+    }
+
+    return checkWorstError("Edge sqrt", samples, worstError);
+}
+
+}